@@ -0,0 +1,102 @@
+#include "AsyncPipelineBuilder.hpp"
+
+#include <chrono>
+
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+AsyncPipelineBuilder::AsyncPipelineBuilder(vk::Device& dev, vk::PipelineCache cache, bool cacheWarm, JobSystem& jobs,
+                                           size_t maxBuilding)
+    : VulkanObject(dev),
+      cache{cache},
+      cacheWarm{cacheWarm},
+      jobs{jobs},
+      maxBuilding{maxBuilding ? maxBuilding : std::max<size_t>(1, jobs.workerCount() / 2)} {}
+
+AsyncPipelineBuilder::~AsyncPipelineBuilder() {
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      for (auto& job : queue)
+         job.handle->status.store(PipelineHandle::State::Failed, std::memory_order_release);
+      queue.clear();
+   }
+   jobs.wait(started);
+}
+
+std::shared_ptr<PipelineHandle> AsyncPipelineBuilder::build(const PipelineDesc& desc) {
+   auto handle = std::make_shared<PipelineHandle>();
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      queue.push_back({desc, handle});
+   }
+   startMore();
+
+   return handle;
+}
+
+void AsyncPipelineBuilder::waitIdle() {
+   // Each build starts the next before it finishes, so started only runs out once the queue has too
+   jobs.wait(started);
+}
+
+void AsyncPipelineBuilder::startMore() {
+   std::lock_guard<std::mutex> guard(lock);
+   while (building < maxBuilding && !queue.empty()) {
+      building++;
+      jobs.run(
+          [this, job = std::move(queue.front())]() mutable {
+             compile(job);
+             {
+                std::lock_guard<std::mutex> guard(lock);
+                building--;
+             }
+             startMore();
+          },
+          &started);
+      queue.pop_front();
+   }
+}
+
+void AsyncPipelineBuilder::compile(Job& job) {
+   PROFILE_FUNCTION();
+   auto        start = std::chrono::steady_clock::now();
+   const auto& desc  = job.desc;
+
+   try {
+      auto pipeline        = std::make_shared<GraphicsPipeline>(dev);
+      pipeline->renderPass = desc.renderPass;
+      if (desc.configure)
+         desc.configure(*pipeline);
+
+      // Modules only need to live until the pipeline's built, or until something on the way there throws.
+      std::vector<vk::UniqueShaderModule> modules;
+      std::vector<VulkanShader>           shaders;
+      auto load = [&](const std::string& path, VulkanShader::Stage stage) {
+         auto src = LoadFile(path);
+         if (src.empty())
+            throw std::runtime_error("couldn't load " + path);
+         shaders.push_back(VulkanShader::FromSrc(src, stage, dev));
+         modules.emplace_back(shaders.back().shaderMod, dev);
+      };
+
+      load(desc.vertPath, VulkanShader::Stage::Vertex);
+      if (!desc.fragPath.empty())
+         load(desc.fragPath, VulkanShader::Stage::Fragment);
+      for (const auto& shader : shaders)
+         pipeline->addStages(shader);
+
+      pipeline->build(cache);
+
+      using Ms             = std::chrono::duration<double, std::milli>;
+      double ms            = Ms(std::chrono::steady_clock::now() - start).count();
+      job.handle->pipeline = pipeline;
+      job.handle->buildMs  = ms;
+      job.handle->status.store(PipelineHandle::State::Ready, std::memory_order_release);
+
+      Logger::Info("Built pipeline ", desc.vertPath, "+", desc.fragPath, " in the background in ", ms,
+                   "ms (pipeline cache ", this->cacheWarm ? "warm" : "cold", ")");
+   } catch (const std::exception& e) {
+      job.handle->status.store(PipelineHandle::State::Failed, std::memory_order_release);
+      Logger::Error("Failed to build pipeline ", desc.vertPath, "+", desc.fragPath, ": ", e.what());
+   }
+}
@@ -0,0 +1,87 @@
+#pragma once
+/*
+ * Builds graphics pipelines as JobSystem jobs so loading SPIR-V, creating shader modules and (mostly) driver
+ * compilation never land on the frame. Compiles can take a long time, so only so many run at once; the rest queue up
+ * here rather than tying up every worker.
+ *
+ * build() hands back a PipelineHandle straight away. Until it's ready, get() returns null (or whatever fallback you
+ * give it), so a draw can either use a placeholder pipeline or just skip itself for a few frames.
+ */
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "JobSystem.hpp"
+#include "Pipeline.hpp"
+
+class PipelineHandle {
+  public:
+   enum class State { Pending, Ready, Failed };
+
+   State state() const { return status.load(std::memory_order_acquire); }
+   bool  ready() const { return state() == State::Ready; }
+
+   /// The pipeline if it's built, otherwise fallback. Safe from any thread.
+   GraphicsPipeline* get(GraphicsPipeline* fallback = nullptr) const { return ready() ? pipeline.get() : fallback; }
+   /// How long loading and compiling took in milliseconds, once it's ready.
+   double buildTime() const { return ready() ? buildMs : 0.0; }
+
+  private:
+   friend class AsyncPipelineBuilder;
+
+   std::atomic<State>                status{State::Pending};
+   std::shared_ptr<GraphicsPipeline> pipeline;  // Written once, before status goes Ready
+   double                            buildMs = 0.0;  // Likewise
+};
+
+/// Everything needed to build a pipeline off-thread.
+struct PipelineDesc {
+   std::string                 vertPath, fragPath;  // SPIR-V files. Leave fragPath empty for none.
+   std::shared_ptr<RenderPass> renderPass;
+
+   /// Sets up everything except the shader stages and render pass. Runs on a worker, so only touch the pipeline.
+   std::function<void(GraphicsPipeline&)> configure;
+};
+
+class AsyncPipelineBuilder : VulkanObject {
+  public:
+   /// cache may be null. Pipeline caches are internally synchronized, so every build shares the one. cacheWarm is
+   /// whether it came with anything from disk, so build times in the log say which they were. maxBuilding 0 means
+   /// half of jobs' workers.
+   AsyncPipelineBuilder(vk::Device& dev, vk::PipelineCache cache, bool cacheWarm = false,
+                        JobSystem& jobs = JobSystem::Main(), size_t maxBuilding = 0);
+   /// Anything still queued is marked Failed.
+   ~AsyncPipelineBuilder();
+
+   AsyncPipelineBuilder(const AsyncPipelineBuilder&) = delete;
+   AsyncPipelineBuilder& operator=(const AsyncPipelineBuilder&) = delete;
+
+   std::shared_ptr<PipelineHandle> build(const PipelineDesc& desc);
+
+   /// Blocks until nothing is queued or building. Handy at load screens.
+   void waitIdle();
+
+  private:
+   struct Job {
+      PipelineDesc                    desc;
+      std::shared_ptr<PipelineHandle> handle;
+   };
+
+   /// Starts queued builds until maxBuilding are going. Takes lock.
+   void startMore();
+   void compile(Job& job);
+
+   vk::PipelineCache cache;
+   bool              cacheWarm;
+   JobSystem&        jobs;
+   size_t            maxBuilding;
+   JobCounter        started;  // Every build that's been handed to jobs and not finished
+
+   std::mutex      lock;
+   std::deque<Job> queue;
+   size_t          building = 0;
+};
@@ -0,0 +1,126 @@
+#include "BinLog.hpp"
+
+#include <algorithm>
+#include <thread>
+
+std::atomic<bool>                  BinLog::open{false};
+std::mutex                         BinLog::fileLock;
+std::ofstream                      BinLog::file;
+std::vector<BinLog::Registered>    BinLog::sites;
+std::mutex                         BinLog::bufferListLock;
+std::vector<BinLog::ThreadBuffer*> BinLog::buffers;
+
+namespace {
+template <typename T>
+void writeRaw(std::ofstream& file, const T& val) {
+   file.write(reinterpret_cast<const sbyte*>(&val), sizeof(T));
+}
+
+void writeStr(std::ofstream& file, const std::string& str) {
+   writeRaw(file, static_cast<uint16>(str.size()));
+   file.write(str.data(), str.size());
+}
+}  // namespace
+
+BinLog::ThreadBuffer::ThreadBuffer() : storage{std::make_unique<byte[]>(BufferSize)}, data{storage.get()} {
+   std::lock_guard<std::mutex> lock(bufferListLock);
+   buffers.push_back(this);
+}
+
+BinLog::ThreadBuffer::~ThreadBuffer() {
+   std::lock_guard<std::mutex> listLock(bufferListLock);
+   buffers.erase(std::remove(buffers.begin(), buffers.end(), this), buffers.end());
+
+   lock();
+   flushLocked(*this);
+   unlock();
+}
+
+void BinLog::Open(const std::string& fileName) {
+   Close();
+
+   // Figure out how fast the timestamp counter ticks so the decoder can give us seconds.
+   using namespace std::chrono;
+   auto   wallStart = steady_clock::now();
+   uint64 start     = Timestamp();
+   std::this_thread::sleep_for(milliseconds(10));
+   uint64 end     = Timestamp();
+   double elapsed = duration<double>(steady_clock::now() - wallStart).count();
+   double ticksPerSec = (end - start) / elapsed;
+
+   std::lock_guard<std::mutex> lock(fileLock);
+   file.open(fileName, std::ios::binary | std::ios::trunc);
+   if (!file)
+      return;
+
+   file.write(Magic, sizeof(Magic));
+   writeRaw(file, Version);
+   writeRaw(file, ticksPerSec);
+   writeRaw(file, end);  // Time 0 as far as the decoder is concerned
+
+   // Anything that registered before we had a file still needs its format in this one.
+   for (uint32 id = 0; id < sites.size(); id++)
+      writeFormat(id);
+
+   open.store(true, std::memory_order_release);
+}
+
+void BinLog::Close() {
+   Flush();
+
+   std::lock_guard<std::mutex> lock(fileLock);
+   open.store(false, std::memory_order_release);
+   if (file.is_open())
+      file.close();
+}
+
+void BinLog::Flush() {
+   std::lock_guard<std::mutex> listLock(bufferListLock);
+   for (auto* buf : buffers) {
+      buf->lock();
+      flushLocked(*buf);
+      buf->unlock();
+   }
+
+   std::lock_guard<std::mutex> lock(fileLock);
+   if (file.is_open())
+      file.flush();
+}
+
+uint32 BinLog::Register(const Site& site, const ArgType* sig, size_t argc) {
+   std::lock_guard<std::mutex> lock(fileLock);
+
+   uint32 id = sites.size();
+   sites.push_back({site.type, site.format, std::vector<ArgType>(sig, sig + argc)});
+
+   // Written straight to the file (not a thread buffer) so it's guaranteed to land before any event using it.
+   if (file.is_open())
+      writeFormat(id);
+
+   return id;
+}
+
+void BinLog::writeFormat(uint32 id) {
+   const auto& site = sites[id];
+
+   writeRaw(file, Entry::Format);
+   writeRaw(file, id);
+   writeStr(file, site.type);
+   writeStr(file, site.format);
+   writeRaw(file, static_cast<uint8>(site.signature.size()));
+   file.write(reinterpret_cast<const sbyte*>(site.signature.data()), site.signature.size());
+}
+
+void BinLog::flushLocked(ThreadBuffer& buf) {
+   if (buf.used == 0)
+      return;
+
+   std::lock_guard<std::mutex> lock(fileLock);
+   if (file.is_open()) {
+      writeRaw(file, Entry::Chunk);
+      writeRaw(file, static_cast<uint32>(buf.used));
+      file.write(reinterpret_cast<const sbyte*>(buf.data), buf.used);
+   }
+
+   buf.used = 0;
+}
@@ -0,0 +1,243 @@
+#pragma once
+/*
+ * Deferred-format binary logging. Each BINLOG() call site registers its type, format string and argument signature
+ * once (the signature and placeholder count are worked out at compile time). After that, a call only memcpys a TSC
+ * timestamp and the raw argument bytes into a per-thread buffer. Nothing gets turned into text until glen-logdecode
+ * reads the .binlog back, so leaving this on in production costs next to nothing.
+ *
+ * Usage: BINLOG("VULKAN", "{} said: {}", layerPrefix, msg);
+ *
+ * Deliberately knows nothing about SDL so the decoder tool can include it standalone.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Types.hpp"
+
+class BinLog {
+  public:
+   /// On-disk type codes for arguments. Don't reorder; old .binlogs depend on these.
+   enum class ArgType : uint8 { I8, U8, I16, U16, I32, U32, I64, U64, F32, F64, Bool, Char, Str };
+
+   /// Tags for each top-level entry in a .binlog after the file header.
+   enum class Entry : uint8 {
+      Format = 1,  ///< u32 id, u16 len + type, u16 len + format, u8 argc, argc * ArgType
+      Chunk  = 2,  ///< u32 len, then len bytes of packed events from one thread
+   };
+
+   static constexpr char   Magic[8]   = {'G', 'L', 'E', 'N', 'B', 'L', 'O', 'G'};
+   static constexpr uint32 Version    = 1;
+   static constexpr size_t BufferSize = 64 * 1024;  // Per thread
+   static constexpr size_t MaxStrLen  = 0xFFFF;
+
+   /// Everything the decoder needs to know about one call site.
+   struct Site {
+      const char* type;
+      const char* format;
+   };
+
+   /// Maps a C++ argument type to what we store for it. Anything not listed here is a compile error.
+   template <typename T, typename = void>
+   struct ArgTraits;
+
+   static constexpr size_t CountPlaceholders(const char* fmt) {
+      size_t count = 0;
+      for (; *fmt; fmt++)
+         if (fmt[0] == '{' && fmt[1] == '}') {
+            count++;
+            fmt++;
+         }
+      return count;
+   }
+
+   static inline uint64 Timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#else
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+#endif
+   }
+
+   /// Starts writing to fileName. Calibrates the timestamp counter (~10ms) so the decoder can turn ticks into seconds.
+   static void Open(const std::string& fileName);
+   /// Pushes every thread's pending events to the file, then closes it.
+   static void Close();
+   /// Pushes every thread's pending events to the file.
+   static void Flush();
+
+   static bool IsOpen() { return open.load(std::memory_order_relaxed); }
+
+   /// Called once per call site, the first time it's hit. Returns the id the site's events are tagged with.
+   static uint32 Register(const Site& site, const ArgType* sig, size_t argc);
+
+   /// Use BINLOG() instead of calling this directly; the lambda is what makes each call site unique.
+   template <typename SiteFn, typename... Args>
+   static void Log(SiteFn site, const Args&... args) {
+      static_assert(CountPlaceholders(site().format) == sizeof...(Args), "BINLOG: {} count doesn't match arguments");
+      static constexpr std::array<ArgType, sizeof...(Args)> signature = {ArgTraits<Args>::Type...};
+
+      static const uint32 id = Register(site(), signature.data(), sizeof...(Args));
+
+      if (!IsOpen())
+         return;
+
+      ThreadBuffer& buf  = localBuffer();
+      size_t        size = sizeof(uint32) + sizeof(uint64) + (ArgTraits<Args>::size(args) + ... + 0);
+      if (size > BufferSize)
+         return;  // A single event bigger than a whole buffer. Don't even bother.
+
+      buf.lock();
+      if (buf.used + size > BufferSize)
+         flushLocked(buf);
+
+      byte* out = buf.data + buf.used;
+      put(out, id);
+      put(out, Timestamp());
+      (ArgTraits<Args>::write(out, args), ...);
+      buf.used = out - buf.data;
+      buf.unlock();
+   }
+
+  private:
+   struct ThreadBuffer {
+      ThreadBuffer();
+      ~ThreadBuffer();
+
+      // Only ever contended when another thread calls Flush(), so a spinlock is fine.
+      void lock() {
+         while (busy.test_and_set(std::memory_order_acquire))
+            ;
+      }
+      void unlock() { busy.clear(std::memory_order_release); }
+
+      std::atomic_flag        busy = ATOMIC_FLAG_INIT;
+      size_t                  used = 0;
+      std::unique_ptr<byte[]> storage;
+      byte*                   data;
+   };
+
+   template <typename T>
+   static void put(byte*& out, const T& val) {
+      std::memcpy(out, &val, sizeof(T));
+      out += sizeof(T);
+   }
+
+   static ThreadBuffer& localBuffer() {
+      static thread_local ThreadBuffer buf;
+      return buf;
+   }
+
+   /// Writes buf out as a Chunk. Caller holds buf's lock.
+   static void flushLocked(ThreadBuffer& buf);
+   static void writeFormat(uint32 id);
+
+   struct Registered {
+      std::string          type, format;
+      std::vector<ArgType> signature;
+   };
+
+   // Lock order is always bufferListLock -> a ThreadBuffer's lock -> fileLock
+   static std::atomic<bool>          open;
+   static std::mutex                 fileLock;  // Guards file and sites
+   static std::ofstream              file;
+   static std::vector<Registered>    sites;
+   static std::mutex                 bufferListLock;
+   static std::vector<ThreadBuffer*> buffers;
+};
+
+// Arithmetic types are stored raw, at their own width.
+#define BINLOG_RAW_ARG(CTYPE, CODE)                                                            \
+   template <>                                                                                 \
+   struct BinLog::ArgTraits<CTYPE> {                                                           \
+      static constexpr ArgType Type = ArgType::CODE;                                           \
+      static constexpr size_t  size(const CTYPE&) { return sizeof(CTYPE); }                    \
+      static void              write(byte*& out, const CTYPE& val) { BinLog::put(out, val); } \
+   };
+
+BINLOG_RAW_ARG(int8, I8)
+BINLOG_RAW_ARG(uint8, U8)
+BINLOG_RAW_ARG(int16, I16)
+BINLOG_RAW_ARG(uint16, U16)
+BINLOG_RAW_ARG(int32, I32)
+BINLOG_RAW_ARG(uint32, U32)
+BINLOG_RAW_ARG(int64, I64)
+BINLOG_RAW_ARG(uint64, U64)
+BINLOG_RAW_ARG(float, F32)
+BINLOG_RAW_ARG(double, F64)
+BINLOG_RAW_ARG(bool, Bool)
+BINLOG_RAW_ARG(char, Char)
+
+#undef BINLOG_RAW_ARG
+
+// long/size_t are a distinct type from int64/uint64 on some platforms. Store them as whichever is the same width.
+template <typename T>
+struct BinLog::ArgTraits<T,
+                         std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, int8> &&
+                                          !std::is_same_v<T, uint8> && !std::is_same_v<T, int16> &&
+                                          !std::is_same_v<T, uint16> && !std::is_same_v<T, int32> &&
+                                          !std::is_same_v<T, uint32> && !std::is_same_v<T, int64> &&
+                                          !std::is_same_v<T, uint64> && !std::is_same_v<T, bool> &&
+                                          !std::is_same_v<T, char>>>
+    : BinLog::ArgTraits<std::conditional_t<std::is_signed_v<T>, int64, uint64>> {
+   static_assert(sizeof(T) <= sizeof(uint64));
+   static void write(byte*& out, const T& val) {
+      BinLog::ArgTraits<std::conditional_t<std::is_signed_v<T>, int64, uint64>>::write(out, val);
+   }
+   static constexpr size_t size(const T&) { return sizeof(uint64); }
+};
+
+// Enums go out as their underlying value
+template <typename T>
+struct BinLog::ArgTraits<T, std::enable_if_t<std::is_enum_v<T>>> : BinLog::ArgTraits<std::underlying_type_t<T>> {
+   static void write(byte*& out, const T& val) {
+      BinLog::ArgTraits<std::underlying_type_t<T>>::write(out, ToBase(val));
+   }
+   static constexpr size_t size(const T&) { return sizeof(std::underlying_type_t<T>); }
+};
+
+// Strings are the one thing we can't avoid copying. u16 length, then the bytes (no terminator).
+struct BinLogStrArg {
+   static constexpr BinLog::ArgType Type = BinLog::ArgType::Str;
+
+   static size_t length(const char* str) { return str ? std::min(std::strlen(str), BinLog::MaxStrLen) : 0; }
+   static size_t size(const char* str) { return sizeof(uint16) + length(str); }
+   static size_t size(const std::string& str) { return sizeof(uint16) + std::min(str.size(), BinLog::MaxStrLen); }
+
+   static void write(byte*& out, const char* str, size_t len) {
+      uint16 len16 = static_cast<uint16>(len);
+      std::memcpy(out, &len16, sizeof(len16));
+      out += sizeof(len16);
+      std::memcpy(out, str, len);
+      out += len;
+   }
+   static void write(byte*& out, const char* str) { write(out, str, length(str)); }
+   static void write(byte*& out, const std::string& str) {
+      write(out, str.data(), std::min(str.size(), BinLog::MaxStrLen));
+   }
+};
+
+template <>
+struct BinLog::ArgTraits<const char*> : BinLogStrArg {};
+template <>
+struct BinLog::ArgTraits<char*> : BinLogStrArg {};
+template <size_t N>
+struct BinLog::ArgTraits<char[N]> : BinLogStrArg {};
+template <>
+struct BinLog::ArgTraits<std::string> : BinLogStrArg {};
+
+#define BINLOG(TYPE, FORMAT, ...) BinLog::Log([] { return BinLog::Site{TYPE, FORMAT}; }, ##__VA_ARGS__)
@@ -0,0 +1,93 @@
+#pragma once
+/*
+ * Dense block storage for one chunk, plus the padded copy the mesher works from.
+ *
+ * Blocks are x-fastest: index = x + y * ChunkSize + z * ChunkSize². Block 0 is air; everything else is opaque as far
+ * as meshing is concerned.
+ *
+ * ChunkSize is a compile time constant (define GLEN_CHUNK_SIZE to change it). The mesher keeps a whole padded column
+ * in one uint64, so it can't go past 62.
+ */
+
+#include <cstring>
+
+#include "Types.hpp"
+
+#ifndef GLEN_CHUNK_SIZE
+#define GLEN_CHUNK_SIZE 32
+#endif
+
+using BlockId = uint16;
+
+constexpr int32  ChunkSize   = GLEN_CHUNK_SIZE;
+constexpr size_t ChunkVolume = size_t(ChunkSize) * ChunkSize * ChunkSize;
+static_assert(ChunkSize >= 1 && ChunkSize <= 62, "A padded chunk column has to fit in a uint64");
+
+struct Chunk {
+   BlockId blocks[ChunkVolume] = {};
+
+   static constexpr size_t Index(int32 x, int32 y, int32 z) {
+      return size_t(x) + size_t(y) * ChunkSize + size_t(z) * ChunkSize * ChunkSize;
+   }
+
+   BlockId  at(int32 x, int32 y, int32 z) const { return blocks[Index(x, y, z)]; }
+   BlockId& at(int32 x, int32 y, int32 z) { return blocks[Index(x, y, z)]; }
+
+   /// Copies out the ChunkSize blocks of row (y, z). Every chunk storage has this; it's what PaddedChunk reads.
+   void decodeRow(int32 y, int32 z, BlockId* out) const {
+      std::memcpy(out, &blocks[Index(0, y, z)], ChunkSize * sizeof(BlockId));
+   }
+};
+
+/// A chunk plus a one block border taken from its 26 neighbours, which is all the mesher needs to cull faces against
+/// the next chunk over and get ambient occlusion right at the edges.
+struct PaddedChunk {
+   static constexpr int32  Size   = ChunkSize + 2;
+   static constexpr size_t Volume = size_t(Size) * Size * Size;
+
+   BlockId blocks[Volume] = {};
+
+   /// Padded coordinates, so 0 and Size - 1 are the neighbours' blocks.
+   static constexpr size_t Index(int32 x, int32 y, int32 z) {
+      return size_t(x) + size_t(y) * Size + size_t(z) * Size * Size;
+   }
+
+   BlockId at(int32 x, int32 y, int32 z) const { return blocks[Index(x, y, z)]; }
+
+   /// neighbours[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 9], so [13] is the chunk itself. Missing neighbours count as air.
+   /// Works with any chunk storage that has at() and decodeRow(), i.e. Chunk or PalettedChunk.
+   template <typename Storage>
+   void fill(const Storage* const neighbours[27]) {
+      auto source = [&](int32 p, int32& local) {
+         if (p == 0) {
+            local = ChunkSize - 1;
+            return 0;
+         }
+         if (p == Size - 1) {
+            local = 0;
+            return 2;
+         }
+         local = p - 1;
+         return 1;
+      };
+
+      for (int32 z = 0; z < Size; z++) {
+         int32 lz, cz = source(z, lz);
+         for (int32 y = 0; y < Size; y++) {
+            int32    ly, cy = source(y, ly);
+            BlockId* row    = &blocks[Index(0, y, z)];
+
+            const Storage* left   = neighbours[0 + cy * 3 + cz * 9];
+            const Storage* middle = neighbours[1 + cy * 3 + cz * 9];
+            const Storage* right  = neighbours[2 + cy * 3 + cz * 9];
+
+            row[0] = left ? left->at(ChunkSize - 1, ly, lz) : 0;
+            if (middle)
+               middle->decodeRow(ly, lz, row + 1);
+            else
+               std::memset(row + 1, 0, ChunkSize * sizeof(BlockId));
+            row[Size - 1] = right ? right->at(0, ly, lz) : 0;
+         }
+      }
+   }
+};
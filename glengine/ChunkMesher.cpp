@@ -0,0 +1,162 @@
+#include "ChunkMesher.hpp"
+
+#include "Profiler.hpp"
+
+namespace {
+constexpr uint64 InnerBits = ((uint64(1) << ChunkSize) - 1) << 1;  // Skips the padding at either end of a column
+
+inline int32 LowestBit(uint64 bits) {
+   return __builtin_ctzll(bits);
+}
+
+inline uint32 Occlusion(bool side1, bool side2, bool corner) {
+   return side1 && side2 ? 0 : 3 - (side1 + side2 + corner);
+}
+}  // namespace
+
+void QuadIndices(uint32 quadCount, std::vector<uint32>& out) {
+   out.reserve(out.size() + size_t(quadCount) * 6);
+   for (uint32 q = 0; q < quadCount; q++) {
+      uint32 base = q * 4;
+      out.insert(out.end(), {base, base + 1, base + 2, base + 2, base + 3, base});
+   }
+}
+
+size_t ChunkMesher::mesh(const PaddedChunk& chunk, std::vector<VoxelVertex>& out) {
+   PROFILE_FUNCTION();
+   size_t before = out.size();
+
+   buildColumns(chunk);
+   for (int32 face = 0; face < 6; face++)
+      meshFace(chunk, Face(face), out);
+
+   return (out.size() - before) / 4;
+}
+
+void ChunkMesher::buildColumns(const PaddedChunk& chunk) {
+   std::memset(columns, 0, sizeof(columns));
+
+   for (int32 z = 0; z < Size; z++) {
+      for (int32 y = 0; y < Size; y++) {
+         const BlockId* row  = &chunk.blocks[PaddedChunk::Index(0, y, z)];
+         uint64         xCol = 0;
+         for (int32 x = 0; x < Size; x++) {
+            uint64 solid = row[x] != 0;
+            xCol |= solid << x;
+            columns[1][x * Size + z] |= solid << y;
+            columns[2][y * Size + x] |= solid << z;
+         }
+         columns[0][z * Size + y] = xCol;
+      }
+   }
+}
+
+void ChunkMesher::meshFace(const PaddedChunk& chunk, Face face, std::vector<VoxelVertex>& out) {
+   const int32 axis = int32(face) / 2, uAxis = (axis + 1) % 3, vAxis = (axis + 2) % 3;
+   const bool  neg  = int32(face) & 1;
+
+   // Scatter each column's visible faces into their slices
+   std::memset(faces, 0, sizeof(faces));
+   uint64 anyFaces = 0;
+   for (int32 v = 1; v <= ChunkSize; v++) {
+      for (int32 u = 1; u <= ChunkSize; u++) {
+         uint64 col     = columns[axis][v * Size + u];
+         uint64 visible = (neg ? col & ~(col << 1) : col & ~(col >> 1)) & InnerBits;
+         anyFaces |= visible;
+         for (; visible; visible &= visible - 1)
+            faces[LowestBit(visible)][v] |= uint64(1) << u;
+      }
+   }
+
+   for (; anyFaces; anyFaces &= anyFaces - 1) {
+      const int32 slice = LowestBit(anyFaces);
+      const int32 front = neg ? slice - 1 : slice + 1;
+      uint64*     rows  = faces[slice];
+
+      for (int32 v = 1; v <= ChunkSize; v++) {
+         for (uint64 bits = rows[v]; bits; bits &= bits - 1) {
+            int32 u = LowestBit(bits);
+            int32 pos[3];
+            pos[axis] = slice, pos[uAxis] = u, pos[vAxis] = v;
+
+            auto s = [&](int32 du, int32 dv) { return solid(axis, front, u + du, v + dv); };
+            bool l = s(-1, 0), r = s(1, 0), d = s(0, -1), t = s(0, 1);
+
+            uint32 ao = Occlusion(l, d, s(-1, -1)) | Occlusion(r, d, s(1, -1)) << 2 | Occlusion(r, t, s(1, 1)) << 4 |
+                        Occlusion(l, t, s(-1, 1)) << 6;
+            keys[v * Size + u] = uint32(chunk.at(pos[0], pos[1], pos[2])) << 8 | ao;
+         }
+      }
+
+      for (int32 v = 1; v <= ChunkSize; v++) {
+         while (rows[v]) {
+            const int32  u   = LowestBit(rows[v]);
+            const uint32 key = keys[v * Size + u];
+
+            int32 w = 1;
+            while (u + w <= ChunkSize && (rows[v] >> (u + w) & 1) && keys[v * Size + u + w] == key)
+               w++;
+            const uint64 run = ((uint64(1) << w) - 1) << u;
+
+            int32 h = 1;
+            for (; v + h <= ChunkSize && (rows[v + h] & run) == run; h++) {
+               const uint32* rowKeys = &keys[(v + h) * Size + u];
+               int32         i       = 0;
+               while (i < w && rowKeys[i] == key)
+                  i++;
+               if (i < w)
+                  break;
+            }
+
+            for (int32 i = 0; i < h; i++)
+               rows[v + i] &= ~run;
+
+            // Back to chunk coordinates, where a block at i spans i to i + 1
+            uint32 ao[4] = {key & 3, key >> 2 & 3, key >> 4 & 3, key >> 6 & 3};
+            uint32 cu[4] = {uint32(u - 1), uint32(u - 1 + w), uint32(u - 1 + w), uint32(u - 1)};
+            uint32 cv[4] = {uint32(v - 1), uint32(v - 1), uint32(v - 1 + h), uint32(v - 1 + h)};
+            uint32 d     = neg ? slice - 1 : slice;
+
+            // The index pattern splits along the first and third vertex, so start one corner round if the other
+            // diagonal is brighter
+            static constexpr int32 Orders[2][2][4] = {{{0, 1, 2, 3}, {1, 2, 3, 0}}, {{0, 3, 2, 1}, {3, 2, 1, 0}}};
+            const int32*           order           = Orders[neg][ao[1] + ao[3] > ao[0] + ao[2]];
+
+            for (int32 i = 0; i < 4; i++) {
+               int32  c = order[i];
+               uint32 p[3];
+               p[axis] = d, p[uAxis] = cu[c], p[vAxis] = cv[c];
+               out.push_back({VoxelVertex::Pack(p[0], p[1], p[2], face, ao[c]), key >> 8});
+            }
+         }
+      }
+   }
+}
+
+MeshingPool::MeshingPool(JobSystem& jobs) : jobs{jobs}, scratch(jobs.workerCount()) {}
+
+MeshingPool::~MeshingPool() {
+   dropping.store(true, std::memory_order_relaxed);
+   waitIdle();
+}
+
+void MeshingPool::submit(std::shared_ptr<const PaddedChunk> chunk, Done done) {
+   jobs.run(
+       [this, chunk = std::move(chunk), done = std::move(done)] {
+          if (dropping.load(std::memory_order_relaxed))
+             return;
+
+          PROFILE_ZONE("MeshChunk");
+          Scratch& local = scratch[jobs.workerIndex()];
+          if (!local.mesher)
+             local.mesher = std::make_unique<ChunkMesher>();
+
+          local.vertices.clear();
+          size_t quads = local.mesher->mesh(*chunk, local.vertices);
+          if (done)
+             done(local.vertices.data(), quads);
+       },
+       &meshing);
+}
+
+void MeshingPool::waitIdle() { jobs.wait(meshing); }
@@ -0,0 +1,107 @@
+#pragma once
+/*
+ * Greedy meshing of chunks into quads.
+ *
+ * Face visibility is done with bitmasks rather than per block: every column of the padded chunk along each axis is one
+ * uint64 of "is solid" bits, so the visible +X faces of a whole column are col & ~(col >> 1), 64 blocks at a time.
+ * Those get scattered into a bit grid per slice, and each slice is greedily merged into the largest rectangles it can
+ * make out of faces with the same block and the same ambient occlusion.
+ *
+ * AO is the usual 0-3 per corner (3 is unoccluded) from the two side blocks and the corner block in front of the
+ * face. Faces only merge with identical corners, so it never gets smeared across a big quad, and each quad is split
+ * along its brighter diagonal so the shading doesn't come out anisotropic.
+ *
+ * Output is 4 VoxelVertex per quad, counter-clockwise seen from outside, to be drawn with the fixed 0 1 2 2 3 0
+ * index pattern (QuadIndices). The vertex struct's 8 bytes are meant to be uploaded as is:
+ *
+ *    VERTEX_LAYOUT(VoxelVertex, packed, block);
+ *
+ * MeshingPool runs ChunkMesher as jobs on a JobSystem and hands each result to a callback on the worker, so it can be
+ * memcpy'd straight into an upload (UploadQueue::upload, IndirectRenderer::add, a mapped buffer) without another copy.
+ */
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Chunk.hpp"
+#include "JobSystem.hpp"
+#include "Types.hpp"
+
+/// Which way a face points. Axis is Face / 2, and odd ones point down the axis.
+enum class Face : uint8 { PosX, NegX, PosY, NegY, PosZ, NegZ };
+
+struct VoxelVertex {
+   uint32 packed;  // x | y << 6 | z << 12 | face << 18 | ao << 21. Positions are corners, so 0 to ChunkSize.
+   uint32 block;   // BlockId. The rest is free for whatever the shader wants.
+
+   static constexpr uint32 Pack(uint32 x, uint32 y, uint32 z, Face face, uint32 ao) {
+      return x | y << 6 | z << 12 | uint32(face) << 18 | ao << 21;
+   }
+
+   uint32 x() const { return packed & 63; }
+   uint32 y() const { return packed >> 6 & 63; }
+   uint32 z() const { return packed >> 12 & 63; }
+   Face   face() const { return Face(packed >> 18 & 7); }
+   uint32 ao() const { return packed >> 21 & 3; }
+};
+static_assert(sizeof(VoxelVertex) == 8, "VoxelVertex gets uploaded as is");
+
+/// Appends the 0 1 2 2 3 0 pattern for quadCount quads to out. Every mesh can share one big buffer of these.
+void QuadIndices(uint32 quadCount, std::vector<uint32>& out);
+
+/// Single threaded; keeps its scratch space between calls, so keep one around per thread.
+class ChunkMesher {
+  public:
+   /// A checkerboard, the worst case.
+   static constexpr size_t MaxQuads    = ChunkVolume / 2 * 6;
+   static constexpr size_t MaxVertices = MaxQuads * 4;
+
+   /// Appends to out and returns the number of quads added.
+   size_t mesh(const PaddedChunk& chunk, std::vector<VoxelVertex>& out);
+
+  private:
+   static constexpr int32 Size = PaddedChunk::Size;
+
+   void buildColumns(const PaddedChunk& chunk);
+   void meshFace(const PaddedChunk& chunk, Face face, std::vector<VoxelVertex>& out);
+   bool solid(int32 axis, int32 i, int32 u, int32 v) const { return columns[axis][v * Size + u] >> i & 1; }
+
+   // [axis][v * Size + u] -> solid bits along axis, where u and v are the next two axes round (so Y, Z for X)
+   uint64 columns[3][Size * Size];
+   // [slice][v] -> bits over u of visible faces, and the merge key (block, AO) of each one
+   uint64 faces[Size][Size];
+   uint32 keys[Size * Size];
+};
+
+class MeshingPool {
+  public:
+   /// Called on a worker with the finished mesh. The vertices are only valid for the duration of the call.
+   using Done = std::function<void(const VoxelVertex* vertices, size_t quadCount)>;
+
+   explicit MeshingPool(JobSystem& jobs = JobSystem::Main());
+   /// Chunks that haven't started meshing yet are dropped; waits for the rest.
+   ~MeshingPool();
+
+   MeshingPool(const MeshingPool&) = delete;
+   MeshingPool& operator=(const MeshingPool&) = delete;
+
+   void submit(std::shared_ptr<const PaddedChunk> chunk, Done done);
+   /// Blocks (helping out, if this is a worker) until nothing is queued or meshing.
+   void waitIdle();
+
+   size_t workerCount() const { return jobs.workerCount(); }
+
+  private:
+   /// Per worker, so a mesher's never shared. Meshing jobs never wait, so one can't be interrupted by another.
+   struct Scratch {
+      std::unique_ptr<ChunkMesher> mesher;
+      std::vector<VoxelVertex>     vertices;
+   };
+
+   JobSystem&           jobs;
+   JobCounter           meshing;
+   std::atomic<bool>    dropping{false};
+   std::vector<Scratch> scratch;
+};
@@ -0,0 +1,85 @@
+#include "CommandRecorder.hpp"
+
+#include "Profiler.hpp"
+
+CommandRecorder::CommandRecorder(vk::Device& dev, uint32 queueFamily, size_t framesInFlight, JobSystem& jobs)
+    : VulkanObject(dev), jobs{jobs} {
+   // Transient, and no eResetCommandBuffer: buffers only ever get recycled a whole pool at a time.
+   auto poolInfo =
+       vk::CommandPoolCreateInfo().setQueueFamilyIndex(queueFamily).setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+
+   pools.resize(framesInFlight);
+   for (auto& framePools : pools) {
+      framePools.resize(jobs.workerCount());
+      for (auto& pool : framePools)
+         pool.pool = dev.createCommandPool(poolInfo);
+
+      framePools[0].primary = dev.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+                                                             .setCommandPool(framePools[0].pool)
+                                                             .setLevel(vk::CommandBufferLevel::ePrimary)
+                                                             .setCommandBufferCount(1))[0];
+   }
+}
+
+CommandRecorder::~CommandRecorder() {
+   // Destroying a pool frees everything allocated from it
+   for (auto& framePools : pools)
+      for (auto& pool : framePools)
+         dev.destroyCommandPool(pool.pool);
+}
+
+void CommandRecorder::beginFrame(size_t frame) {
+   PROFILE_FUNCTION();
+   this->frame = frame;
+
+   for (auto& pool : pools[frame]) {
+      dev.resetCommandPool(pool.pool, vk::CommandPoolResetFlags());
+      pool.used = 0;
+   }
+}
+
+vk::CommandBuffer CommandRecorder::primary() { return pools[frame][0].primary; }
+
+const std::vector<vk::CommandBuffer>& CommandRecorder::record(const std::vector<RecordFunc>&        funcs,
+                                                              const vk::CommandBufferInheritanceInfo& inherit) {
+   PROFILE_FUNCTION();
+   this->result.assign(funcs.size(), vk::CommandBuffer());
+
+   auto beginInfo = vk::CommandBufferBeginInfo()
+                        .setFlags(vk::CommandBufferUsageFlagBits::eRenderPassContinue |
+                                  vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
+                        .setPInheritanceInfo(&inherit);
+
+   // One func per job, since each is already about a worker's worth. It's recorded from whichever worker picks it up's
+   // pool. A worker can pick up another func while waiting inside one, but that's the same thread, so the pool still
+   // isn't used from two threads at once.
+   this->jobs.parallelFor(
+       0, funcs.size(),
+       [&](size_t begin, size_t end) {
+          PROFILE_ZONE("RecordSecondaries");
+          Pool& pool = this->pools[this->frame][this->jobs.workerIndex()];
+          for (size_t i = begin; i < end; i++) {
+             auto cmd = nextSecondary(pool);
+             cmd.begin(beginInfo);
+             funcs[i](cmd);
+             cmd.end();
+             this->result[i] = cmd;
+          }
+       },
+       1);
+
+   return result;
+}
+
+vk::CommandBuffer CommandRecorder::nextSecondary(Pool& pool) {
+   // Allocations stick around across resets, so after the first few frames this never allocates.
+   if (pool.used == pool.secondaries.size()) {
+      auto more = dev.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+                                                 .setCommandPool(pool.pool)
+                                                 .setLevel(vk::CommandBufferLevel::eSecondary)
+                                                 .setCommandBufferCount(std::max<size_t>(pool.secondaries.size(), 4)));
+      pool.secondaries.insert(pool.secondaries.end(), more.begin(), more.end());
+   }
+
+   return pool.secondaries[pool.used++];
+}
@@ -0,0 +1,58 @@
+#pragma once
+/*
+ * Per-frame, multithreaded command recording.
+ *
+ * Every (frame in flight, JobSystem worker) pair owns its own transient command pool, so workers never share a pool and
+ * a whole frame's worth of buffers is recycled with one vkResetCommandPool instead of freeing them one by one. Each
+ * frame, the list of RecordFuncs is run as jobs; each one records into its own secondary command buffer, and the
+ * results come back in the same order as the funcs so the primary can vkCmdExecuteCommands them deterministically.
+ */
+
+#include <functional>
+#include <vector>
+
+#include "VulkanBase.hpp"
+
+#include "JobSystem.hpp"
+#include "Types.hpp"
+
+class CommandRecorder : VulkanObject {
+  public:
+   /// Records into an already begun secondary buffer. Dynamic state (viewport, scissor) isn't inherited from the
+   /// primary, so set it in here.
+   using RecordFunc = std::function<void(vk::CommandBuffer cmd)>;
+
+   /// record() has to be called from one of jobs' workers; a JobSystem with one worker records everything inline.
+   CommandRecorder(vk::Device& dev, uint32 queueFamily, size_t framesInFlight, JobSystem& jobs = JobSystem::Main());
+   ~CommandRecorder();
+
+   CommandRecorder(const CommandRecorder&) = delete;
+   CommandRecorder& operator=(const CommandRecorder&) = delete;
+
+   /// Recycles everything frame recorded last time around. Only call once that frame's fence has signaled.
+   void beginFrame(size_t frame);
+
+   /// The (unbegun) primary buffer for the current frame.
+   vk::CommandBuffer primary();
+
+   /// Records funcs[i] into result[i], in parallel. Blocks until they're all done.
+   const std::vector<vk::CommandBuffer>& record(const std::vector<RecordFunc>&        funcs,
+                                                const vk::CommandBufferInheritanceInfo& inherit);
+
+   size_t workerCount() const { return jobs.workerCount(); }
+
+  private:
+   struct Pool {
+      vk::CommandPool                pool;
+      std::vector<vk::CommandBuffer> secondaries;
+      size_t                         used = 0;
+      vk::CommandBuffer              primary;  // Only allocated for worker 0's pools
+   };
+
+   vk::CommandBuffer nextSecondary(Pool& pool);
+
+   JobSystem&                     jobs;
+   std::vector<std::vector<Pool>> pools;  // [frame][worker]
+   size_t                         frame = 0;
+   std::vector<vk::CommandBuffer> result;
+};
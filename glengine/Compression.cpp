@@ -0,0 +1,178 @@
+#include "Compression.hpp"
+
+#include <cstring>
+
+namespace {
+constexpr size_t MinMatch     = 4;
+constexpr size_t LastLiterals = 5;   // The block always ends in at least this many literals...
+constexpr size_t MatchLimit   = 12;  // ...and no match starts this close to the end
+constexpr uint32 HashBits     = 13;
+constexpr size_t MaxOffset    = 65535;
+
+inline uint32 Read32(const ubyte* p) {
+   uint32 v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+inline uint32 Hash(uint32 v) {
+   return (v * 2654435761u) >> (32 - HashBits);
+}
+
+/// 15 in the token, then 255s until the remainder.
+inline ubyte* WriteLength(ubyte* op, size_t len) {
+   for (; len >= 255; len -= 255)
+      *op++ = 255;
+   *op++ = ubyte(len);
+   return op;
+}
+
+inline ubyte* WriteSequence(ubyte* op, const ubyte* literals, size_t literalLen, size_t offset, size_t matchLen) {
+   ubyte* token = op++;
+   *token       = ubyte((literalLen >= 15 ? 15 : literalLen) << 4);
+   if (literalLen >= 15)
+      op = WriteLength(op, literalLen - 15);
+   if (literalLen)
+      std::memcpy(op, literals, literalLen);
+   op += literalLen;
+
+   if (offset) {
+      *op++ = ubyte(offset);
+      *op++ = ubyte(offset >> 8);
+      matchLen -= MinMatch;
+      *token |= ubyte(matchLen >= 15 ? 15 : matchLen);
+      if (matchLen >= 15)
+         op = WriteLength(op, matchLen - 15);
+   }
+   return op;
+}
+}  // namespace
+
+size_t LZCompress(const void* src, size_t size, void* dst, size_t capacity) {
+   if (capacity < LZCompressBound(size))
+      return 0;
+
+   const ubyte* const base   = static_cast<const ubyte*>(src);
+   const ubyte* const end    = base + size;
+   ubyte* const       out    = static_cast<ubyte*>(dst);
+   ubyte*             op     = out;
+   const ubyte*       anchor = base;
+
+   if (size > MatchLimit) {
+      const ubyte* const matchEnd  = end - LastLiterals;
+      const ubyte* const searchEnd = end - MatchLimit;
+      uint32             table[1 << HashBits] = {};  // Positions + 1, so 0 is empty
+
+      const ubyte* ip = base;
+      while (ip < searchEnd) {
+         // Skip ahead faster the longer we go without finding anything
+         size_t       misses = 1 << 6;
+         const ubyte* match;
+         for (;;) {
+            uint32 h = Hash(Read32(ip));
+            match    = table[h] ? base + table[h] - 1 : nullptr;
+            table[h] = uint32(ip - base) + 1;
+            if (match && size_t(ip - match) <= MaxOffset && Read32(match) == Read32(ip))
+               break;
+            ip += misses++ >> 6;
+            if (ip >= searchEnd)
+               goto lastLiterals;
+         }
+
+         while (ip > anchor && match > base && ip[-1] == match[-1]) {
+            ip--;
+            match--;
+         }
+
+         const ubyte* matchStart = ip;
+         ip += MinMatch;
+         match += MinMatch;
+         while (ip < matchEnd && *ip == *match) {
+            ip++;
+            match++;
+         }
+
+         op     = WriteSequence(op, anchor, matchStart - anchor, ip - match, ip - matchStart);
+         anchor = ip;
+
+         if (ip < searchEnd)
+            table[Hash(Read32(ip - 2))] = uint32(ip - 2 - base) + 1;
+      }
+   }
+
+lastLiterals:
+   op = WriteSequence(op, anchor, end - anchor, 0, 0);
+   return op - out;
+}
+
+int64 LZDecompress(const void* src, size_t size, void* dst, size_t capacity) {
+   const ubyte*       ip   = static_cast<const ubyte*>(src);
+   const ubyte* const iend = ip + size;
+   ubyte* const       out  = static_cast<ubyte*>(dst);
+   ubyte*             op   = out;
+   ubyte* const       oend = out + capacity;
+
+   auto readLength = [&](size_t& len) {
+      ubyte b;
+      do {
+         if (ip >= iend)
+            return false;
+         b = *ip++;
+         len += b;
+      } while (b == 255);
+      return true;
+   };
+
+   while (ip < iend) {
+      ubyte token = *ip++;
+
+      size_t literalLen = token >> 4;
+      if (literalLen == 15 && !readLength(literalLen))
+         return -1;
+      if (literalLen > size_t(iend - ip) || literalLen > size_t(oend - op))
+         return -1;
+      if (literalLen)
+         std::memcpy(op, ip, literalLen);
+      ip += literalLen;
+      op += literalLen;
+
+      if (ip == iend)
+         break;  // The last sequence is literals only
+
+      if (iend - ip < 2)
+         return -1;
+      size_t offset = ip[0] | size_t(ip[1]) << 8;
+      ip += 2;
+      if (offset == 0 || offset > size_t(op - out))
+         return -1;
+
+      size_t matchLen = token & 15;
+      if (matchLen == 15 && !readLength(matchLen))
+         return -1;
+      matchLen += MinMatch;
+      if (matchLen > size_t(oend - op))
+         return -1;
+
+      const ubyte* match = op - offset;
+      if (size_t(oend - op) >= matchLen + 8) {
+         // Copy 8 at a time, overrunning by up to 7. Short offsets (runs) get their pattern spread over the first 8
+         // bytes, after which it repeats every multiple of offset that's at least 8, and overlap can't bite.
+         ubyte* stop = op + matchLen;
+         if (offset < 8) {
+            for (int32 i = 0; i < 8; i++)
+               op[i] = match[i];
+            match = op + 8 - offset * ((8 + offset - 1) / offset);
+            op += 8;
+         }
+         for (; op < stop; op += 8, match += 8)
+            std::memcpy(op, match, 8);
+         op = stop;
+      } else {
+         for (size_t i = 0; i < matchLen; i++)
+            op[i] = match[i];
+         op += matchLen;
+      }
+   }
+
+   return op - out;
+}
@@ -0,0 +1,23 @@
+#pragma once
+/*
+ * LZ4-style block compression: byte-aligned literal runs and matches with 16-bit offsets, no entropy coding, so it
+ * decompresses at memory speed and compresses at a few hundred MB/s. The output is the LZ4 block format, so anything
+ * that reads LZ4 blocks can read it, but there's no frame, checksum or size stored; the caller keeps track of those.
+ *
+ * Decompression is bounds checked against both buffers, so corrupt input fails rather than scribbling over memory.
+ */
+
+#include <cstddef>
+
+#include "Types.hpp"
+
+/// Worst case compressed size (incompressible input).
+constexpr size_t LZCompressBound(size_t size) {
+   return size + size / 255 + 16;
+}
+
+/// Returns the compressed size, or 0 if capacity is less than LZCompressBound(size).
+size_t LZCompress(const void* src, size_t size, void* dst, size_t capacity);
+
+/// Returns the decompressed size, or -1 if src is malformed or doesn't fit in capacity.
+int64 LZDecompress(const void* src, size_t size, void* dst, size_t capacity);
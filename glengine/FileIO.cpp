@@ -0,0 +1,88 @@
+#include "FileIO.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Logger.hpp"
+
+bool WriteAll(int fd, const void* data, size_t size, uint64 offset) {
+   auto bytes = static_cast<const ubyte*>(data);
+   while (size) {
+      ssize_t written = ::pwrite(fd, bytes, size, offset);
+      if (written < 0) {
+         if (errno == EINTR)
+            continue;
+         return false;
+      }
+      bytes += written;
+      offset += written;
+      size -= written;
+   }
+   return true;
+}
+
+void SyncDirectory(const std::string& path) {
+   auto slash = path.find_last_of('/');
+   auto dir   = slash == std::string::npos ? std::string(".") : path.substr(0, slash + 1);
+   int  fd    = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd >= 0) {
+      ::fsync(fd);
+      ::close(fd);
+   }
+}
+
+bool ReplaceFile(const std::string& path, const std::function<bool(int fd)>& write) {
+   std::string tmp = path + ".tmp";
+   int         fd  = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0) {
+      Logger::Error("Couldn't create ", tmp, ": ", std::strerror(errno));
+      return false;
+   }
+
+   bool ok = write(fd) && ::fdatasync(fd) == 0;
+   ::close(fd);
+   if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+      Logger::Error("Couldn't write ", path, ": ", std::strerror(errno));
+      ::unlink(tmp.c_str());
+      return false;
+   }
+
+   SyncDirectory(path);
+   return true;
+}
+
+bool ReplaceFile(const std::string& path, const std::vector<ubyte>& contents) {
+   return ReplaceFile(path, [&](int fd) { return WriteAll(fd, contents.data(), contents.size(), 0); });
+}
+
+MappedFile::MappedFile(const std::string& path) {
+   int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      Logger::Error("Couldn't open ", path, ": ", std::strerror(errno));
+      return;
+   }
+
+   struct stat info;
+   if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+      void* address = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (address != MAP_FAILED) {
+         bytes  = static_cast<const ubyte*>(address);
+         length = info.st_size;
+      } else
+         Logger::Error("Couldn't map ", path, ": ", std::strerror(errno));
+   } else
+      Logger::Error(path, " is empty");
+
+   // The mapping holds its own reference to the file
+   ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+   if (bytes)
+      ::munmap(const_cast<ubyte*>(bytes), length);
+}
@@ -0,0 +1,40 @@
+#pragma once
+/*
+ * The bits of POSIX file I/O that need more care than an ifstream: writes that loop until they're done, replacing a
+ * file so a crash leaves either all of the old one or all of the new one, and read-only whole-file mappings.
+ */
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+
+/// pwrite until it's all written. False (with errno set) on failure.
+bool WriteAll(int fd, const void* data, size_t size, uint64 offset);
+
+/// fsyncs path's directory, so a rename or a new file survives a crash too.
+void SyncDirectory(const std::string& path);
+
+/// write gets a fresh temp file next to path. Once it returns true the file's synced and renamed over path.
+bool ReplaceFile(const std::string& path, const std::function<bool(int fd)>& write);
+bool ReplaceFile(const std::string& path, const std::vector<ubyte>& contents);
+
+/// A whole file mapped read-only.
+class MappedFile {
+  public:
+   /// Check isOpen(); failures are logged.
+   explicit MappedFile(const std::string& path);
+   ~MappedFile();
+
+   MappedFile(const MappedFile&) = delete;
+   MappedFile& operator=(const MappedFile&) = delete;
+
+   bool         isOpen() const { return bytes != nullptr; }
+   const ubyte* data() const { return bytes; }
+   size_t       size() const { return length; }
+
+  private:
+   const ubyte* bytes  = nullptr;
+   size_t       length = 0;
+};
@@ -0,0 +1,56 @@
+#include "FrameRing.hpp"
+
+#include <algorithm>
+
+#include "Logger.hpp"
+
+FrameRing::FrameRing(vk::Device& dev, GpuAllocator& allocator, const vk::PhysicalDevice& physical, size_t frames,
+                     vk::DeviceSize segmentSize)
+    : VulkanObject(dev), allocator{allocator}, frames{frames} {
+   const auto& limits = physical.getProperties().limits;
+   // nonCoherentAtomSize too, in case we ever land in non-coherent memory and have to flush ranges
+   this->minAlignment = std::max({limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment,
+                                  limits.nonCoherentAtomSize, vk::DeviceSize(16)});
+   this->segSize      = (segmentSize + minAlignment - 1) / minAlignment * minAlignment;
+
+   using Usage = vk::BufferUsageFlagBits;
+   this->ring  = allocator.createBuffer(this->segSize * frames,
+                                       Usage::eUniformBuffer | Usage::eStorageBuffer | Usage::eVertexBuffer |
+                                           Usage::eIndexBuffer | Usage::eIndirectBuffer,
+                                       MemoryUsage::Upload, BufferFlags::Mapped);
+}
+
+FrameRing::~FrameRing() {
+   Logger::Info("Frame ring peaked at ", highWater() >> 10, "KiB of ", this->segSize >> 10, "KiB per frame");
+   allocator.destroy(this->ring);
+}
+
+void FrameRing::beginFrame(size_t frame) {
+   auto lastUsed = this->used.exchange(0, std::memory_order_relaxed);
+   if (lastUsed > this->peak.load(std::memory_order_relaxed))
+      this->peak.store(lastUsed, std::memory_order_relaxed);
+
+   this->segStart = (frame % this->frames) * this->segSize;
+   this->overflowed.store(false, std::memory_order_relaxed);
+}
+
+FrameAlloc FrameRing::alloc(vk::DeviceSize size, vk::DeviceSize alignment) {
+   alignment = std::max(alignment, this->minAlignment);
+
+   vk::DeviceSize start, cur = this->used.load(std::memory_order_relaxed);
+   do {
+      start = (cur + alignment - 1) / alignment * alignment;
+      if (start + size > this->segSize) {
+         if (!this->overflowed.exchange(true, std::memory_order_relaxed))
+            Logger::Error("Frame ring overflowed its ", this->segSize >> 10, "KiB segment; make it bigger");
+         return {};
+      }
+   } while (!this->used.compare_exchange_weak(cur, start + size, std::memory_order_relaxed));
+
+   FrameAlloc res;
+   res.buffer = this->ring.buffer;
+   res.offset = this->segStart + start;
+   res.size   = size;
+   res.data   = static_cast<ubyte*>(this->ring.data()) + res.offset;
+   return res;
+}
@@ -0,0 +1,75 @@
+#pragma once
+/*
+ * Scratch memory for anything that only lives for one frame: camera matrices, per-object transforms, debug lines...
+ *
+ * One persistently mapped buffer split into a segment per frame in flight. Allocating is an atomic bump in the current
+ * segment, and writing is a memcpy straight into it; the segment gets reused once that frame's fence has signaled, so
+ * in steady state there's no Vulkan calls at all. Every allocation is aligned for use as a dynamic uniform or storage
+ * buffer offset, so one descriptor pointing at buffer() serves every draw.
+ */
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#include "VulkanBase.hpp"
+
+#include "GpuAllocator.hpp"
+#include "Types.hpp"
+
+struct FrameAlloc {
+   vk::Buffer     buffer;
+   vk::DeviceSize offset = 0;  // Into buffer. Use directly as a dynamic offset, or a vertex/index buffer offset.
+   vk::DeviceSize size   = 0;
+   void*          data   = nullptr;  // Already offset. Null if the segment overflowed.
+
+   explicit operator bool() const { return data != nullptr; }
+   uint32   dynamicOffset() const { return static_cast<uint32>(offset); }
+};
+
+class FrameRing : VulkanObject {
+  public:
+   FrameRing(vk::Device& dev, GpuAllocator& allocator, const vk::PhysicalDevice& physical, size_t frames,
+             vk::DeviceSize segmentSize = 4 * 1024 * 1024);
+   ~FrameRing();
+
+   FrameRing(const FrameRing&) = delete;
+   FrameRing& operator=(const FrameRing&) = delete;
+
+   /// Switches to frame's segment and throws away what was in it. Only once frame's fence has signaled.
+   void beginFrame(size_t frame);
+
+   /// Thread safe. alignment of 0 means minAlignment, and anything smaller gets bumped up to it.
+   FrameAlloc alloc(vk::DeviceSize size, vk::DeviceSize alignment = 0);
+
+   /// alloc() + memcpy.
+   FrameAlloc push(const void* data, vk::DeviceSize size) {
+      auto res = alloc(size);
+      if (res)
+         std::memcpy(res.data, data, size);
+      return res;
+   }
+   template <typename T>
+   FrameAlloc push(const T& value) {
+      static_assert(std::is_trivially_copyable_v<T>, "Frame data gets memcpy'd");
+      return push(&value, sizeof(T));
+   }
+
+   vk::Buffer     buffer() const { return this->ring.buffer; }
+   vk::DeviceSize segmentSize() const { return this->segSize; }
+   /// Most any one frame has used since startup. Size segmentSize off this.
+   vk::DeviceSize highWater() const { return this->peak.load(std::memory_order_relaxed); }
+
+   vk::DeviceSize minAlignment;
+
+  private:
+   GpuAllocator&  allocator;
+   VulkanBuffer   ring;
+   vk::DeviceSize segSize;
+   size_t         frames;
+
+   vk::DeviceSize              segStart = 0;
+   std::atomic<vk::DeviceSize> used{0};  // Into the current segment
+   std::atomic<vk::DeviceSize> peak{0};
+   std::atomic<bool>           overflowed{false};  // So we only complain once a frame
+};
@@ -12,8 +12,8 @@
 #include "VulkanBackend.hpp"
 
 #include "Input.hpp"
+#include "JobSystem.hpp"
 
+#include "BinLog.hpp"
 #include "Logger.hpp"
-
-// Note: Consider pulling in transwarp for overall library directing.
-// // Maybe just in the client app?
+#include "Profiler.hpp"
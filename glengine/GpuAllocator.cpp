@@ -0,0 +1,322 @@
+#include "GpuAllocator.hpp"
+
+#include <algorithm>
+
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+//==========================================================================
+// BuddyBlock
+
+BuddyBlock::BuddyBlock(uint64 size, uint64 minSize) : minSize{minSize} {
+   maxOrder = 0;
+   while (sizeOf(maxOrder) < size)
+      maxOrder++;
+
+   freeLists.resize(maxOrder + 1);
+   freeLists[maxOrder].insert(0);
+}
+
+bool BuddyBlock::alloc(uint64 size, uint64 alignment, uint64& offset, uint8& order) {
+   // Every piece is aligned to its own size, so asking for at least `alignment` bytes takes care of alignment.
+   uint64 want = std::max(size, alignment);
+   uint8  need = 0;
+   while (sizeOf(need) < want) {
+      if (++need > maxOrder)
+         return false;
+   }
+
+   uint8 have = need;
+   while (have <= maxOrder && freeLists[have].empty())
+      have++;
+   if (have > maxOrder)
+      return false;
+
+   offset = *freeLists[have].begin();
+   freeLists[have].erase(freeLists[have].begin());
+
+   // Split down, leaving the upper halves free
+   while (have > need) {
+      have--;
+      freeLists[have].insert(offset + sizeOf(have));
+   }
+
+   order = need;
+   usedBytes += sizeOf(need);
+   livePieces++;
+   return true;
+}
+
+void BuddyBlock::free(uint64 offset, uint8 order) {
+   usedBytes -= sizeOf(order);
+   livePieces--;
+
+   // Merge with our buddy for as long as it's free too
+   while (order < maxOrder) {
+      uint64 buddy = offset ^ sizeOf(order);
+      auto   it    = freeLists[order].find(buddy);
+      if (it == freeLists[order].end())
+         break;
+
+      freeLists[order].erase(it);
+      offset = std::min(offset, buddy);
+      order++;
+   }
+
+   freeLists[order].insert(offset);
+}
+
+uint64 BuddyBlock::largestFree() const {
+   for (int order = maxOrder; order >= 0; order--)
+      if (!freeLists[order].empty())
+         return sizeOf(order);
+   return 0;
+}
+
+//==========================================================================
+// GpuAllocator
+
+namespace {
+constexpr vk::DeviceSize MinPieceSize = 256;
+
+vk::DeviceSize roundUpPow2(vk::DeviceSize size) {
+   vk::DeviceSize res = 1;
+   while (res < size)
+      res <<= 1;
+   return res;
+}
+}  // namespace
+
+GpuAllocator::GpuAllocator(vk::Device& dev, const vk::PhysicalDevice& physical, vk::DeviceSize blockSize)
+    : VulkanObject(dev),
+      memProps{physical.getMemoryProperties()},
+      blockSize{roundUpPow2(blockSize)},
+      maxAllocations{physical.getProperties().limits.maxMemoryAllocationCount} {
+   heapCounters.resize(memProps.memoryHeapCount);
+}
+
+GpuAllocator::~GpuAllocator() {
+   logStats();
+
+   for (auto& pool : pools)
+      for (auto& block : pool.blocks) {
+         if (!block.buddy.empty())
+            Logger::Error("GpuAllocator: leaked ", block.buddy.used(), " bytes in memory type ", pool.memoryType);
+         dev.freeMemory(block.memory);
+      }
+}
+
+uint32 GpuAllocator::findMemoryType(uint32 typeBits, vk::MemoryPropertyFlags required,
+                                    vk::MemoryPropertyFlags preferred) const {
+   // First pass wants everything, second settles for just what's required.
+   for (auto flags : {required | preferred, required})
+      for (uint32 i = 0; i < memProps.memoryTypeCount; i++)
+         if ((typeBits & (1u << i)) && (memProps.memoryTypes[i].propertyFlags & flags) == flags)
+            return i;
+
+   Logger::ErrorOut("GpuAllocator: no memory type fits bits ", typeBits, " and flags ", uint32(required));
+   return 0;
+}
+
+vk::DeviceMemory GpuAllocator::allocateMemory(vk::DeviceSize size, uint32 memoryType, void** mapped) {
+   if (liveAllocations + 1 > maxAllocations)
+      Logger::Error("GpuAllocator: going over maxMemoryAllocationCount (", maxAllocations, ")");
+
+   auto memory = dev.allocateMemory(vk::MemoryAllocateInfo().setAllocationSize(size).setMemoryTypeIndex(memoryType));
+   liveAllocations++;
+
+   // Host visible memory stays mapped for its whole life. Mapping is expensive, and holding it mapped is free.
+   *mapped = nullptr;
+   if (memProps.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+      *mapped = dev.mapMemory(memory, 0, size);
+
+   return memory;
+}
+
+GpuAllocator::Pool& GpuAllocator::poolFor(uint32 memoryType, bool linear) {
+   for (auto& pool : pools)
+      if (pool.memoryType == memoryType && pool.linear == linear)
+         return pool;
+
+   auto heapSize = memProps.memoryHeaps[memProps.memoryTypes[memoryType].heapIndex].size;
+   auto size     = blockSize;
+   while (size > MinPieceSize && size > heapSize / 8)
+      size >>= 1;
+
+   pools.push_back({memoryType, linear, size, {}});
+   return pools.back();
+}
+
+GpuAllocation GpuAllocator::allocate(const vk::MemoryRequirements& reqs, MemoryUsage usage, bool linear,
+                                     bool dedicated) {
+   PROFILE_FUNCTION();
+   using Prop = vk::MemoryPropertyFlagBits;
+
+   vk::MemoryPropertyFlags required, preferred;
+   switch (usage) {
+      case MemoryUsage::GpuOnly: required = Prop::eDeviceLocal; break;
+      case MemoryUsage::Upload:
+         required  = Prop::eHostVisible | Prop::eHostCoherent;
+         preferred = Prop::eDeviceLocal;
+         break;
+      case MemoryUsage::Readback:
+         required  = Prop::eHostVisible;
+         preferred = Prop::eHostCached;
+         break;
+   }
+
+   GpuAllocation alloc;
+   alloc.size       = reqs.size;
+   alloc.memoryType = findMemoryType(reqs.memoryTypeBits, required, preferred);
+
+   std::lock_guard<std::mutex> guard(lock);
+   auto& counters = heapCounters[memProps.memoryTypes[alloc.memoryType].heapIndex];
+   counters.requested += reqs.size;
+
+   Pool& pool = poolFor(alloc.memoryType, linear);
+   if (dedicated || reqs.size > pool.blockSize / 2) {
+      alloc.memory = allocateMemory(reqs.size, alloc.memoryType, &alloc.mapped);
+      counters.dedicated++;
+      counters.dedicatedBytes += reqs.size;
+      return alloc;
+   }
+
+   alloc.pool = &pool - pools.data();
+
+   for (size_t i = 0; i <= pool.blocks.size(); i++) {
+      if (i == pool.blocks.size()) {
+         void* mapped;
+         auto  memory = allocateMemory(pool.blockSize, alloc.memoryType, &mapped);
+         pool.blocks.push_back({memory, mapped, BuddyBlock(pool.blockSize, MinPieceSize)});
+      }
+
+      auto& block = pool.blocks[i];
+      if (block.buddy.alloc(reqs.size, reqs.alignment, alloc.offset, alloc.order)) {
+         alloc.block  = i;
+         alloc.memory = block.memory;
+         if (block.mapped)
+            alloc.mapped = static_cast<byte*>(block.mapped) + alloc.offset;
+         return alloc;
+      }
+   }
+
+   return alloc;  // Unreachable; a fresh block always fits
+}
+
+void GpuAllocator::free(GpuAllocation& alloc) {
+   if (!alloc)
+      return;
+
+   std::lock_guard<std::mutex> guard(lock);
+   auto& counters = heapCounters[memProps.memoryTypes[alloc.memoryType].heapIndex];
+   counters.requested -= alloc.size;
+
+   if (alloc.pool < 0) {
+      dev.freeMemory(alloc.memory);
+      liveAllocations--;
+      counters.dedicated--;
+      counters.dedicatedBytes -= alloc.size;
+   } else {
+      // Empty blocks are kept. Streaming tends to free and reallocate in waves, and a block is cheap to hold.
+      pools[alloc.pool].blocks[alloc.block].buddy.free(alloc.offset, alloc.order);
+   }
+
+   alloc = GpuAllocation();
+}
+
+VulkanBuffer GpuAllocator::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryUsage memUsage,
+                                        FlagSet<BufferFlags> flags, std::vector<uint32> sharedFamilies) {
+   if (flags.has(BufferFlags::Mapped))
+      memUsage = MemoryUsage::Upload;
+
+   std::sort(sharedFamilies.begin(), sharedFamilies.end());
+   sharedFamilies.erase(std::unique(sharedFamilies.begin(), sharedFamilies.end()), sharedFamilies.end());
+
+   VulkanBuffer res;
+   res.size       = size;
+   res.flags      = flags;
+   res.concurrent = sharedFamilies.size() > 1;
+
+   auto info = vk::BufferCreateInfo().setSize(size).setUsage(usage).setSharingMode(vk::SharingMode::eExclusive);
+   if (res.concurrent)
+      info.setSharingMode(vk::SharingMode::eConcurrent)
+          .setQueueFamilyIndexCount(sharedFamilies.size())
+          .setPQueueFamilyIndices(sharedFamilies.data());
+   res.buffer = dev.createBuffer(info);
+
+   res.alloc = allocate(dev.getBufferMemoryRequirements(res.buffer), memUsage, true);
+   dev.bindBufferMemory(res.buffer, res.alloc.memory, res.alloc.offset);
+
+   return res;
+}
+
+void GpuAllocator::destroy(VulkanBuffer& buffer) {
+   if (buffer.buffer)
+      dev.destroyBuffer(buffer.buffer);
+   free(buffer.alloc);
+   buffer = VulkanBuffer();
+}
+
+VulkanImage GpuAllocator::createImage(const vk::ImageCreateInfo& info, MemoryUsage memUsage) {
+   VulkanImage res;
+   res.image = dev.createImage(info);
+
+   auto reqs   = dev.getImageMemoryRequirements(res.image);
+   bool linear = info.tiling == vk::ImageTiling::eLinear;
+   // Render targets and big textures get their own memory. Drivers like that, and they'd eat a block anyway.
+   bool dedicated = reqs.size >= blockSize / 4 || (info.usage & (vk::ImageUsageFlagBits::eColorAttachment |
+                                                                 vk::ImageUsageFlagBits::eDepthStencilAttachment));
+
+   res.alloc = allocate(reqs, memUsage, linear, dedicated);
+   dev.bindImageMemory(res.image, res.alloc.memory, res.alloc.offset);
+
+   return res;
+}
+
+void GpuAllocator::destroy(VulkanImage& image) {
+   if (image.image)
+      dev.destroyImage(image.image);
+   free(image.alloc);
+   image = VulkanImage();
+}
+
+std::vector<GpuAllocator::HeapStats> GpuAllocator::stats() {
+   std::lock_guard<std::mutex> guard(lock);
+
+   std::vector<HeapStats> res(memProps.memoryHeapCount);
+   for (uint32 i = 0; i < memProps.memoryHeapCount; i++) {
+      res[i].heapSize    = memProps.memoryHeaps[i].size;
+      res[i].requested   = heapCounters[i].requested;
+      res[i].dedicated   = heapCounters[i].dedicated;
+      res[i].allocations = heapCounters[i].dedicated;
+      res[i].reserved    = heapCounters[i].dedicatedBytes;
+      res[i].used        = heapCounters[i].dedicatedBytes;
+   }
+
+   for (const auto& pool : pools) {
+      auto& heap = res[memProps.memoryTypes[pool.memoryType].heapIndex];
+      for (const auto& block : pool.blocks) {
+         heap.blocks++;
+         heap.allocations += block.buddy.pieces();
+         heap.reserved += block.buddy.size();
+         heap.used += block.buddy.used();
+         heap.largestFree = std::max(heap.largestFree, block.buddy.largestFree());
+      }
+   }
+
+   return res;
+}
+
+void GpuAllocator::logStats() {
+   auto heaps = stats();
+   for (size_t i = 0; i < heaps.size(); i++) {
+      const auto& heap = heaps[i];
+      if (!heap.reserved)
+         continue;
+
+      Logger::Info("GPU heap ", i, ": ", heap.reserved >> 20, "MiB reserved in ", heap.blocks, " blocks + ",
+                   heap.dedicated, " dedicated, ", heap.used >> 10, "KiB used (", heap.requested >> 10,
+                   "KiB requested), largest free ", heap.largestFree >> 10,
+                   "KiB, fragmentation ", heap.fragmentation());
+   }
+}
@@ -0,0 +1,166 @@
+#pragma once
+/*
+ * Device memory sub-allocation.
+ *
+ * vkAllocateMemory is slow and capped at maxMemoryAllocationCount (4096 on plenty of drivers), so instead we grab big
+ * blocks per memory type and hand out pieces of them with a buddy allocator. Buddy wastes up to half of each piece
+ * to rounding, but it's O(log n), can't fragment into unusable slivers, and every piece is naturally aligned to its own
+ * size, which covers any alignment Vulkan is going to ask for.
+ *
+ * bufferImageGranularity is dealt with by never mixing linear (buffers, linear images) and optimal-tiling images in
+ * the same block; each memory type has a pool for each. Anything too big for a block, and large images, get a
+ * dedicated allocation.
+ */
+
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "VulkanBase.hpp"
+
+#include "Macros.hpp"
+#include "RenderingBackend.hpp"
+#include "Types.hpp"
+
+/// Pure bookkeeping for one buddy block. Knows nothing about Vulkan; offsets are relative to the block.
+class BuddyBlock {
+  public:
+   BuddyBlock(uint64 size, uint64 minSize);
+
+   /// Returns false if there's no room. alignment must be a power of 2.
+   bool alloc(uint64 size, uint64 alignment, uint64& offset, uint8& order);
+   void free(uint64 offset, uint8 order);
+
+   uint64 size() const { return sizeOf(maxOrder); }
+   uint64 used() const { return usedBytes; }
+   uint32 pieces() const { return livePieces; }  // Allocations currently handed out
+   uint64 largestFree() const;
+   bool   empty() const { return usedBytes == 0; }
+
+  private:
+   uint64 sizeOf(uint8 order) const { return minSize << order; }
+
+   uint64                        minSize;
+   uint8                         maxOrder;
+   uint64                        usedBytes  = 0;
+   uint32                        livePieces = 0;
+   std::vector<std::set<uint64>> freeLists;  // [order] -> free offsets. Ordered so we favour the front of the block.
+};
+
+/// What the memory is for. Picks the property flags we need and the ones we'd like.
+enum class MemoryUsage {
+   GpuOnly,   ///< Device local. Fill it with a transfer.
+   Upload,    ///< Host visible + coherent, persistently mapped. Device local too if we can get it (ReBAR/UMA).
+   Readback,  ///< Host visible, cached if possible.
+};
+
+struct GpuAllocation {
+   vk::DeviceMemory memory;
+   vk::DeviceSize   offset = 0;
+   vk::DeviceSize   size   = 0;
+   void*            mapped = nullptr;  // Only for host visible memory. Already offset.
+
+   uint32 memoryType = 0;
+   int32  pool       = -1;  // -1 means a dedicated allocation
+   int32  block      = -1;
+   uint8  order      = 0;
+
+   explicit operator bool() const { return bool(memory); }
+};
+
+/// The Vulkan half of RenderingBackend's Buffer.
+struct VulkanBuffer {
+   vk::Buffer           buffer;
+   GpuAllocation        alloc;
+   vk::DeviceSize       size = 0;
+   FlagSet<BufferFlags> flags{BufferFlags(0)};
+   bool                 concurrent = false;  // VK_SHARING_MODE_CONCURRENT, so no ownership transfers needed
+
+   bool  isMapped() const { return alloc.mapped != nullptr; }
+   void* data() const { return alloc.mapped; }
+
+   CONVERTABLE_TO_MEMBER(buffer)
+};
+
+struct VulkanImage {
+   vk::Image     image;
+   GpuAllocation alloc;
+
+   CONVERTABLE_TO_MEMBER(image)
+};
+
+class GpuAllocator : VulkanObject {
+  public:
+   struct HeapStats {
+      vk::DeviceSize heapSize    = 0;
+      vk::DeviceSize reserved    = 0;  // Actually vkAllocateMemory'd
+      vk::DeviceSize used        = 0;  // Handed out (including buddy rounding)
+      vk::DeviceSize requested   = 0;  // What callers asked for
+      vk::DeviceSize largestFree = 0;
+      uint32         blocks = 0, allocations = 0, dedicated = 0;
+
+      /// 0 when all free space is one contiguous piece, approaching 1 as it gets chopped up.
+      float fragmentation() const {
+         auto free = reserved - used;
+         return free ? 1.0f - float(largestFree) / float(free) : 0.0f;
+      }
+   };
+
+   /// blockSize is shrunk for small heaps so one block never hogs more than an eighth of a heap.
+   GpuAllocator(vk::Device& dev, const vk::PhysicalDevice& physical, vk::DeviceSize blockSize = 64 * 1024 * 1024);
+   ~GpuAllocator();
+
+   GpuAllocator(const GpuAllocator&) = delete;
+   GpuAllocator& operator=(const GpuAllocator&) = delete;
+
+   /// linear is true for buffers and linear-tiled images; see bufferImageGranularity above.
+   GpuAllocation allocate(const vk::MemoryRequirements& reqs, MemoryUsage usage, bool linear, bool dedicated = false);
+   void          free(GpuAllocation& alloc);
+
+   /// Creates, allocates and binds. BufferFlags::Mapped forces MemoryUsage::Upload. With more than one distinct queue
+   /// family in sharedFamilies the buffer is shared concurrently between them.
+   VulkanBuffer createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryUsage memUsage,
+                             FlagSet<BufferFlags> flags = BufferFlags(0), std::vector<uint32> sharedFamilies = {});
+   void         destroy(VulkanBuffer& buffer);
+
+   VulkanImage createImage(const vk::ImageCreateInfo& info, MemoryUsage memUsage = MemoryUsage::GpuOnly);
+   void        destroy(VulkanImage& image);
+
+   std::vector<HeapStats> stats();
+   void                   logStats();
+
+   uint32 findMemoryType(uint32 typeBits, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred) const;
+
+  private:
+   struct Block {
+      vk::DeviceMemory memory;
+      void*            mapped;
+      BuddyBlock       buddy;
+   };
+
+   struct Pool {
+      uint32             memoryType;
+      bool               linear;
+      vk::DeviceSize     blockSize;
+      std::vector<Block> blocks;
+   };
+
+   vk::DeviceMemory allocateMemory(vk::DeviceSize size, uint32 memoryType, void** mapped);
+   Pool&            poolFor(uint32 memoryType, bool linear);
+
+   vk::PhysicalDeviceMemoryProperties memProps;
+   vk::DeviceSize                     blockSize;
+   uint32                             maxAllocations;
+   uint32                             liveAllocations = 0;  // Actual vkAllocateMemory calls outstanding
+
+   // Per heap, for stats()
+   struct HeapCounters {
+      uint32         dedicated      = 0;
+      vk::DeviceSize dedicatedBytes = 0;
+      vk::DeviceSize requested      = 0;
+   };
+
+   std::mutex                lock;
+   std::vector<Pool>         pools;
+   std::vector<HeapCounters> heapCounters;
+};
@@ -0,0 +1,26 @@
+#include "ITC.hpp"
+
+#ifdef __linux__
+#include <climits>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static_assert(sizeof(std::atomic<uint32>) == sizeof(uint32), "The kernel waits on the atomic's raw value");
+
+void FutexWait(std::atomic<uint32>& addr, uint32 expected) {
+   ::syscall(SYS_futex, reinterpret_cast<uint32*>(&addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+void FutexWakeAll(std::atomic<uint32>& addr) {
+   ::syscall(SYS_futex, reinterpret_cast<uint32*>(&addr), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+#else
+void FutexWait(std::atomic<uint32>& addr, uint32 expected) {
+   if (addr.load(std::memory_order_acquire) == expected)
+      std::this_thread::yield();
+}
+
+void FutexWakeAll(std::atomic<uint32>&) {}
+#endif
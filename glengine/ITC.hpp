@@ -0,0 +1,331 @@
+#pragma once
+/*
+ * Inter-thread channels, for the render thread, input pump, audio mixer and streaming loader to talk without locks.
+ * Items have to be default constructible and movable.
+ *
+ *    SpscRing<T, N>     one producer, one consumer, bounded. Both ends are wait-free.
+ *    MpscQueue<T, N>    any number of producers, one consumer, bounded (Vyukov: every slot carries a sequence number).
+ *                       Producers are lock-free (a CAS on the tail), the consumer is wait-free.
+ *    TripleBuffer<T>    a "latest value" mailbox. The writer never waits for the reader and vice versa; the reader
+ *                       just sees the newest value published, skipping any it missed.
+ *
+ * Producer and consumer state sit on separate cache lines, and each side keeps a cached copy of the other's index so
+ * it only touches the shared one when it looks full/empty.
+ *
+ * The try* calls never block. push()/pop()/waitForNew() do: with Blocking = true they sleep on a futex once spinning
+ * hasn't helped, otherwise they just spin and yield. Blocking costs the other side a fence and a load per operation
+ * to see if anyone's asleep, which is why it's opt in.
+ */
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "Types.hpp"
+
+constexpr size_t CacheLine = 64;
+
+/// Sleeps on addr while it still holds expected. Can wake spuriously. Just yields off Linux.
+void FutexWait(std::atomic<uint32>& addr, uint32 expected);
+/// Wakes everyone sleeping on addr.
+void FutexWakeAll(std::atomic<uint32>& addr);
+
+/// Lets one side sleep until the other says something's changed. Free to notify() when nobody's waiting, bar a fence.
+class FutexEvent {
+  public:
+   /// Call after publishing whatever the waiter's looking for.
+   void notify() {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiters.load(std::memory_order_relaxed)) {
+         epoch.fetch_add(1, std::memory_order_release);
+         FutexWakeAll(epoch);
+      }
+   }
+
+   /// Returns once ready() is true.
+   template <typename Pred>
+   void waitUntil(Pred&& ready) {
+      for (int spin = 0; spin < SpinsBeforeSleep; spin++) {
+         if (ready())
+            return;
+         std::this_thread::yield();
+      }
+
+      for (;;) {
+         uint32 seen = epoch.load(std::memory_order_acquire);
+         waiters.fetch_add(1, std::memory_order_seq_cst);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if (ready()) {
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+            return;
+         }
+         FutexWait(epoch, seen);
+         waiters.fetch_sub(1, std::memory_order_relaxed);
+      }
+   }
+
+  private:
+   static constexpr int SpinsBeforeSleep = 64;
+
+   std::atomic<uint32> epoch{0};
+   std::atomic<uint32> waiters{0};
+};
+
+/// Shared by the channels to compile the waiting away when it's not wanted.
+template <bool Blocking>
+struct ChannelWait {
+   void notify() {}
+   template <typename Pred>
+   void waitUntil(Pred&& ready) {
+      while (!ready())
+         std::this_thread::yield();
+   }
+};
+
+template <>
+struct ChannelWait<true> : FutexEvent {};
+
+template <typename T, size_t Capacity, bool Blocking = false>
+class SpscRing {
+   static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of two");
+
+  public:
+   SpscRing() = default;
+   SpscRing(const SpscRing&) = delete;
+   SpscRing& operator=(const SpscRing&) = delete;
+   ~SpscRing() {
+      T item;
+      while (tryPop(item)) {}
+   }
+
+   /// Producer only. False if full.
+   template <typename... Args>
+   bool tryEmplace(Args&&... args) {
+      size_t tail = producer.tail.load(std::memory_order_relaxed);
+      if (tail - producer.cachedHead == Capacity) {
+         producer.cachedHead = consumer.head.load(std::memory_order_acquire);
+         if (tail - producer.cachedHead == Capacity)
+            return false;
+      }
+
+      new (&slots[tail & Mask]) T(std::forward<Args>(args)...);
+      producer.tail.store(tail + 1, std::memory_order_release);
+      notEmpty.notify();
+      return true;
+   }
+   bool tryPush(const T& item) { return tryEmplace(item); }
+   bool tryPush(T&& item) { return tryEmplace(std::move(item)); }
+
+   /// Consumer only. False if empty.
+   bool tryPop(T& out) {
+      size_t head = consumer.head.load(std::memory_order_relaxed);
+      if (head == consumer.cachedTail) {
+         consumer.cachedTail = producer.tail.load(std::memory_order_acquire);
+         if (head == consumer.cachedTail)
+            return false;
+      }
+
+      T* item = std::launder(reinterpret_cast<T*>(&slots[head & Mask]));
+      out     = std::move(*item);
+      item->~T();
+      consumer.head.store(head + 1, std::memory_order_release);
+      notFull.notify();
+      return true;
+   }
+
+   /// Producer only. Waits for room.
+   void push(T item) {
+      while (!tryPush(std::move(item)))
+         notFull.waitUntil([&] { return !full(); });
+   }
+
+   /// Consumer only. Waits for something.
+   T pop() {
+      T item;
+      while (!tryPop(item))
+         notEmpty.waitUntil([&] { return !empty(); });
+      return item;
+   }
+
+   /// Approximate unless called from the right side: empty() from the consumer, full() from the producer.
+   bool empty() const {
+      return consumer.head.load(std::memory_order_relaxed) == producer.tail.load(std::memory_order_acquire);
+   }
+   bool full() const {
+      return producer.tail.load(std::memory_order_relaxed) - consumer.head.load(std::memory_order_acquire) ==
+             Capacity;
+   }
+
+  private:
+   static constexpr size_t Mask = Capacity - 1;
+
+   struct alignas(CacheLine) Producer {
+      std::atomic<size_t> tail{0};
+      size_t              cachedHead = 0;
+   };
+   struct alignas(CacheLine) Consumer {
+      std::atomic<size_t> head{0};
+      size_t              cachedTail = 0;
+   };
+
+   Producer producer;
+   Consumer consumer;
+   alignas(CacheLine) ChannelWait<Blocking> notEmpty;
+   alignas(CacheLine) ChannelWait<Blocking> notFull;
+   alignas(CacheLine) std::aligned_storage_t<sizeof(T), alignof(T)> slots[Capacity];
+};
+
+template <typename T, size_t Capacity, bool Blocking = false>
+class MpscQueue {
+   static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of two");
+
+  public:
+   MpscQueue() {
+      for (size_t i = 0; i < Capacity; i++)
+         slots[i].seq.store(i, std::memory_order_relaxed);
+   }
+   MpscQueue(const MpscQueue&) = delete;
+   MpscQueue& operator=(const MpscQueue&) = delete;
+   ~MpscQueue() {
+      T item;
+      while (tryPop(item)) {}
+   }
+
+   /// Any thread. False if full.
+   template <typename... Args>
+   bool tryEmplace(Args&&... args) {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      Slot*  slot;
+      for (;;) {
+         slot      = &slots[pos & Mask];
+         auto diff = intptr_t(slot->seq.load(std::memory_order_acquire)) - intptr_t(pos);
+         if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+               break;
+         } else if (diff < 0)
+            return false;  // The consumer hasn't got to this slot's last lap yet
+         else
+            pos = tail.load(std::memory_order_relaxed);
+      }
+
+      new (&slot->storage) T(std::forward<Args>(args)...);
+      slot->seq.store(pos + 1, std::memory_order_release);
+      notEmpty.notify();
+      return true;
+   }
+   bool tryPush(const T& item) { return tryEmplace(item); }
+   bool tryPush(T&& item) { return tryEmplace(std::move(item)); }
+
+   /// Consumer only. False if empty, or if the next producer in line hasn't finished writing its item yet.
+   bool tryPop(T& out) {
+      Slot& slot = slots[head & Mask];
+      if (slot.seq.load(std::memory_order_acquire) != head + 1)
+         return false;
+
+      T* item = std::launder(reinterpret_cast<T*>(&slot.storage));
+      out     = std::move(*item);
+      item->~T();
+      slot.seq.store(head + Capacity, std::memory_order_release);
+      head++;
+      notFull.notify();
+      return true;
+   }
+
+   /// Any thread. Waits for room.
+   void push(T item) {
+      while (!tryPush(std::move(item)))
+         notFull.waitUntil([&] { return hasRoom(); });
+   }
+
+   /// Consumer only. Waits for something.
+   T pop() {
+      T item;
+      while (!tryPop(item))
+         notEmpty.waitUntil([&] { return slots[head & Mask].seq.load(std::memory_order_acquire) == head + 1; });
+      return item;
+   }
+
+  private:
+   static constexpr size_t Mask = Capacity - 1;
+
+   struct Slot {
+      std::atomic<size_t>                           seq;
+      std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+   };
+
+   bool hasRoom() const {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      return intptr_t(slots[pos & Mask].seq.load(std::memory_order_acquire)) - intptr_t(pos) >= 0;
+   }
+
+   alignas(CacheLine) std::atomic<size_t> tail{0};
+   alignas(CacheLine) size_t head = 0;  // Only the consumer touches this
+   alignas(CacheLine) ChannelWait<Blocking> notEmpty;
+   alignas(CacheLine) ChannelWait<Blocking> notFull;
+   alignas(CacheLine) Slot slots[Capacity];
+};
+
+/// One writer, one reader. Three copies of T: the one being written, the one being read, and the latest published one
+/// in the middle, which publish() and update() swap theirs with.
+template <typename T, bool Blocking = false>
+class TripleBuffer {
+  public:
+   TripleBuffer() = default;
+   explicit TripleBuffer(const T& initial) {
+      for (auto& buffer : buffers)
+         buffer.value = initial;
+   }
+   TripleBuffer(const TripleBuffer&) = delete;
+   TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+   /// Writer only. The buffer to fill in; it still holds whatever was written to it two publishes ago.
+   T& write() { return buffers[back].value; }
+   /// Writer only. Makes write()'s buffer the latest.
+   void publish() {
+      back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & IndexMask;
+      published.fetch_add(1, std::memory_order_relaxed);
+      fresh.notify();
+   }
+   void publish(const T& value) {
+      write() = value;
+      publish();
+   }
+
+   /// Reader only. Swaps in the latest value if there's one the reader hasn't seen. True if there was.
+   bool update() {
+      if (!(middle.load(std::memory_order_relaxed) & Fresh))
+         return false;
+      front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+      return true;
+   }
+   /// Reader only. The value as of the last update().
+   const T& read() const { return buffers[front].value; }
+
+   /// Reader only. Waits until there's something newer than read(), then update()s to it.
+   const T& waitForNew() {
+      fresh.waitUntil([&] { return (middle.load(std::memory_order_acquire) & Fresh) != 0; });
+      update();
+      return read();
+   }
+
+   /// How many times publish() has been called. Any thread.
+   uint64 publishCount() const { return published.load(std::memory_order_relaxed); }
+
+  private:
+   static constexpr uint8 IndexMask = 3;
+   static constexpr uint8 Fresh     = 4;  // Set in middle when it's been published and not read yet
+
+   struct alignas(CacheLine) Buffer {
+      T value{};
+   };
+
+   Buffer buffers[3];
+   alignas(CacheLine) uint8 back  = 0;  // Writer's
+   alignas(CacheLine) uint8 front = 1;  // Reader's
+   alignas(CacheLine) std::atomic<uint8> middle{2};
+   std::atomic<uint64> published{0};
+   alignas(CacheLine) ChannelWait<Blocking> fresh;
+};
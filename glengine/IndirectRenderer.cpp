@@ -0,0 +1,388 @@
+#include "IndirectRenderer.hpp"
+
+#include <algorithm>
+
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+namespace {
+constexpr uint32 CullGroupSize = 64;  // local_size_x in cull.comp
+constexpr uint32 MinArenaPiece = 64;  // In vertices/indices
+
+using CmdDrawIndexedIndirectCount = void(VKAPI_PTR*)(VkCommandBuffer, VkBuffer, VkDeviceSize, VkBuffer, VkDeviceSize,
+                                                     uint32_t, uint32_t);
+
+uint32 roundUpPow2(uint32 val) {
+   uint32 res = 1;
+   while (res < val)
+      res <<= 1;
+   return res;
+}
+
+/// Buddy arenas only come in powers of 2, so make the config say what we actually get.
+IndirectRenderer::Config rounded(IndirectRenderer::Config config) {
+   config.maxVertices = roundUpPow2(config.maxVertices);
+   config.maxIndices  = roundUpPow2(config.maxIndices);
+   return config;
+}
+}  // namespace
+
+/// Gribb/Hartmann. Vulkan depth is [0, 1], so the near plane is just the third row.
+void IndirectRenderer::ExtractPlanes(const glm::mat4& m, glm::vec4 planes[6]) {
+   auto row = [&](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+
+   planes[0] = row(3) + row(0);  // Left
+   planes[1] = row(3) - row(0);  // Right
+   planes[2] = row(3) + row(1);  // Bottom
+   planes[3] = row(3) - row(1);  // Top
+   planes[4] = row(2);           // Near
+   planes[5] = row(3) - row(2);  // Far
+
+   for (int i = 0; i < 6; i++)
+      planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+IndirectRenderer::IndirectRenderer(vk::Device& dev, GpuAllocator& allocator, UploadQueue& uploads,
+                                   vk::PipelineCache cache, const Config& config, const Features& features,
+                                   size_t frames)
+    : VulkanObject(dev),
+      allocator{allocator},
+      uploads{uploads},
+      config{rounded(config)},
+      features{features},
+      frames{frames},
+      vertexSpace{this->config.maxVertices, MinArenaPiece},
+      indexSpace{this->config.maxIndices, MinArenaPiece} {
+   using Usage = vk::BufferUsageFlagBits;
+   auto shared = uploads.families();  // Written piecemeal while the GPU reads the rest, so skip ownership transfers
+
+   this->vertexArena = allocator.createBuffer(vk::DeviceSize(this->config.maxVertices) * this->config.vertexStride,
+                                              Usage::eVertexBuffer | Usage::eStorageBuffer | Usage::eTransferDst,
+                                              MemoryUsage::GpuOnly, BufferFlags(0), shared);
+   this->indexArena  = allocator.createBuffer(vk::DeviceSize(this->config.maxIndices) * sizeof(uint32),
+                                             Usage::eIndexBuffer | Usage::eStorageBuffer | Usage::eTransferDst,
+                                             MemoryUsage::GpuOnly, BufferFlags(0), shared);
+   this->objectTable = allocator.createBuffer(vk::DeviceSize(this->config.maxObjects) * sizeof(GpuObject),
+                                              Usage::eStorageBuffer | Usage::eTransferDst, MemoryUsage::GpuOnly,
+                                              BufferFlags(0), shared);
+   this->readback    = allocator.createBuffer(frames * sizeof(uint32), Usage::eTransferDst, MemoryUsage::Readback);
+   this->objects.resize(this->config.maxObjects);
+
+   buildCullPipeline(cache);
+   if (!isEnabled())
+      return;
+
+   auto poolSizes = vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 3 * frames);
+   this->descPool = dev.createDescriptorPool(
+       vk::DescriptorPoolCreateInfo().setMaxSets(frames).setPoolSizeCount(1).setPPoolSizes(&poolSizes));
+
+   this->perFrame.resize(frames);
+   for (auto& frame : this->perFrame) {
+      auto drawsSize = vk::DeviceSize(this->config.maxObjects) * sizeof(VkDrawIndexedIndirectCommand);
+      frame.draws    = allocator.createBuffer(drawsSize,
+                                           Usage::eStorageBuffer | Usage::eIndirectBuffer | Usage::eTransferDst,
+                                           MemoryUsage::GpuOnly);
+      frame.count    = allocator.createBuffer(
+          sizeof(uint32), Usage::eStorageBuffer | Usage::eIndirectBuffer | Usage::eTransferDst | Usage::eTransferSrc,
+          MemoryUsage::GpuOnly);
+
+      frame.set = dev.allocateDescriptorSets(vk::DescriptorSetAllocateInfo()
+                                                 .setDescriptorPool(this->descPool)
+                                                 .setDescriptorSetCount(1)
+                                                 .setPSetLayouts(&this->setLayout))[0];
+
+      vk::DescriptorBufferInfo infos[] = {{this->objectTable.buffer, 0, VK_WHOLE_SIZE},
+                                          {frame.draws.buffer, 0, VK_WHOLE_SIZE},
+                                          {frame.count.buffer, 0, VK_WHOLE_SIZE}};
+      dev.updateDescriptorSets(vk::WriteDescriptorSet()
+                                   .setDstSet(frame.set)
+                                   .setDstBinding(0)
+                                   .setDescriptorCount(3)
+                                   .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                                   .setPBufferInfo(infos),
+                               nullptr);
+   }
+
+   Logger::Info("GPU-driven drawing up with room for ", this->config.maxObjects, " objects, using ",
+                this->drawIndirectCount ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirect");
+}
+
+IndirectRenderer::~IndirectRenderer() {
+   for (auto& frame : this->perFrame) {
+      allocator.destroy(frame.draws);
+      allocator.destroy(frame.count);
+   }
+   if (this->descPool)
+      dev.destroyDescriptorPool(this->descPool);
+   if (this->setLayout)
+      dev.destroyDescriptorSetLayout(this->setLayout);
+   this->cullPipe.reset();
+
+   allocator.destroy(this->readback);
+   allocator.destroy(this->objectTable);
+   allocator.destroy(this->indexArena);
+   allocator.destroy(this->vertexArena);
+}
+
+void IndirectRenderer::buildCullPipeline(vk::PipelineCache cache) {
+   if (!std::ifstream(this->config.cullShader)) {
+      Logger::Error("No ", this->config.cullShader, ", so GPU-driven drawing is off");
+      return;
+   }
+   auto src = LoadFile(this->config.cullShader);
+
+   vk::DescriptorSetLayoutBinding bindings[3];
+   for (uint32 i = 0; i < 3; i++)
+      bindings[i] = vk::DescriptorSetLayoutBinding(i, vk::DescriptorType::eStorageBuffer, 1,
+                                                   vk::ShaderStageFlagBits::eCompute);
+   this->setLayout =
+       dev.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo().setBindingCount(3).setPBindings(bindings));
+
+   auto pushRange = vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullParams));
+
+   auto shader    = VulkanShader::FromSrc(src, VulkanShader::Stage::Compute, dev);
+   this->cullPipe = std::make_unique<ComputePipeline>(dev);
+   this->cullPipe->setStage(shader);
+   this->cullPipe->layoutInfo.setSetLayoutCount(1)
+       .setPSetLayouts(&this->setLayout)
+       .setPushConstantRangeCount(1)
+       .setPPushConstantRanges(&pushRange);
+   this->cullPipe->build(cache);
+   dev.destroyShaderModule(shader);
+
+   // An extension function, so it has to come through the device rather than the loader's exports
+   if (this->features.drawIndirectCount)
+      this->drawIndirectCount = dev.getProcAddr("vkCmdDrawIndexedIndirectCountKHR");
+}
+
+int32 IndirectRenderer::add(const void* vertices, uint32 vertexCount, const uint32* indices, uint32 indexCount,
+                            glm::vec3 center, float radius) {
+   auto slot = stage(vertices, vertexCount, indices, indexCount, center, radius);
+   return slot ? *slot : -1;
+}
+
+Optional<int32> IndirectRenderer::stage(const Mesh& mesh) {
+   return stage(mesh.vertices.data(), uint32(mesh.vertices.size() / this->config.vertexStride), mesh.indices.data(),
+                uint32(mesh.indices.size()), mesh.center, mesh.radius);
+}
+
+Optional<int32> IndirectRenderer::stage(const void* vertices, uint32 vertexCount, const uint32* indices,
+                                        uint32 indexCount, glm::vec3 center, float radius) {
+   PROFILE_FUNCTION();
+   if (!isEnabled())
+      return -1;
+
+   int32 slot;
+   if (!this->freeSlots.empty()) {
+      slot = this->freeSlots.back();
+      this->freeSlots.pop_back();
+   } else if (this->slotsUsed < this->config.maxObjects)
+      slot = this->slotsUsed++;
+   else {
+      Logger::Error("IndirectRenderer is out of object slots");
+      return -1;
+   }
+
+   auto& obj = this->objects[slot];
+   if (!this->vertexSpace.alloc(vertexCount, 1, obj.vertexOffset, obj.vertexOrder)) {
+      Logger::Error("IndirectRenderer's vertex arena is full");
+      this->freeSlots.push_back(slot);
+      return -1;
+   }
+   if (!this->indexSpace.alloc(indexCount, 1, obj.indexOffset, obj.indexOrder)) {
+      Logger::Error("IndirectRenderer's index arena is full");
+      this->vertexSpace.free(obj.vertexOffset, obj.vertexOrder);
+      this->freeSlots.push_back(slot);
+      return -1;
+   }
+
+   // Both or neither, so there's never a half written mesh in space that's about to be handed out again
+   auto staged = uploads.tryUpload({UploadRegion(this->vertexArena, obj.vertexOffset * this->config.vertexStride,
+                                                 vertices, vk::DeviceSize(vertexCount) * this->config.vertexStride),
+                                    UploadRegion(this->indexArena, obj.indexOffset * sizeof(uint32), indices,
+                                                 indexCount * sizeof(uint32))});
+   if (!staged) {
+      this->indexSpace.free(obj.indexOffset, obj.indexOrder);
+      this->vertexSpace.free(obj.vertexOffset, obj.vertexOrder);
+      this->freeSlots.push_back(slot);
+      return None<int32>();
+   }
+   obj.live = true;
+   this->liveObjects++;
+
+   // The object goes last, so by the time it's visible to the cull pass the mesh is too
+   writeObject(slot, {glm::vec4(center, radius), indexCount, uint32(obj.indexOffset), int32(obj.vertexOffset), 0});
+
+   return slot;
+}
+
+void IndirectRenderer::remove(int32 slot) {
+   if (slot < 0 || !this->objects[slot].live)
+      return;
+
+   this->objects[slot].live = false;
+   this->liveObjects--;
+
+   // Culled from here on. The arenas can't be reused until that's made it to the GPU and the frames still drawing
+   // the old mesh are done, so give it a couple of frames past the upload's.
+   writeObject(slot, {}, true);
+}
+
+uint64 IndirectRenderer::apply(const std::vector<Change>& changes) {
+   for (const auto& change : changes) {
+      if (change.seq <= this->appliedSeq)
+         continue;  // Resent because the game thread hadn't heard we'd done it yet
+      this->appliedSeq = change.seq;
+
+      // Whatever the key had goes, whether or not there's a new mesh for it
+      auto old = this->keyedSlots.find(change.key);
+      if (old != this->keyedSlots.end()) {
+         remove(old->second);
+         this->keyedSlots.erase(old);
+      }
+      this->waitingMeshes.erase(change.key);
+
+      if (!change.mesh)
+         continue;
+      auto slot = stage(*change.mesh);
+      if (!slot)
+         this->waitingMeshes[change.key] = change.mesh;
+      else if (*slot >= 0)
+         this->keyedSlots[change.key] = *slot;
+   }
+   return this->appliedSeq;
+}
+
+void IndirectRenderer::writeObject(int32 slot, const GpuObject& obj, bool thenFree) {
+   auto& object = this->objects[slot];
+   object.write = obj;
+   object.freeAfterWrite |= thenFree;
+   if (!object.writePending) {
+      object.writePending = true;
+      this->pendingWrites.push_back(slot);
+   }
+}
+
+void IndirectRenderer::flushWrites() {
+   if (this->frameNumber < this->writesFrom)
+      return;
+
+   while (!this->pendingWrites.empty()) {
+      int32 slot   = this->pendingWrites.front();
+      auto& object = this->objects[slot];
+      auto  ticket = uploads.tryUpload(this->objectTable, slot * sizeof(GpuObject), &object.write, sizeof(GpuObject));
+      if (!ticket)
+         return;  // Next frame, once collect() has freed some space
+
+      if (object.freeAfterWrite)
+         this->pendingFrees.push_back({*ticket, 0, slot});
+      object.writePending   = false;
+      object.freeAfterWrite = false;
+      this->pendingWrites.pop_front();
+   }
+}
+
+void IndirectRenderer::beginFrame(size_t frame, uint64 frameNumber) {
+   this->frameNumber = frameNumber;
+
+   for (auto it = this->waitingMeshes.begin(); it != this->waitingMeshes.end();) {
+      auto slot = stage(*it->second);
+      if (!slot) {
+         it++;
+         continue;
+      }
+      if (*slot >= 0)
+         this->keyedSlots[it->first] = *slot;
+      it = this->waitingMeshes.erase(it);
+   }
+   flushWrites();
+
+   // Once the emptied object is on the GPU, nothing recorded after it can draw the old mesh. The frames before it
+   // are all done framesInFlight frames later.
+   for (auto& pending : this->pendingFrees)
+      if (!pending.freeAt && uploads.isReady(pending.ticket))
+         pending.freeAt = frameNumber + this->frames;
+
+   while (!this->pendingFrees.empty() && this->pendingFrees.front().freeAt &&
+          this->pendingFrees.front().freeAt <= frameNumber) {
+      auto& obj = this->objects[this->pendingFrees.front().slot];
+      this->vertexSpace.free(obj.vertexOffset, obj.vertexOrder);
+      this->indexSpace.free(obj.indexOffset, obj.indexOrder);
+      this->freeSlots.push_back(this->pendingFrees.front().slot);
+      this->pendingFrees.pop_front();
+   }
+
+   if (!isEnabled())
+      return;
+
+   // frame's fence has signaled, so whatever its cull pass counted has landed
+   dev.invalidateMappedMemoryRanges(
+       vk::MappedMemoryRange(this->readback.alloc.memory, this->readback.alloc.offset, VK_WHOLE_SIZE));
+   this->lastVisible = static_cast<const uint32*>(this->readback.data())[frame];
+}
+
+void IndirectRenderer::recordCull(vk::CommandBuffer cmd, size_t frame) {
+   PROFILE_FUNCTION();
+   if (!isEnabled())
+      return;
+
+   using Stage  = vk::PipelineStageFlagBits;
+   using Access = vk::AccessFlagBits;
+   auto& cur    = this->perFrame[frame];
+
+   // Empty slots have to read as indexCount 0
+   if (this->writesFrom == std::numeric_limits<uint64>::max()) {
+      cmd.fillBuffer(this->objectTable.buffer, 0, VK_WHOLE_SIZE, 0);
+      this->writesFrom = this->frameNumber + this->frames;
+   }
+   cmd.fillBuffer(cur.count.buffer, 0, sizeof(uint32), 0);
+   // Without a count every slot gets drawn, so the ones the cull pass doesn't write have to be empty
+   if (!this->drawIndirectCount && this->slotsUsed > 0)
+      cmd.fillBuffer(cur.draws.buffer, 0, this->slotsUsed * sizeof(VkDrawIndexedIndirectCommand), 0);
+
+   cmd.pipelineBarrier(Stage::eTransfer, Stage::eComputeShader, {},
+                       vk::MemoryBarrier(Access::eTransferWrite, Access::eShaderRead | Access::eShaderWrite), nullptr,
+                       nullptr);
+
+   CullParams params;
+   ExtractPlanes(this->viewProj, params.planes);
+   params.objectCount = this->slotsUsed;
+
+   cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *this->cullPipe->pipe);
+   cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *this->cullPipe->layout, 0, cur.set, nullptr);
+   cmd.pushConstants(*this->cullPipe->layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+   cmd.dispatch((this->slotsUsed + CullGroupSize - 1) / CullGroupSize, 1, 1);
+
+   cmd.pipelineBarrier(Stage::eComputeShader, Stage::eDrawIndirect | Stage::eTransfer, {},
+                       vk::MemoryBarrier(Access::eShaderWrite, Access::eIndirectCommandRead | Access::eTransferRead),
+                       nullptr, nullptr);
+
+   cmd.copyBuffer(cur.count.buffer, this->readback.buffer, vk::BufferCopy(0, frame * sizeof(uint32), sizeof(uint32)));
+   cmd.pipelineBarrier(Stage::eTransfer, Stage::eHost, {}, vk::MemoryBarrier(Access::eTransferWrite, Access::eHostRead),
+                       nullptr, nullptr);
+}
+
+void IndirectRenderer::recordDraw(vk::CommandBuffer cmd, size_t frame, vk::Extent2D extent) {
+   PROFILE_FUNCTION();
+   auto* pipeline = this->drawPipe ? this->drawPipe->get() : nullptr;
+   if (!isEnabled() || !pipeline || this->slotsUsed == 0)
+      return;
+
+   const auto& cur    = this->perFrame[frame];
+   const auto  stride = sizeof(VkDrawIndexedIndirectCommand);
+
+   cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline->pipe);
+   cmd.setViewport(0, vk::Viewport(0.0f, 0.0f, extent.width, extent.height, 0.0f, 1.0f));
+   cmd.setScissor(0, vk::Rect2D({0, 0}, extent));
+   cmd.bindVertexBuffers(0, this->vertexArena.buffer, vk::DeviceSize(0));
+   cmd.bindIndexBuffer(this->indexArena.buffer, 0, vk::IndexType::eUint32);
+
+   if (this->drawIndirectCount)
+      reinterpret_cast<CmdDrawIndexedIndirectCount>(this->drawIndirectCount)(
+          cmd, cur.draws.buffer, 0, cur.count.buffer, 0, this->slotsUsed, stride);
+   else if (this->features.multiDrawIndirect)
+      cmd.drawIndexedIndirect(cur.draws.buffer, 0, this->slotsUsed, stride);
+   else
+      for (uint32 i = 0; i < this->slotsUsed; i++)
+         cmd.drawIndexedIndirect(cur.draws.buffer, i * stride, 1, stride);
+}
@@ -0,0 +1,191 @@
+#pragma once
+/*
+ * GPU-driven drawing for lots of small meshes (i.e. chunks).
+ *
+ * Every mesh lives in one shared vertex arena and one shared index arena, and gets a slot in an object table holding
+ * its bounding sphere and draw args. Each frame a compute pass (cull.comp) tests every slot against the frustum and
+ * appends a VkDrawIndexedIndirectCommand for each survivor, and the whole lot is drawn with a single
+ * vkCmdDrawIndexedIndirectCount, however many chunks there are. Without VK_KHR_draw_indirect_count the draw list is
+ * cleared first and drawn with vkCmdDrawIndexedIndirect over every slot, so culled slots are just empty draws.
+ *
+ * firstInstance of each draw is the object's slot, so the vertex shader can find per-object data with gl_InstanceIndex.
+ *
+ * The count the GPU came up with is read back a few frames later (visibleCount()), mostly so tests can check it.
+ */
+
+#include <deque>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "VulkanBase.hpp"
+
+#include "GpuAllocator.hpp"
+#include "Pipeline.hpp"
+#include "Types.hpp"
+#include "UploadQueue.hpp"
+
+class IndirectRenderer : VulkanObject {
+  public:
+   struct Config {
+      uint32      vertexStride = 0;  // Bytes per vertex. Must be set.
+      uint32      maxVertices  = 4 * 1024 * 1024;
+      uint32      maxIndices   = 16 * 1024 * 1024;
+      uint32      maxObjects   = 64 * 1024;
+      std::string cullShader   = "cull.spv";
+   };
+
+   struct Features {
+      bool drawIndirectCount;  // VK_KHR_draw_indirect_count is enabled
+      bool multiDrawIndirect;  // Otherwise we fall back on one vkCmdDrawIndexedIndirect per slot
+   };
+
+   /// A mesh as the game thread hands it over. Owns its data, since it's uploaded some time later on the render thread.
+   struct Mesh {
+      std::vector<ubyte>  vertices;  // vertexStride bytes each
+      std::vector<uint32> indices;
+      glm::vec3           center{0.0f};
+      float               radius = 0.0f;
+   };
+
+   /// An add (or remove, with no mesh) from the game thread. See VulkanFramePacket::addIndirect().
+   struct Change {
+      uint64                      seq;  // Counts up from 1, so a change that's sent twice is only applied once
+      uint64                      key;  // Whatever the game calls the mesh, i.e. a chunk's position
+      std::shared_ptr<const Mesh> mesh;
+   };
+
+   IndirectRenderer(vk::Device& dev, GpuAllocator& allocator, UploadQueue& uploads, vk::PipelineCache cache,
+                    const Config& config, const Features& features, size_t frames);
+   /// Only once the device is idle.
+   ~IndirectRenderer();
+
+   IndirectRenderer(const IndirectRenderer&) = delete;
+   IndirectRenderer& operator=(const IndirectRenderer&) = delete;
+
+   /// False if the cull shader couldn't be loaded; everything else becomes a no-op.
+   bool isEnabled() const { return this->cullPipe != nullptr; }
+
+   /// Uploads the mesh and returns its slot, or -1 if an arena or the object table is full, or the staging ring can't
+   /// take the mesh right now (try again next frame). It starts getting drawn once its upload's done. Render thread
+   /// only, like everything else here, so it never waits on the ring. The game thread goes through apply() instead.
+   int32 add(const void* vertices, uint32 vertexCount, const uint32* indices, uint32 indexCount, glm::vec3 center,
+             float radius);
+   /// The slot stops being drawn straight away and its arena space is reused once the GPU's done with it.
+   void remove(int32 slot);
+
+   /// Render thread. Applies the changes it hasn't seen yet, in order, and returns the newest seq it has. Adding a key
+   /// that's already there replaces its mesh. One the ring can't take yet is retried every frame until it can, unless
+   /// a later change replaces or removes it first.
+   uint64 apply(const std::vector<Change>& changes);
+
+   /// Planes are pulled out of viewProj each frame. VulkanBackend sets it from each packet's camera.
+   void setViewProj(const glm::mat4& viewProj) { this->viewProj = viewProj; }
+
+   /// Drawn with this. Its layout has to be compatible with whatever the vertex shader expects.
+   void setPipeline(std::shared_ptr<PipelineHandle> pipeline) { this->drawPipe = std::move(pipeline); }
+
+   /// Once frame's fence has signaled. Picks up its read back count and frees anything that's now safe to. Before
+   /// UploadQueue::beginFrame.
+   void beginFrame(size_t frame, uint64 frameNumber);
+   /// Outside the render pass, before recordDraw.
+   void recordCull(vk::CommandBuffer cmd, size_t frame);
+   /// Inside the render pass.
+   void recordDraw(vk::CommandBuffer cmd, size_t frame, vk::Extent2D extent);
+
+   /// The planes the cull pass tests against (normals pointing inwards), for checking its results on the CPU.
+   static void ExtractPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]);
+
+   uint32 objectCount() const { return this->liveObjects; }
+   /// How many objects the GPU drew, as of a few frames ago.
+   uint32 visibleCount() const { return this->lastVisible; }
+
+  private:
+   /// Matches Object in cull.comp
+   struct GpuObject {
+      glm::vec4 sphere;
+      uint32    indexCount, firstIndex;
+      int32     vertexOffset;
+      uint32    pad;
+   };
+
+   /// Matches Cull in cull.comp
+   struct CullParams {
+      glm::vec4 planes[6];
+      uint32    objectCount;
+   };
+
+   struct Object {
+      bool   live = false;
+      uint64 vertexOffset, indexOffset;
+      uint8  vertexOrder, indexOrder;
+
+      // The objectTable write that hasn't been staged yet, if writePending. Only the newest one is kept.
+      GpuObject write;
+      bool      writePending   = false;
+      bool      freeAfterWrite = false;  // Once it's staged, the arena space goes on pendingFrees
+   };
+
+   struct PendingFree {
+      UploadTicket ticket;  // Emptying the object out
+      uint64       freeAt;  // frameNumber, or 0 until ticket is ready
+      int32        slot;
+   };
+
+   struct PerFrame {
+      VulkanBuffer      draws, count;
+      vk::DescriptorSet set;
+   };
+
+   void buildCullPipeline(vk::PipelineCache cache);
+   /// add(), except it's None when the only problem is that the ring's full right now.
+   Optional<int32> stage(const void* vertices, uint32 vertexCount, const uint32* indices, uint32 indexCount,
+                         glm::vec3 center, float radius);
+   Optional<int32> stage(const Mesh& mesh);
+   /// Queued until the next beginFrame. Writing a slot that already has one queued replaces it, so there's only ever
+   /// one write per slot in flight through the ring at a time.
+   void writeObject(int32 slot, const GpuObject& obj, bool thenFree = false);
+   /// Stages as many queued writes as the ring will take, oldest first. Nothing until the table's clear is done.
+   void flushWrites();
+
+   GpuAllocator& allocator;
+   UploadQueue&  uploads;
+   Config        config;
+   Features      features;
+   size_t        frames;
+
+   // Arenas are sub-allocated in vertices/indices rather than bytes
+   VulkanBuffer vertexArena, indexArena, objectTable;
+   BuddyBlock   vertexSpace, indexSpace;
+
+   std::vector<Object>      objects;
+   std::vector<int32>       freeSlots;
+   std::deque<int32>        pendingWrites;  // Slots with writePending, oldest first
+   std::deque<PendingFree>  pendingFrees;
+   uint32                   slotsUsed = 0, liveObjects = 0;  // slotsUsed is one past the highest slot ever handed out
+
+   // What apply() has done
+   std::unordered_map<uint64, int32>                       keyedSlots;
+   std::unordered_map<uint64, std::shared_ptr<const Mesh>> waitingMeshes;  // Not staged yet, by key
+   uint64                                                  appliedSeq = 0;
+
+   // The table's cleared with vkCmdFillBuffer in the first cull pass. Staged writes could overtake that on the transfer
+   // queue, so none go until the frame it was recorded in is done.
+   uint64 writesFrom  = std::numeric_limits<uint64>::max();  // frameNumber
+   uint64 frameNumber = 0;                                   // As of the last beginFrame
+
+   vk::DescriptorSetLayout          setLayout;
+   vk::DescriptorPool               descPool;
+   std::unique_ptr<ComputePipeline> cullPipe;
+   std::shared_ptr<PipelineHandle>  drawPipe;
+   std::vector<PerFrame>            perFrame;
+   VulkanBuffer                     readback;  // A uint32 draw count per frame
+   PFN_vkVoidFunction               drawIndirectCount = nullptr;  // Only with VK_KHR_draw_indirect_count
+
+   glm::mat4 viewProj    = glm::mat4(1.0f);
+   uint32    lastVisible = 0;
+};
@@ -2,4 +2,370 @@
 
 #include <SDL2/SDL.h>
 
+#include <algorithm>
+#include <limits>
 
+Input::Input(SDL_Window* window) : window{window}, running{true}, windowDims{1, 1} {
+   if (window)
+      SDL_GetWindowSize(window, &windowDims.x, &windowDims.y);
+
+   // Axis 0, for unbound names. Key 0 has no scancode, so nothing ever sets it.
+   this->axes.emplace_back(AxisMapping(AxisType::Keyboard, KeyID(0)));
+   this->axisHashes.push_back(0);
+   this->isChanged.push_back(false);
+   this->axisNames.push_back("<unbound>");
+   this->axisSlots.resize(MinSlots);
+}
+
+Input::~Input() = default;
+
+void Input::update() {
+   PROFILE_FUNCTION();
+   if (this->indexDirty)
+      rebuildIndex();
+
+   // Whatever changed last frame has been seen for a frame now. Every other axis already has prev == cur.
+   for (AxisID id : this->changed) {
+      this->axes[id].prev = this->axes[id].cur;
+      this->isChanged[id] = false;
+   }
+   this->changed.clear();
+
+   SDL_Event event;
+   if (this->replay) {
+      while (SDL_PollEvent(&event))
+         if (event.type == SDL_QUIT)
+            running = false;
+
+      this->replay->nextFrame(this->replayEvents, this->replayAxes, window ? SDL_GetWindowID(window) : 0);
+      for (const auto& replayed : this->replayEvents) {
+         handleEvent(replayed);
+         if (this->recorder)
+            this->recorder->addEvent(replayed);
+      }
+   } else {
+      while (SDL_PollEvent(&event)) {
+         handleEvent(event);
+         if (this->recorder)
+            this->recorder->addEvent(event);
+      }
+   }
+
+   if (this->recorder)
+      endRecordingFrame();
+   if (this->replay)
+      checkReplayFrame();
+
+   dispatchKeyCallbacks();
+}
+
+bool Input::startRecording(const std::string& path) {
+   // Whatever's already held down has to be there from the start of the replay too
+   std::vector<RecordedAxis> initial;
+   for (AxisID id = 1; id < this->axes.size(); id++)
+      if (this->axes[id].cur != 0.0f)
+         initial.push_back({id, this->axes[id].cur});
+
+   this->recorder = std::make_unique<InputRecorder>(path, windowDims, initial);
+   if (!this->recorder->isOpen()) {
+      this->recorder.reset();
+      return false;
+   }
+   Logger::Info("Recording input to ", path);
+   return true;
+}
+
+void Input::stopRecording() {
+   if (!this->recorder)
+      return;
+   if (this->recorder->close())
+      Logger::Info("Recorded ", this->recorder->frameCount(), " frames of input");
+   else
+      Logger::Error("Input recording failed partway; only some of ", this->recorder->frameCount(), " frames were kept");
+   this->recorder.reset();
+}
+
+void Input::endRecordingFrame() {
+   std::vector<RecordedAxis> values;
+   values.reserve(this->changed.size());
+   for (AxisID id : this->changed)
+      values.push_back({id, this->axes[id].cur});
+   this->recorder->endFrame(values);
+}
+
+bool Input::startReplay(const std::string& path, bool quitAtEnd) {
+   auto replay = std::make_unique<InputReplay>(path);
+   if (!replay->isOpen())
+      return false;
+
+   // Start from exactly where the recording did
+   for (AxisID id = 1; id < this->axes.size(); id++)
+      if (this->axes[id].cur != 0.0f)
+         setAxis(id, 0.0f);
+   for (const auto& axis : replay->initialAxes())
+      if (axis.id < this->axes.size())
+         setAxis(axis.id, axis.value);
+   windowDims = replay->windowDims();
+
+   this->replay           = std::move(replay);
+   this->quitAtReplayEnd  = quitAtEnd;
+   this->replayMismatches = 0;
+   Logger::Info("Replaying input from ", path);
+   return true;
+}
+
+void Input::checkReplayFrame() {
+   for (const auto& axis : this->replayAxes)
+      if (axis.id >= this->axes.size() || this->axes[axis.id].cur != axis.value) {
+         if (!this->replayMismatches)
+            Logger::Error("Replayed input diverged from the recording: axis ", axis.id, " should be ", axis.value);
+         this->replayMismatches++;
+      }
+
+   if (this->replay->done()) {
+      Logger::Info("Input replay finished", this->replayMismatches ? "" : ", matching the recording exactly");
+      this->replay.reset();
+      if (this->quitAtReplayEnd)
+         running = false;
+      else if (window)
+         SDL_GetWindowSize(window, &windowDims.x, &windowDims.y);  // Back to the real one
+   }
+}
+
+void Input::handleEvent(const SDL_Event& event) {
+   switch (event.type) {
+      case SDL_QUIT:
+         running = false;
+         break;
+
+      case SDL_KEYDOWN:
+      case SDL_KEYUP: {
+         if (event.key.repeat)
+            break;  // Nothing's changed
+
+         auto  state = event.type == SDL_KEYDOWN ? ButtonState::Down : ButtonState::Up;
+         float value = state == ButtonState::Down ? 1.0f : 0.0f;
+         this->byScancode.forEach(event.key.keysym.scancode, [&](AxisID id) { setAxis(id, value); });
+         if (!this->keyCallbacks[static_cast<size_t>(state)].empty())
+            this->keyEvents.push_back({state, event.key.keysym.sym});
+         break;
+      }
+
+      case SDL_MOUSEBUTTONDOWN:
+      case SDL_MOUSEBUTTONUP: {
+         float value = event.type == SDL_MOUSEBUTTONDOWN ? 1.0f : 0.0f;
+         this->byMouseButton.forEach(event.button.button, [&](AxisID id) { setAxis(id, value); });
+         break;
+      }
+
+      case SDL_MOUSEMOTION:
+         this->byMouseAxis.forEach(static_cast<uint32_t>(MouseAxis::X), [&](AxisID id) {
+            setAxis(id, event.motion.x / static_cast<float>(windowDims.x));
+         });
+         this->byMouseAxis.forEach(static_cast<uint32_t>(MouseAxis::Y), [&](AxisID id) {
+            setAxis(id, event.motion.y / static_cast<float>(windowDims.y));
+         });
+         break;
+
+      case SDL_WINDOWEVENT:
+         if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED &&
+             event.window.windowID == (window ? SDL_GetWindowID(window) : 0))
+            windowDims = {event.window.data1, event.window.data2};
+         break;
+
+      case SDL_KEYMAPCHANGED:
+         rebuildIndex();  // Axes are bound to keycodes, and which scancode each is on just moved
+         break;
+
+      default:
+         break;
+   }
+}
+
+void Input::setAxis(AxisID id, float value) {
+   this->axes[id].cur = value;
+   if (!this->isChanged[id]) {
+      this->isChanged[id] = true;
+      this->changed.push_back(id);
+   }
+}
+
+void Input::fullUpdate() {
+   PROFILE_FUNCTION();
+   if (this->replay)
+      return;
+   if (this->indexDirty)
+      rebuildIndex();
+
+   // Todo: Perhaps have this take from an external state so we could theoretically multithread this part (assuming
+   // enough axes).
+   auto kbstate = SDL_GetKeyboardState(nullptr);
+   int  mouseX, mouseY;
+   auto mouseState = SDL_GetMouseState(&mouseX, &mouseY);
+   if (window)
+      SDL_GetWindowSize(window, &windowDims.x, &windowDims.y);
+
+   for (AxisID id : this->changed)
+      this->isChanged[id] = false;
+   this->changed.clear();
+
+   for (AxisID id = 1; id < this->axes.size(); id++) {
+      auto&       axis    = this->axes[id];
+      const auto& mapping = axis.mappedTo;
+
+      axis.prev = axis.cur;
+
+      switch (mapping.type) {
+         case AxisType::Keyboard:
+            if (kbstate[axis.scancode])
+               axis.cur = 1.0f;
+            else
+               axis.cur = 0.0f;
+            break;
+
+         case AxisType::MouseButton:
+            if (mouseState & SDL_BUTTON(mapping.mouseButton))
+               axis.cur = 1.0f;
+            else
+               axis.cur = 0.0f;
+            break;
+
+         case AxisType::GamepadButton:
+            Logger::Debug("You haven't implemented Gamepads yet, doofus.");
+            break;
+
+         case AxisType::MouseAxis:
+            if (mapping.mouseAxis == MouseAxis::X)
+               axis.cur = mouseX / static_cast<float>(windowDims.x);
+            else
+               axis.cur = mouseY / static_cast<float>(windowDims.y);
+            break;
+
+         case AxisType::GamepadAxis:
+            Logger::Debug("You haven't implemented this either");
+            break;
+
+         default:
+            Logger::Debug("Attempted to use unknown AxisType ", static_cast<size_t>(mapping.type));
+            break;
+      }
+
+      // Same as if update() had set it, so prev catches up next frame
+      if (axis.cur != axis.prev)
+         setAxis(id, axis.cur);
+   }
+}
+
+Input::AxisID Input::bindAxis(AxisName name, AxisMapping mapping) {
+   if (this->axes.size() * 2 > this->axisSlots.size())
+      growSlots();
+
+   NameSlot& slot = this->axisSlots[findSlot(name.hash)];
+   if (slot.id) {
+      // Otherwise this quietly remaps the other one, so say so whatever the build
+      if (this->axisNames[slot.id] != name.text)
+         Logger::Error("Axis names \"", this->axisNames[slot.id], "\" and \"", name.text, "\" hash the same!");
+      this->axes[slot.id].mappedTo = mapping;
+      this->indexDirty             = true;
+      return slot.id;
+   }
+
+   if (this->axes.size() > std::numeric_limits<AxisID>::max())
+      Logger::ErrorOut("Too many axes bound! Can't bind ", name.text);
+
+   AxisID id = static_cast<AxisID>(this->axes.size());
+   this->axes.emplace_back(mapping);
+   this->axisHashes.push_back(name.hash);
+   this->isChanged.push_back(false);
+   this->axisNames.emplace_back(name.text);
+   slot             = {name.hash, id};
+   this->indexDirty = true;
+   return id;
+}
+
+void Input::growSlots() {
+   this->axisSlots.assign(this->axisSlots.size() * 2, NameSlot());
+   for (AxisID id = 1; id < this->axes.size(); id++)
+      this->axisSlots[findSlot(this->axisHashes[id])] = {this->axisHashes[id], id};
+}
+
+void Input::rebuildIndex() {
+   PROFILE_FUNCTION();
+   std::vector<std::pair<uint32_t, AxisID>> keys, buttons, motion;
+   for (AxisID id = 1; id < this->axes.size(); id++) {
+      auto&       axis    = this->axes[id];
+      const auto& mapping = axis.mappedTo;
+      switch (mapping.type) {
+         case AxisType::Keyboard:
+            axis.scancode = SDL_GetScancodeFromKey(mapping.key);
+            if (axis.scancode != SDL_SCANCODE_UNKNOWN)
+               keys.push_back({axis.scancode, id});
+            break;
+         case AxisType::MouseButton:
+            buttons.push_back({static_cast<uint32_t>(mapping.mouseButton), id});
+            break;
+         case AxisType::MouseAxis:
+            motion.push_back({static_cast<uint32_t>(mapping.mouseAxis), id});
+            break;
+         default:
+            break;  // Gamepads don't do anything yet
+      }
+   }
+
+   this->byScancode.build(SDL_NUM_SCANCODES, keys);
+   this->byMouseButton.build(MaxMouseButtons, buttons);
+   this->byMouseAxis.build(2, motion);
+   this->indexDirty = false;
+}
+
+void Input::ReverseIndex::build(size_t inputs, const std::vector<std::pair<uint32_t, AxisID>>& links) {
+   // Counting sort by input
+   start.assign(inputs + 1, 0);
+   for (const auto& link : links)
+      if (link.first < inputs)
+         start[link.first + 1]++;
+   for (size_t i = 0; i < inputs; i++)
+      start[i + 1] += start[i];
+
+   ids.resize(start[inputs]);
+   std::vector<uint32_t> next(start.begin(), start.end() - 1);
+   for (const auto& link : links)
+      if (link.first < inputs)
+         ids[next[link.first]++] = link.second;
+}
+
+void Input::registerKeyCallback(ButtonState whichState, KeyCallback callback) {
+   this->keyCallbacks[static_cast<size_t>(whichState)].push_back(callback);
+}
+
+void Input::unregisterKeyCallback(KeyCallback callback) {
+   for (auto& callbacks : this->keyCallbacks) {
+      if (this->dispatching)
+         std::replace(callbacks.begin(), callbacks.end(), callback, KeyCallback(nullptr));
+      else
+         callbacks.erase(std::remove(callbacks.begin(), callbacks.end(), callback), callbacks.end());
+   }
+}
+
+void Input::dispatchKeyCallbacks() {
+   this->dispatching = true;
+   // Down and up events are interleaved, so go a run of same-state events at a time
+   std::vector<KeyID> keys;
+   for (size_t start = 0, end; start < this->keyEvents.size(); start = end) {
+      auto state = this->keyEvents[start].state;
+      keys.clear();
+      for (end = start; end < this->keyEvents.size() && this->keyEvents[end].state == state; end++)
+         keys.push_back(this->keyEvents[end].key);
+
+      // Indexed, since callbacks can register more (which won't see this frame's keys)
+      auto& callbacks = this->keyCallbacks[static_cast<size_t>(state)];
+      for (size_t i = 0, count = callbacks.size(); i < count; i++)
+         for (size_t k = 0; k < keys.size() && callbacks[i]; k++)
+            callbacks[i](keys[k]);
+   }
+   this->keyEvents.clear();
+   this->dispatching = false;
+
+   for (auto& callbacks : this->keyCallbacks)
+      callbacks.erase(std::remove(callbacks.begin(), callbacks.end(), KeyCallback(nullptr)), callbacks.end());
+}
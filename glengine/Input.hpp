@@ -1,7 +1,11 @@
 #pragma once
 #include <SDL2/SDL.h>
+#include <cstring>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
@@ -9,7 +13,9 @@
 
 #include <glm/glm.hpp>
 
+#include "InputRecording.hpp"
 #include "Logger.hpp"
+#include "Profiler.hpp"
 
 enum class ButtonState : bool { Down = false, Up };
 enum class MouseAxis : bool { X, Y };
@@ -81,6 +87,12 @@ struct AxisMapping {
    AxisMapping(AxisType ty, std::pair<GamepadID, GPButtonID> button) : type{ty}, gpButton{button} {}
    AxisMapping(AxisType ty, std::pair<GamepadID, GPAxisID> button) : type{ty}, gpAxis{button} {}
    AxisMapping(AxisType ty, MouseAxis ax) : type{ty}, mouseAxis{ax} {}
+   AxisMapping(const AxisMapping&) = default;
+   // std::pair's assignment isn't trivial, which deletes the union's, though every member's just bytes.
+   AxisMapping& operator=(const AxisMapping& other) {
+      std::memcpy(static_cast<void*>(this), &other, sizeof(AxisMapping));
+      return *this;
+   }
 
    AxisType type;
 
@@ -93,93 +105,182 @@ struct AxisMapping {
 };
 
 
+/// An axis's name, hashed (FNV-1a). Input never sees the string, just the hash. Spell it AXIS("jump"), which always
+/// hashes at compile time.
+struct AxisName {
+   constexpr AxisName(const char* name, size_t length) : AxisName(name, length, Hash(name, length)) {}
+   constexpr AxisName(const char* name, size_t length, uint64_t hash) : text{name, length}, hash{hash} {}
+   /// For names that only turn up at runtime (config files, the console), so it hashes then and there.
+   explicit AxisName(const std::string& name) : AxisName(name.data(), name.size()) {}
+
+   static constexpr uint64_t Hash(const char* name, size_t length) {
+      uint64_t hash = 0xCBF29CE484222325;
+      for (size_t i = 0; i < length; i++)
+         hash = (hash ^ static_cast<uint8_t>(name[i])) * 0x100000001B3;
+      return hash;
+   }
+
+   std::string_view text;  // Only for diagnostics. Only valid as long as whatever it was made from is.
+   uint64_t         hash;
+};
+
+// The hash as a template argument is what makes it a constant expression. NAME has to be a string literal.
+#define AXIS(NAME) \
+   (AxisName{NAME, sizeof(NAME) - 1, std::integral_constant<uint64_t, AxisName::Hash(NAME, sizeof(NAME) - 1)>::value})
+
+/*
+ * Axes are named inputs (keys, mouse buttons and motion, eventually gamepads) as a float, with this frame's and last
+ * frame's value.
+ *
+ * update() is incremental: it only looks at this frame's SDL events, finds the axes each one drives through a reverse
+ * index (scancode/button -> AxisIDs, in flat arrays), and only touches those. So it costs however many events came in,
+ * not however many axes are bound. fullUpdate() re-reads every axis from SDL's state instead, to resync.
+ *
+ * update() can also record what it sees to a file, or replay one of those instead of reading SDL; see
+ * InputRecording.hpp. A replay doesn't need a real window (window can be null), so it runs under SDL's dummy driver.
+ *
+ * Names are looked up by hash in a flat, open addressed table kept at most half full, so it's nearly always one probe.
+ * AxisID 0 is never bound: it's what unbound names find, and always reads 0.
+ */
 class Input {
   public:
    struct Axis {
       Axis(AxisMapping mapping) : mappedTo{mapping} {}
-      float       cur, prev;
-      AxisMapping mappedTo;
+      float        cur = 0.0f, prev = 0.0f;
+      AxisMapping  mappedTo;
+      SDL_Scancode scancode = SDL_SCANCODE_UNKNOWN;  // Keyboard axes only. Looked up when the index is built.
    };
 
    using AxisID      = uint16_t;  ///!> Direct axis lookup. If at all possible, cache this and only use this.
    using KeyCallback = void (*)(KeyID);
 
 
-   Input(SDL_Window* window) : window{window}, running{true} {}
+   Input(SDL_Window* window);
+   ~Input();
 
    bool shouldQuit() { return !running; }
 
-   void update() {
-      SDL_Event event;
-      while (SDL_PollEvent(&event))
-         if (event.type == SDL_QUIT)
-            running = false;
+   /// Drains SDL's events, updating just the axes they drive, then calls the key callbacks with the frame's keys.
+   void update();
+
+   // Forces a full update of every axis. Use sparingly. Does nothing while replaying; the recording's all there is.
+   void fullUpdate();
+
+   /// Writes every update() from here on to path, until stopRecording(). False if it can't be opened.
+   bool startRecording(const std::string& path);
+   void stopRecording();
+   bool isRecording() const { return recorder != nullptr; }
+
+   /// From the next update(), plays path back in place of SDL's events. Live events are still drained, but only
+   /// SDL_QUIT gets through. With quitAtEnd, shouldQuit() goes true once it's all played. False if path can't be read.
+   bool startReplay(const std::string& path, bool quitAtEnd = true);
+   bool isReplaying() const { return replay != nullptr; }
+   /// Recorded axis values replaying didn't reproduce. Anything but 0 means something's not deterministic.
+   uint64_t getReplayMismatches() const { return replayMismatches; }
+
+   /// Binds name to mapping and returns its ID. Binding a name again remaps it, keeping the ID.
+   AxisID bindAxis(AxisName name, AxisMapping mapping);
+   /// Look it up once and keep the ID where you can, though this is hardly more than an index.
+   AxisID findAxis(AxisName name) const {
+      AxisID id = axisSlots[findSlot(name.hash)].id;
+#ifndef NDEBUG
+      if (!id && reportedUnbound.insert(name.hash).second)
+         Logger::Error("Axis \"", name.text, "\" isn't bound");
+#endif
+      return id;
    }
 
-   // Forces a full update of every axis. Use sparingly.
-   void fullUpdate() {
-      // Todo: Perhaps have this take from an external state so we could theoretically multithread this part (assuming
-      // enough axes).
-      auto       kbstate = SDL_GetKeyboardState(nullptr);
-      int        mouseX, mouseY;
-      auto       mouseState = SDL_GetMouseState(&mouseX, &mouseY);
-      glm::ivec2 windowDims;
-      SDL_GetWindowSize(window, &windowDims.x, &windowDims.y);
-
-      for (auto& axis : axes) {
-         const auto& mapping = axis.mappedTo;
-
-         axis.prev = axis.cur;
-
-         switch (mapping.type) {
-            case AxisType::Keyboard:
-               if (kbstate[SDL_GetScancodeFromKey(mapping.key)])
-                  axis.cur = 1.0f;
-               else
-                  axis.cur = 0.0f;
-               break;
-
-            case AxisType::MouseButton:
-               if (mouseState & SDL_BUTTON(mapping.mouseButton))
-                  axis.cur = 1.0f;
-               else
-                  axis.cur = 0.0f;
-               break;
-
-            case AxisType::GamepadButton:
-               Logger::Debug("You haven't implemented Gamepads yet, doofus.");
-               break;
-
-            case AxisType::MouseAxis:
-               if (mapping.mouseAxis == MouseAxis::X)
-                  axis.cur = mouseX / static_cast<float>(windowDims.x);
-               else
-                  axis.cur = mouseY / static_cast<float>(windowDims.y);
-               break;
-
-            case AxisType::GamepadAxis:
-               Logger::Debug("You haven't implemented this either");
-               break;
-
-            default:
-               Logger::Debug("Attempted to use unknown AxisType ", static_cast<size_t>(mapping.type));
-               break;
-         }
-      }
+   inline float     getAxis(AxisName name) const { return getAxis(findAxis(name)); }
+   inline float     getAxis(AxisID id) const { return axes[id].cur; }
+   ButtonState      getRawKeyState(KeyID key) {
+      return SDL_GetKeyboardState(nullptr)[SDL_GetScancodeFromKey(key)] ? ButtonState::Down : ButtonState::Up;
    }
-   inline float     getAxis(const std::string& name) { return getAxis(axisNames[name]); }
-   inline float     getAxis(AxisID id) { return axes[id].cur; }
-   ButtonState      getRawKeyState(KeyID key) { SDL_GetKeyboardState(nullptr)[SDL_GetScancodeFromKey(key)]; }
    ButtonState      getRawButtonState(GamepadID gp, GPButtonID button);  // TODO
    glm::ivec2       getMousePosition();
    MouseButtonState getMouseState();
 
+   /// callback gets every key that went into whichState this frame (not repeats), in order, at the end of update().
+   /// Callbacks are run one at a time over each run of same-state keys rather than once per key, so a callback still
+   /// sees a key go down before it sees it come back up.
    void registerKeyCallback(ButtonState whichState, KeyCallback callback);
+   /// Safe to call from inside a callback.
    void unregisterKeyCallback(KeyCallback callback);
 
   private:
-   SDL_Window*                             window;
-   bool                                    running;
-   std::unordered_map<std::string, AxisID> axisNames;  // AxisID indexes into axes
-   std::vector<Axis>                       axes;
+   /// Input -> the axes it drives, for inputs [0, inputs). Input i's axes are ids[start[i]] up to ids[start[i + 1]].
+   struct ReverseIndex {
+      std::vector<uint32_t> start;
+      std::vector<AxisID>   ids;
+
+      void build(size_t inputs, const std::vector<std::pair<uint32_t, AxisID>>& links);
+
+      template <typename F>
+      void forEach(uint32_t input, F&& func) const {
+         if (input + 1 < start.size())
+            for (uint32_t i = start[input]; i < start[input + 1]; i++)
+               func(ids[i]);
+      }
+   };
+
+   /// Rebuilds the reverse indices from axes. Needed after binding, or when the keyboard layout changes.
+   void rebuildIndex();
+   void handleEvent(const SDL_Event& event);
+   /// Sets an axis and remembers it changed, so its prev gets caught up next update().
+   void setAxis(AxisID id, float value);
+   void dispatchKeyCallbacks();
+   /// Hands the recorder this frame's changed axes, and the replay's axes get checked against what we came to.
+   void endRecordingFrame();
+   void checkReplayFrame();
+
+   struct NameSlot {
+      uint64_t hash = 0;
+      AxisID   id   = 0;  // 0 if empty
+   };
+
+   /// The slot holding hash, or the empty one it would go in.
+   size_t findSlot(uint64_t hash) const {
+      size_t mask = axisSlots.size() - 1;
+      size_t i    = hash & mask;
+      while (axisSlots[i].id && axisSlots[i].hash != hash)
+         i = (i + 1) & mask;
+      return i;
+   }
+   /// Doubles axisSlots and puts every name back.
+   void growSlots();
+
+   static constexpr size_t MaxMouseButtons = 256;  // SDL_MouseButtonEvent::button is a Uint8
+   static constexpr size_t MinSlots        = 256;
+
+   SDL_Window*           window;
+   bool                  running;
+   glm::ivec2            windowDims;
+   std::vector<NameSlot> axisSlots;   // Starting from hash & (size - 1). Always a power of two long.
+   std::vector<uint64_t> axisHashes;  // By AxisID. 0 for axis 0.
+   std::vector<Axis>     axes;
+   std::vector<std::string> axisNames;  // By AxisID, so collisions and the like can say what they're about
+#ifndef NDEBUG
+   mutable std::unordered_set<uint64_t> reportedUnbound;  // So looking one up every frame only complains once
+#endif
+
+   ReverseIndex byScancode, byMouseButton, byMouseAxis;
+   bool         indexDirty = false;
+
+   std::vector<AxisID>  changed;    // Set since the last update() started
+   std::vector<uint8_t> isChanged;  // By AxisID; whether it's in changed
+
+   struct KeyEvent {
+      ButtonState state;
+      KeyID       key;
+   };
+
+   std::vector<KeyCallback> keyCallbacks[2];  // By ButtonState. Nulled if unregistered mid-dispatch, erased after.
+   std::vector<KeyEvent>    keyEvents;        // This frame's, in order
+   bool                     dispatching = false;
+
+   std::unique_ptr<InputRecorder> recorder;
+   std::unique_ptr<InputReplay>   replay;
+   bool                           quitAtReplayEnd  = true;
+   uint64_t                       replayMismatches = 0;
+   std::vector<SDL_Event>         replayEvents;  // This frame's, from replay
+   std::vector<RecordedAxis>      replayAxes;
 };
@@ -0,0 +1,279 @@
+#include "InputRecording.hpp"
+
+#include <cstring>
+
+#include "Logger.hpp"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Input recordings are written little-endian as is"
+#endif
+
+namespace {
+/// On-disk event tags. Don't reorder; old recordings depend on these.
+enum class EventKind : uint8 { Quit = 1, KeyDown, KeyUp, MouseDown, MouseUp, MouseMotion, Resize };
+
+struct FrameHeader {
+   uint32 frame;
+   uint16 events, axes;
+};
+
+template <typename T>
+void Put(std::vector<ubyte>& out, const T& value) {
+   size_t at = out.size();
+   out.resize(at + sizeof(T));
+   std::memcpy(out.data() + at, &value, sizeof(T));
+}
+
+/// Bounds checked; false once it runs off the end.
+struct Reader {
+   const ubyte* data;
+   size_t       size, pos;
+
+   template <typename T>
+   bool get(T& value) {
+      if (size - pos < sizeof(T))
+         return false;
+      std::memcpy(&value, data + pos, sizeof(T));
+      pos += sizeof(T);
+      return true;
+   }
+};
+}  // namespace
+
+InputRecorder::InputRecorder(const std::string& path, glm::ivec2 windowDims, const std::vector<RecordedAxis>& initial)
+    : path{path}, file(path, std::ios::binary | std::ios::trunc) {
+   if (!file.is_open()) {
+      Logger::Error("Couldn't open ", path, " to record input to");
+      return;
+   }
+
+   std::vector<ubyte> header(Magic, Magic + sizeof(Magic));
+   Put(header, Version);
+   Put(header, int32(windowDims.x));
+   Put(header, int32(windowDims.y));
+   Put(header, uint16(initial.size()));
+   for (const auto& axis : initial) {
+      Put(header, axis.id);
+      Put(header, axis.value);
+   }
+   write(header);
+}
+
+InputRecorder::~InputRecorder() {
+   close();
+}
+
+bool InputRecorder::close() {
+   if (!file.is_open())
+      return !failed;
+
+   if (frame && !wroteLast) {
+      std::vector<ubyte> out;
+      Put(out, frame - 1);
+      Put(out, uint16(0));
+      Put(out, uint16(0));
+      write(out);
+   }
+
+   file.close();
+   if (file.fail() && !failed) {
+      Logger::Error("Couldn't finish writing the input recording ", path, "; it may be cut short");
+      failed = true;
+   }
+   return !failed;
+}
+
+void InputRecorder::write(const std::vector<ubyte>& out) {
+   if (failed)
+      return;  // Anything after a gap would only confuse the replay
+
+   file.write(reinterpret_cast<const sbyte*>(out.data()), out.size());
+   file.flush();
+   if (!file.good()) {
+      Logger::Error("Writing the input recording ", path, " failed (disk full?), so it stops at frame ", frame);
+      failed = true;
+   }
+}
+
+void InputRecorder::addEvent(const SDL_Event& event) {
+   size_t before = events.size();
+   switch (event.type) {
+      case SDL_QUIT:
+         Put(events, EventKind::Quit);
+         break;
+
+      case SDL_KEYDOWN:
+      case SDL_KEYUP:
+         if (event.key.repeat)
+            return;
+         Put(events, event.type == SDL_KEYDOWN ? EventKind::KeyDown : EventKind::KeyUp);
+         Put(events, int32(event.key.keysym.sym));
+         break;
+
+      case SDL_MOUSEBUTTONDOWN:
+      case SDL_MOUSEBUTTONUP:
+         Put(events, event.type == SDL_MOUSEBUTTONDOWN ? EventKind::MouseDown : EventKind::MouseUp);
+         Put(events, uint8(event.button.button));
+         break;
+
+      case SDL_MOUSEMOTION:
+         Put(events, EventKind::MouseMotion);
+         Put(events, int32(event.motion.x));
+         Put(events, int32(event.motion.y));
+         break;
+
+      case SDL_WINDOWEVENT:
+         if (event.window.event != SDL_WINDOWEVENT_SIZE_CHANGED)
+            return;
+         Put(events, EventKind::Resize);
+         Put(events, int32(event.window.data1));
+         Put(events, int32(event.window.data2));
+         break;
+
+      default:
+         return;
+   }
+
+   if (eventCount == UINT16_MAX) {
+      events.resize(before);  // Something's flooding us. The axes still get recorded.
+      return;
+   }
+   eventCount++;
+}
+
+void InputRecorder::endFrame(const std::vector<RecordedAxis>& changed) {
+   uint32 thisFrame = frame++;
+   wroteLast        = eventCount || !changed.empty();
+   if (!wroteLast)
+      return;
+
+   std::vector<ubyte> out;
+   out.reserve(sizeof(FrameHeader) + events.size() + changed.size() * 6);
+   Put(out, thisFrame);
+   Put(out, eventCount);
+   Put(out, uint16(changed.size()));
+   out.insert(out.end(), events.begin(), events.end());
+   for (const auto& axis : changed) {
+      Put(out, axis.id);
+      Put(out, axis.value);
+   }
+   write(out);
+
+   events.clear();
+   eventCount = 0;
+}
+
+InputReplay::InputReplay(const std::string& path) : file(path) {
+   if (!file.isOpen())
+      return;
+
+   Reader in{file.data(), file.size(), 0};
+   char   magic[sizeof(InputRecorder::Magic)];
+   uint32 version;
+   int32  width, height;
+   uint16 count;
+   if (!in.get(magic) || std::memcmp(magic, InputRecorder::Magic, sizeof(magic)) != 0 || !in.get(version)) {
+      Logger::Error(path, " isn't an input recording");
+      return;
+   }
+   if (version != InputRecorder::Version) {
+      Logger::Error(path, " is an input recording from version ", version, ", not ", InputRecorder::Version);
+      return;
+   }
+   if (!in.get(width) || !in.get(height) || !in.get(count)) {
+      Logger::Error(path, " is cut short");
+      return;
+   }
+
+   dims = {width, height};
+   initial.resize(count);
+   for (auto& axis : initial)
+      if (!in.get(axis.id) || !in.get(axis.value)) {
+         Logger::Error(path, " is cut short");
+         return;
+      }
+
+   pos   = in.pos;
+   valid = true;
+}
+
+void InputReplay::nextFrame(std::vector<SDL_Event>& events, std::vector<RecordedAxis>& axes, uint32 windowID) {
+   events.clear();
+   axes.clear();
+   uint32 thisFrame = frame++;
+
+   Reader      in{file.data(), file.size(), pos};
+   FrameHeader header = {};
+   if (done() || !in.get(header.frame) || header.frame != thisFrame)
+      return;  // Nothing happened this frame
+
+   bool ok = in.get(header.events) && in.get(header.axes);
+   for (uint16 i = 0; ok && i < header.events; i++) {
+      SDL_Event event;
+      std::memset(&event, 0, sizeof(event));
+      EventKind kind;
+      if (!(ok = in.get(kind)))
+         break;
+
+      switch (kind) {
+         case EventKind::Quit:
+            event.type = SDL_QUIT;
+            break;
+
+         case EventKind::KeyDown:
+         case EventKind::KeyUp: {
+            int32 sym;
+            ok                        = in.get(sym);
+            event.type                = kind == EventKind::KeyDown ? SDL_KEYDOWN : SDL_KEYUP;
+            event.key.keysym.sym      = sym;
+            event.key.keysym.scancode = SDL_GetScancodeFromKey(sym);  // This layout's, not the recording's
+            break;
+         }
+
+         case EventKind::MouseDown:
+         case EventKind::MouseUp:
+            ok         = in.get(event.button.button);
+            event.type = kind == EventKind::MouseDown ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+            break;
+
+         case EventKind::MouseMotion: {
+            int32 x, y;
+            ok             = in.get(x) && in.get(y);
+            event.type     = SDL_MOUSEMOTION;
+            event.motion.x = x;
+            event.motion.y = y;
+            break;
+         }
+
+         case EventKind::Resize: {
+            int32 width, height;
+            ok                    = in.get(width) && in.get(height);
+            event.type            = SDL_WINDOWEVENT;
+            event.window.event    = SDL_WINDOWEVENT_SIZE_CHANGED;
+            event.window.windowID = windowID;
+            event.window.data1    = width;
+            event.window.data2    = height;
+            break;
+         }
+
+         default:
+            ok = false;
+            break;
+      }
+      if (ok)
+         events.push_back(event);
+   }
+
+   axes.resize(header.axes);
+   for (auto& axis : axes)
+      ok = ok && in.get(axis.id) && in.get(axis.value);
+
+   if (!ok) {
+      Logger::Error("Input recording is cut short or corrupt at frame ", thisFrame, ". Stopping there.");
+      events.clear();
+      axes.clear();
+      pos = file.size();
+      return;
+   }
+   pos = in.pos;
+}
@@ -0,0 +1,90 @@
+#pragma once
+/*
+ * Input recordings: the events Input used each frame and the axis values they came to, so a play session can be fed
+ * back in exactly (say, as a benchmark that runs on every commit). Frames where nothing happened aren't written.
+ *
+ * The file is a header (magic, version, window size, every nonzero axis at the start), then for each frame that had
+ * anything in it, and the last one so a replay lasts exactly as long:
+ *    u32 frame (counting from the start of the recording), u16 event count, u16 axis count,
+ *    the events, then u16 axis + f32 value for every axis that changed that frame.
+ * Events are cut down to what Input reads. Keys are kept as keycodes and looked up again on replay, so a recording
+ * replays the same whatever keyboard layout it's played back on. All little-endian.
+ *
+ * Needs nothing from the window, so replays work just as well under SDL's dummy video driver.
+ */
+
+#include <SDL2/SDL.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "FileIO.hpp"
+#include "Types.hpp"
+
+struct RecordedAxis {
+   uint16 id;
+   float  value;
+};
+
+class InputRecorder {
+  public:
+   static constexpr char   Magic[8] = {'G', 'L', 'E', 'N', 'I', 'N', 'P', 'T'};
+   static constexpr uint32 Version  = 1;
+
+   /// Check isOpen(); failures are logged. initial is whatever axes aren't 0 as recording starts.
+   InputRecorder(const std::string& path, glm::ivec2 windowDims, const std::vector<RecordedAxis>& initial);
+   /// Calls close().
+   ~InputRecorder();
+
+   bool isOpen() const { return file.is_open() && !failed; }
+   /// Marks the last frame, even if nothing happened in it, and closes the file. False if any write failed, in which
+   /// case the recording's cut short (that's logged as it happens, too).
+   bool close();
+
+   /// Anything Input doesn't look at (and key repeats) is skipped.
+   void addEvent(const SDL_Event& event);
+   /// Writes out the frame, if there was anything in it, and moves on to the next.
+   void endFrame(const std::vector<RecordedAxis>& changed);
+
+   uint32 frameCount() const { return frame; }
+
+  private:
+   /// Writes and flushes, so a crash still leaves everything up to the last frame on disk.
+   void write(const std::vector<ubyte>& out);
+
+   std::string        path;
+   std::ofstream      file;
+   bool               failed = false;
+   std::vector<ubyte> events;  // This frame's, encoded
+   uint16             eventCount = 0;
+   uint32             frame      = 0;
+   bool               wroteLast  = false;  // Whether frame - 1 got written
+};
+
+class InputReplay {
+  public:
+   /// Check isOpen(); failures are logged.
+   explicit InputReplay(const std::string& path);
+
+   bool isOpen() const { return valid; }
+   /// Every recorded frame has been handed out.
+   bool done() const { return pos == file.size(); }
+
+   glm::ivec2                       windowDims() const { return dims; }
+   const std::vector<RecordedAxis>& initialAxes() const { return initial; }
+
+   /// The next frame's events, and the axis values they should come to. Both are empty if nothing was recorded for it.
+   /// Window events are addressed to windowID.
+   void nextFrame(std::vector<SDL_Event>& events, std::vector<RecordedAxis>& axes, uint32 windowID);
+
+  private:
+   MappedFile                file;
+   bool                      valid = false;
+   size_t                    pos   = 0;
+   uint32                    frame = 0;
+   glm::ivec2                dims;
+   std::vector<RecordedAxis> initial;
+};
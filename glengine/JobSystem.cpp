@@ -0,0 +1,284 @@
+#include "JobSystem.hpp"
+
+#include <string>
+
+#include "Profiler.hpp"
+
+struct JobTask {
+   JobSystem::Job job;
+   JobCounter*    counter;
+};
+
+namespace {
+// Which system and worker the current thread is
+thread_local const JobSystem* CurrentSystem = nullptr;
+thread_local size_t           CurrentIndex  = 0;
+
+/// Rounds of looking for work before a worker goes to sleep.
+constexpr int SpinsBeforeSleep = 64;
+}  // namespace
+
+bool JobSystem::WorkDeque::push(Task* task) {
+   int64 b = bottom.load(std::memory_order_relaxed);
+   int64 t = top.load(std::memory_order_acquire);
+   if (b - t >= Capacity)
+      return false;
+
+   slots[b & (Capacity - 1)].store(task, std::memory_order_relaxed);
+   bottom.store(b + 1, std::memory_order_release);
+   return true;
+}
+
+JobTask* JobSystem::WorkDeque::pop() {
+   // Claim the bottom slot first, then see if a thief got there too
+   int64 b = bottom.load(std::memory_order_relaxed) - 1;
+   bottom.store(b, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   int64 t = top.load(std::memory_order_relaxed);
+
+   if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+   }
+
+   Task* task = slots[b & (Capacity - 1)].load(std::memory_order_relaxed);
+   if (t == b) {
+      // The last one, so race the thieves for it
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+         task = nullptr;
+      bottom.store(b + 1, std::memory_order_relaxed);
+   }
+   return task;
+}
+
+JobTask* JobSystem::WorkDeque::steal() {
+   int64 t = top.load(std::memory_order_acquire);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   int64 b = bottom.load(std::memory_order_acquire);
+   if (t >= b)
+      return nullptr;
+
+   Task* task = slots[t & (Capacity - 1)].load(std::memory_order_relaxed);
+   if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      return nullptr;  // Lost to the owner or another thief
+   return task;
+}
+
+JobSystem::JobSystem(size_t threadCount) : previous{CurrentSystem}, previousIndex{CurrentIndex} {
+   threadCount = std::max<size_t>(threadCount, 1);
+   for (size_t i = 0; i < threadCount; i++)
+      deques.push_back(std::make_unique<WorkDeque>());
+
+   CurrentSystem = this;
+   CurrentIndex  = 0;
+   for (size_t i = 1; i < threadCount; i++)
+      threads.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem() {
+   // Help until everything's done, pinned jobs and those waiting on dependencies included
+   size_t self = workerIndex();
+   while (outstanding.load(std::memory_order_acquire) > 0) {
+      if (Task* task = findTask(self))
+         execute(task);
+      else if (self != 0 || !runOnePinned())
+         std::this_thread::yield();
+   }
+
+   {
+      std::lock_guard<std::mutex> guard(sleepLock);
+      quitting = true;
+   }
+   wake.notify_all();
+   for (auto& thread : threads)
+      thread.join();
+
+   CurrentSystem = previous;
+   CurrentIndex  = previousIndex;
+}
+
+JobSystem& JobSystem::Main() {
+   static JobSystem main;
+   return main;
+}
+
+size_t JobSystem::workerIndex() const { return CurrentSystem == this ? CurrentIndex : NotAWorker; }
+
+void JobSystem::run(Job job, JobCounter* counter, JobCounter* after) {
+   if (counter)
+      counter->pending.fetch_add(1, std::memory_order_relaxed);
+   outstanding.fetch_add(1, std::memory_order_relaxed);
+   auto task = new Task{std::move(job), counter};
+
+   if (after) {
+      // Jobs finish under this lock, so it either sees after's last job done or queues us before it's checked
+      std::lock_guard<std::mutex> guard(after->lock);
+      if (!after->done()) {
+         after->dependents.push_back(task);
+         return;
+      }
+   }
+   schedule(task);
+}
+
+void JobSystem::runPinned(Job job, JobCounter* counter) {
+   if (counter)
+      counter->pending.fetch_add(1, std::memory_order_relaxed);
+   outstanding.fetch_add(1, std::memory_order_relaxed);
+
+   std::lock_guard<std::mutex> guard(pinnedLock);
+   pinned.push_back(new Task{std::move(job), counter});
+}
+
+void JobSystem::schedule(Task* task) {
+   // Counted before it's visible, so a thief can't take it and send the count negative
+   queued.fetch_add(1, std::memory_order_seq_cst);
+
+   size_t self = workerIndex();
+   if (self == NotAWorker || !deques[self]->push(task)) {
+      std::lock_guard<std::mutex> guard(injectLock);
+      injected.push_back(task);
+      injectedCount.fetch_add(1, std::memory_order_release);
+   }
+
+   // Sleepers check queued under sleepLock before waiting, so taking it here means they either see this job or get
+   // the notify.
+   if (sleeping.load(std::memory_order_seq_cst)) {
+      { std::lock_guard<std::mutex> guard(sleepLock); }
+      wake.notify_one();
+   }
+}
+
+JobTask* JobSystem::findTask(size_t self) {
+   Task* task = self == NotAWorker ? nullptr : deques[self]->pop();
+
+   if (!task && injectedCount.load(std::memory_order_acquire) > 0) {
+      std::lock_guard<std::mutex> guard(injectLock);
+      if (!injected.empty()) {
+         task = injected.front();
+         injected.pop_front();
+         injectedCount.fetch_sub(1, std::memory_order_relaxed);
+      }
+   }
+
+   // Start stealing at a different victim each time, so thieves don't all pile onto worker 0
+   static thread_local uint32 seed = uint32(std::hash<std::thread::id>()(std::this_thread::get_id()));
+   size_t count = deques.size();
+   seed         = seed * 1664525u + 1013904223u;
+   for (size_t i = 0, start = seed >> 8; !task && i < count; i++) {
+      size_t victim = (start + i) % count;
+      if (victim != self)
+         task = deques[victim]->steal();
+   }
+
+   if (task)
+      queued.fetch_sub(1, std::memory_order_relaxed);
+   return task;
+}
+
+void JobSystem::execute(Task* task) {
+   task->job();
+   finish(task->counter);
+   delete task;
+   outstanding.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::finish(JobCounter* counter) {
+   if (!counter)
+      return;
+
+   std::vector<Task*> ready;
+   {
+      std::lock_guard<std::mutex> guard(counter->lock);
+      if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+         ready.swap(counter->dependents);
+   }
+   for (Task* task : ready)
+      schedule(task);
+}
+
+bool JobSystem::runOnePinned() {
+   Task* task;
+   {
+      std::lock_guard<std::mutex> guard(pinnedLock);
+      if (pinned.empty())
+         return false;
+      task = pinned.front();
+      pinned.pop_front();
+   }
+   execute(task);
+   return true;
+}
+
+size_t JobSystem::runPinnedJobs() {
+   size_t ran = 0;
+   while (runOnePinned())
+      ran++;
+   return ran;
+}
+
+void JobSystem::wait(JobCounter& counter) {
+   PROFILE_FUNCTION();
+   size_t self = workerIndex();
+   while (!counter.done()) {
+      if (self == 0 && runOnePinned())
+         continue;
+      if (self != NotAWorker)
+         if (Task* task = findTask(self)) {
+            execute(task);
+            continue;
+         }
+      std::this_thread::yield();
+   }
+
+   // The last job drops pending under the lock, so once we've had it, nothing's touching counter any more
+   std::lock_guard<std::mutex> guard(counter.lock);
+}
+
+void JobSystem::parallelFor(size_t begin, size_t end, const RangeFunc& body, size_t grain) {
+   if (begin >= end)
+      return;
+   if (!grain)
+      grain = std::max<size_t>(1, (end - begin) / (workerCount() * 8));
+
+   // Split off the top half as a job until what's left is grain sized, so idle workers steal big pieces and split
+   // those further themselves
+   JobCounter                          counter;
+   std::function<void(size_t, size_t)> split = [&](size_t first, size_t last) {
+      while (last - first > grain) {
+         size_t mid = first + (last - first) / 2;
+         run([&split, mid, last] { split(mid, last); }, &counter);
+         last = mid;
+      }
+      body(first, last);
+   };
+
+   split(begin, end);
+   wait(counter);
+}
+
+void JobSystem::workerLoop(size_t index) {
+   CurrentSystem = this;
+   CurrentIndex  = index;
+   Profiler::SetThreadName("Worker " + std::to_string(index));
+
+   for (;;) {
+      Task* task = nullptr;
+      for (int spin = 0; !task && spin < SpinsBeforeSleep; spin++) {
+         task = findTask(index);
+         if (!task)
+            std::this_thread::yield();
+      }
+      if (task) {
+         execute(task);
+         continue;
+      }
+
+      std::unique_lock<std::mutex> guard(sleepLock);
+      sleeping.fetch_add(1, std::memory_order_seq_cst);
+      wake.wait(guard, [&] { return quitting || queued.load(std::memory_order_seq_cst) > 0; });
+      sleeping.fetch_sub(1, std::memory_order_relaxed);
+      if (quitting)
+         return;
+   }
+}
@@ -0,0 +1,135 @@
+#pragma once
+/*
+ * Work-stealing job system.
+ *
+ * Every worker has its own deque (Chase-Lev): it pushes and pops its own jobs at the bottom, and once it runs dry it
+ * steals from the top of someone else's, so the common case touches no shared state at all. Jobs run() from threads
+ * that aren't workers go through a small locked queue instead.
+ *
+ * The thread that creates a JobSystem is worker 0. It doesn't sit in a loop waiting for work like the others, but
+ * whenever it waits (wait(), parallelFor()) it runs jobs instead of blocking. Other workers do the same when a job
+ * waits, so waiting inside a job is fine and never deadlocks.
+ *
+ * Jobs report to a JobCounter, which can be waited on or passed to run() as a dependency: the job's only queued once
+ * that counter hits zero. Jobs started with runPinned() only ever run on worker 0, which should be the thread that
+ * owns the window (SDL wants most of its calls from there), either from runPinnedJobs() or while it's waiting.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Types.hpp"
+
+class JobSystem;
+struct JobTask;  // A queued job; internal to JobSystem
+
+/// How many jobs are still outstanding. Has to outlive every job reporting to it, and everything waiting on it.
+class JobCounter {
+  public:
+   JobCounter() = default;
+   JobCounter(const JobCounter&) = delete;
+   JobCounter& operator=(const JobCounter&) = delete;
+
+   bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+  private:
+   friend class JobSystem;
+
+   std::atomic<uint32>   pending{0};
+   std::mutex            lock;        // Taken to finish a job, so a waiter knows when the counter's no longer in use
+   std::vector<JobTask*> dependents;  // Jobs that get queued once pending hits zero
+};
+
+class JobSystem {
+  public:
+   using Job       = std::function<void()>;
+   using RangeFunc = std::function<void(size_t begin, size_t end)>;
+
+   static constexpr size_t NotAWorker = ~size_t(0);
+
+   /// threadCount includes the calling thread, so 1 means every job runs on it while it waits.
+   explicit JobSystem(size_t threadCount = std::max(1u, std::thread::hardware_concurrency()));
+   /// Finishes everything still queued first.
+   ~JobSystem();
+
+   JobSystem(const JobSystem&) = delete;
+   JobSystem& operator=(const JobSystem&) = delete;
+
+   /// The engine's, created on first use. Call this first from the thread that owns the window, since that's where
+   /// its pinned jobs run.
+   static JobSystem& Main();
+
+   /// counter (if any) is bumped now and dropped once the job's done. If after isn't done, the job waits for it.
+   void run(Job job, JobCounter* counter = nullptr, JobCounter* after = nullptr);
+   /// Only runs on worker 0.
+   void runPinned(Job job, JobCounter* counter = nullptr);
+
+   /// Runs other jobs until counter is done. Workers outside this system just yield until it is.
+   void wait(JobCounter& counter);
+
+   /// Calls body over [begin, end) in pieces of at least grain, in parallel, and waits for them. With grain 0 the
+   /// range is cut into about 8 pieces per worker, which keeps everyone busy without being dominated by overhead.
+   void parallelFor(size_t begin, size_t end, const RangeFunc& body, size_t grain = 0);
+
+   /// Runs every pinned job that's queued. Worker 0 only; call it once a frame. Returns how many ran.
+   size_t runPinnedJobs();
+
+   size_t workerCount() const { return deques.size(); }
+   /// The calling thread's worker index in [0, workerCount()), or NotAWorker. Handy for per-worker scratch space.
+   size_t workerIndex() const;
+
+  private:
+   using Task = JobTask;
+
+   /// Chase-Lev deque over a fixed ring. The owner pushes and pops the bottom; anyone can steal off the top.
+   class WorkDeque {
+     public:
+      static constexpr int64 Capacity = 4096;
+
+      bool  push(Task* task);  // Owner only. False if full.
+      Task* pop();             // Owner only
+      Task* steal();
+
+     private:
+      alignas(64) std::atomic<int64> top{0};
+      alignas(64) std::atomic<int64> bottom{0};
+      std::atomic<Task*> slots[Capacity];
+   };
+
+   void workerLoop(size_t index);
+
+   /// Pushes onto the calling worker's deque, or the injection queue if it hasn't got one, and wakes someone.
+   void  schedule(Task* task);
+   Task* findTask(size_t self);
+   void  execute(Task* task);
+   /// Drops counter, queueing its dependents if that was the last job.
+   void  finish(JobCounter* counter);
+   bool  runOnePinned();
+
+   std::vector<std::unique_ptr<WorkDeque>> deques;          // One per worker, including worker 0
+   std::atomic<int64>                      queued{0};       // Tasks sitting in deques or the injection queue
+   std::atomic<int64>                      outstanding{0};  // Tasks that haven't finished, wherever they are
+
+   std::mutex          injectLock;
+   std::deque<Task*>   injected;
+   std::atomic<size_t> injectedCount{0};  // So workers don't take injectLock just to find it empty
+   std::mutex          pinnedLock;
+   std::deque<Task*>   pinned;
+
+   std::mutex              sleepLock;
+   std::condition_variable wake;
+   std::atomic<uint32>     sleeping{0};
+   bool                    quitting = false;
+
+   const JobSystem* previous;  // Whatever the creating thread was worker 0 of before, restored when this goes
+   size_t           previousIndex;
+
+   std::vector<std::thread> threads;
+};
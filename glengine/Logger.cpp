@@ -1,3 +1,114 @@
 #include "Logger.hpp"
 
+#include <chrono>
+
 std::unique_ptr<Logger> Logger::instance = std::make_unique<Logger>();
+
+void Logger::SetAsync(bool enabled, size_t capacity, Overflow policy) {
+   instance->stopWriter();
+   if (!enabled)
+      return;
+
+   std::lock_guard<std::mutex> lock(instance->stateLock);
+   instance->states.push_back(std::make_unique<AsyncState>(instance.get(), capacity, policy));
+   instance->async.store(instance->states.back().get(), std::memory_order_release);
+}
+
+void Logger::Flush() {
+   auto* async = instance->async.load(std::memory_order_acquire);
+   if (!async)
+      return;  // Sync mode already flushes on every Write
+
+   size_t target = async->tail.load(std::memory_order_acquire);
+   while (async->written.load(std::memory_order_acquire) < target)
+      std::this_thread::yield();
+}
+
+void Logger::writeOut(const std::string& batch) {
+   std::lock_guard<std::mutex> lock(outputLock);
+
+   if (logFile.is_open())
+      logFile << batch << std::flush;
+
+   std::cout << batch << std::flush;
+}
+
+void Logger::stopWriter() {
+   std::lock_guard<std::mutex> lock(stateLock);
+   AsyncState*                 state = async.exchange(nullptr, std::memory_order_acq_rel);
+   if (!state)
+      return;
+
+   // New Write()s go straight out from here on. Wait out the ones already pushing so the writer drains them too.
+   state->accepting.store(false, std::memory_order_seq_cst);
+   while (state->pushing.load(std::memory_order_seq_cst))
+      std::this_thread::yield();
+
+   state->running.store(false, std::memory_order_release);
+   if (state->writer.joinable())
+      state->writer.join();
+   // Not freed; see states
+}
+
+Logger::AsyncState::AsyncState(Logger* owner, size_t capacity, Overflow policy) : owner{owner}, policy{policy} {
+   size_t size = 2;
+   while (size < capacity)
+      size <<= 1;
+
+   slots = std::make_unique<Slot[]>(size);
+   mask  = size - 1;
+   for (size_t i = 0; i < size; i++)
+      slots[i].seq.store(i, std::memory_order_relaxed);
+
+   writer = std::thread(&AsyncState::run, this);
+}
+
+size_t Logger::AsyncState::drainInto(std::string& out) {
+   size_t count = 0;
+   for (;;) {
+      Slot& first = slots[head & mask];
+      if (first.seq.load(std::memory_order_acquire) != head + 1)
+         break;  // Empty, or the producer that claimed this slot hasn't finished filling it yet
+
+      // The first part is published last, so the rest of the message is already there
+      size_t      parts = first.rec.parts;
+      std::string body;
+      for (size_t i = 0; i < parts; i++)
+         body.append(slots[(head + i) & mask].rec.text, slots[(head + i) & mask].rec.len);
+      trim(body);
+      out += makeHeader(first.rec.type, first.rec.ticks);
+      out += body;
+      out += '\n';
+
+      for (size_t i = 0; i < parts; i++)
+         slots[(head + i) & mask].seq.store(head + i + mask + 1, std::memory_order_release);
+      head += parts;
+      count++;
+   }
+
+   return count;
+}
+
+void Logger::AsyncState::run() {
+   std::string batch;
+
+   // Keep going until we've been told to stop AND there's nothing left, so shutdown always drains.
+   for (;;) {
+      bool stopping = !running.load(std::memory_order_acquire);
+
+      batch.clear();
+      size_t count = drainInto(batch);
+
+      if (auto lost = skipped.exchange(0, std::memory_order_relaxed))
+         batch += buildStr(makeHeader("LOGGER"), "Ring full, skipped ", lost, " messages") + '\n';
+
+      if (!batch.empty())
+         owner->writeOut(batch);
+      written.store(head, std::memory_order_release);
+
+      if (stopping && head == tail.load(std::memory_order_acquire))
+         break;
+      if (count == 0)
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+}
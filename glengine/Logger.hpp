@@ -1,27 +1,43 @@
 #pragma once
+#include <atomic>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <SDL2/SDL.h>
 
 // The only kind of singleton allowed in any sane code
 class Logger {
   public:
-   ~Logger() { logFile.close(); }
+   /// What an async Write() does when the ring is full
+   enum class Overflow {
+      Drop,          ///< Throw the message away. Nobody will ever know.
+      Block,         ///< Spin until the writer thread frees a slot
+      CountAndSkip,  ///< Throw the message away, but log how many we lost once there's room again
+   };
+
+   ~Logger() {
+      stopWriter();
+      logFile.close();
+   }
 
 
    /// Generalized writing function. Prints in [TYPE]@<time in secs>: <ARGS...>
    template <typename... Args>
    static void Write(const std::string& type, const Args&... args) {
-      std::string message = buildStr(makeHeader(type), args...);
-
-      if (instance->logFile.is_open())
-         instance->logFile << message << std::endl << std::flush;
+      // A state is never freed before exit, so one that's being stopped is still safe to look at. push() just says no.
+      if (auto* async = instance->async.load(std::memory_order_acquire))
+         if (async->push(type, args...))
+            return;
 
-      std::cout << message << std::endl << std::flush;
+      instance->writeOut(buildStr(makeHeader(type), args...) + '\n');
    }
 
    // Shorthand write functions
@@ -42,6 +58,8 @@ class Logger {
    template <typename... Args>
    static void ErrorOut(const Args&... args) {
       Error(args...);
+      // Whatever killed us is probably sitting in the ring. Make sure it actually gets out.
+      instance->stopWriter();
       exit(-1);
    }
 
@@ -53,28 +71,160 @@ class Logger {
 
    /// Changes what file we write to when we log things.
    static void SetLogFile(const std::string& fileName) {
+      std::lock_guard<std::mutex> lock(instance->outputLock);
       if (instance->logFile.is_open())
          instance->logFile.close();
 
       instance->logFile.open(fileName);
    }
 
+   /// Moves all output onto a background thread. Write() then only formats the message body straight into a slot of
+   /// a bounded lock-free ring; the header, newline trimming and the actual I/O happen on the writer thread.
+   /// capacity is rounded up to a power of 2. Disabling drains whatever is still queued first.
+   /// Don't flip this while other threads are logging.
+   static void SetAsync(bool enabled, size_t capacity = 4096, Overflow policy = Overflow::CountAndSkip);
+
+   /// Blocks until everything Write()n before this call has hit the terminal and log file.
+   static void Flush();
+
   private:
+   /// One slot's worth of a queued message. Longer bodies spill over into the slots after it, up to MaxParts of them,
+   /// and only get truncated past that.
+   struct Record {
+      static constexpr size_t TextSize = 224;
+      static constexpr size_t TypeSize = 16;
+      static constexpr size_t MaxParts = 16;
+
+      uint32_t ticks;
+      uint16_t len;
+      uint8_t  parts;  // How many records the message takes, this one included. Only set on the first.
+      char     type[TypeSize];
+      char     text[TextSize];
+   };
+
+   /// Lets an ostream write into a fixed char array instead of allocating. Overflowing just truncates.
+   struct FixedBuf : std::streambuf {
+      void reset(char* begin, size_t size) { setp(begin, begin + size); }
+      size_t written() const { return pptr() - pbase(); }
+   };
+
+   /// Bounded MPSC ring (Vyukov-style, each slot carries its own sequence number) plus the thread draining it.
+   struct AsyncState {
+      struct alignas(64) Slot {
+         std::atomic<size_t> seq;
+         Record              rec;
+      };
+
+      AsyncState(Logger* owner, size_t capacity, Overflow policy);
+
+      /// False once the state's being stopped, in which case the caller writes it out itself.
+      template <typename... Args>
+      bool push(const std::string& type, const Args&... args) {
+         // stop() waits for pushing to drop to 0 after clearing accepting, so either we see it cleared or everything we
+         // queue gets drained
+         pushing.fetch_add(1, std::memory_order_seq_cst);
+         if (!accepting.load(std::memory_order_seq_cst)) {
+            pushing.fetch_sub(1, std::memory_order_release);
+            return false;
+         }
+         tryPush(type, args...);
+         pushing.fetch_sub(1, std::memory_order_release);
+         return true;
+      }
+
+      template <typename... Args>
+      void tryPush(const std::string& type, const Args&... args) {
+         // Formatted up front, since how long it is decides how many slots to claim. Reused per thread so we don't
+         // pay for a locale/stream construction on every call.
+         static thread_local char         text[Record::TextSize * Record::MaxParts];
+         static thread_local FixedBuf     buf;
+         static thread_local std::ostream stream(&buf);
+         buf.reset(text, std::min(sizeof(text), (mask + 1) * Record::TextSize));
+         stream.clear();
+         addTo(stream, args...);
+         size_t len   = buf.written();
+         size_t parts = std::max<size_t>(1, (len + Record::TextSize - 1) / Record::TextSize);
+
+         // All the parts' slots have to be free for this lap before we can claim them in one go
+         size_t pos = tail.load(std::memory_order_relaxed);
+         for (;;) {
+            intptr_t diff = 0;
+            for (size_t i = 0; i < parts && diff == 0; i++)
+               diff = static_cast<intptr_t>(slots[(pos + i) & mask].seq.load(std::memory_order_acquire)) -
+                      static_cast<intptr_t>(pos + i);
+
+            if (diff == 0) {
+               if (tail.compare_exchange_weak(pos, pos + parts, std::memory_order_relaxed))
+                  break;
+            } else if (diff < 0) {
+               // Full
+               if (policy == Overflow::Block) {
+                  std::this_thread::yield();
+                  pos = tail.load(std::memory_order_relaxed);
+                  continue;
+               }
+               if (policy == Overflow::CountAndSkip)
+                  skipped.fetch_add(1, std::memory_order_relaxed);
+               return;
+            } else
+               pos = tail.load(std::memory_order_relaxed);
+         }
+
+         // The first part goes last, so once the writer sees it the rest are there too
+         for (size_t i = parts; i-- > 0;) {
+            Slot&   slot = slots[(pos + i) & mask];
+            Record& rec  = slot.rec;
+            rec.len      = static_cast<uint16_t>(std::min(Record::TextSize, len - std::min(len, i * Record::TextSize)));
+            std::memcpy(rec.text, text + i * Record::TextSize, rec.len);
+            if (i == 0) {
+               rec.ticks = SDL_GetTicks();
+               rec.parts = static_cast<uint8_t>(parts);
+               std::strncpy(rec.type, type.c_str(), Record::TypeSize - 1);
+               rec.type[Record::TypeSize - 1] = '\0';
+            }
+            slot.seq.store(pos + i + 1, std::memory_order_release);
+         }
+      }
+
+      /// Pops everything currently readable into out. Returns how many records that was.
+      size_t drainInto(std::string& out);
+
+      void run();
+
+      Logger*                 owner;
+      std::unique_ptr<Slot[]> slots;
+      size_t                  mask;
+      Overflow                policy;
+
+      alignas(64) std::atomic<size_t> tail{0};
+      alignas(64) size_t  head = 0;  // Only the writer thread touches this
+      std::atomic<size_t> written{0};  // Mirrors head for Flush()
+      std::atomic<size_t> skipped{0};
+      std::atomic<bool>   running{true};    // The writer thread keeps going until this is cleared and it's drained
+      std::atomic<bool>   accepting{true};  // push() queues while this is set
+      std::atomic<size_t> pushing{0};       // Threads between checking accepting and finishing their push
+
+      std::thread writer;
+   };
+
    static std::unique_ptr<Logger> instance;
    std::ofstream                  logFile;
+   std::mutex                     outputLock;  // Held by whoever is currently writing to cout/logFile
+   std::atomic<AsyncState*>       async{nullptr};
+   // Every state there's ever been. Some other thread's Write() may still be looking at a stopped one, so none of them
+   // go before the Logger does.
+   std::vector<std::unique_ptr<AsyncState>> states;
+   std::mutex                               stateLock;  // Held while starting/stopping the writer
+
+   void writeOut(const std::string& batch);
+   void stopWriter();
 
    // Helper funcs
 
-   /// Inputs a list of variadic args into a stringstream
-   template <typename T, typename... Args>
-   static void addTo(std::stringstream& stream, const T& arg, const Args&... args) {
-      stream << arg;
-      addTo(stream, args...);
-   }
-   // Base case
-   template <typename T>
-   static void addTo(std::stringstream& stream, const T& arg) {
-      stream << arg;
+   /// Inputs a list of variadic args into a stream
+   template <typename... Args>
+   static void addTo(std::ostream& stream, const Args&... args) {
+      (stream << ... << args);
    }
 
    /// Turns any newlines into spaces
@@ -95,7 +245,7 @@ class Logger {
    }
 
    /// Make something like [VULKAN]@0.1231s
-   static std::string makeHeader(const std::string& header) {
-      return buildStr("[", header, "]@", SDL_GetTicks() / 1000.0, "s: ");
+   static std::string makeHeader(const std::string& header, uint32_t ticks = SDL_GetTicks()) {
+      return buildStr("[", header, "]@", ticks / 1000.0, "s: ");
    }
 };
@@ -0,0 +1,214 @@
+#include "PalettedChunk.hpp"
+
+#include <algorithm>
+#include <utility>
+
+PalettedChunk::PalettedChunk(BlockId fill) : palette{fill}, counts{uint32(ChunkVolume)} {}
+
+PalettedChunk PalettedChunk::FromDense(const Chunk& dense) {
+   PalettedChunk chunk(dense.blocks[0]);
+   chunk.counts[0] = 0;
+
+   // Build the palette first so the indices only get packed once, at the right width
+   std::vector<uint16> indices(ChunkVolume);
+   for (size_t i = 0; i < ChunkVolume; i++) {
+      uint32 entry = chunk.findOrAdd(dense.blocks[i]);
+      indices[i]   = entry;
+      chunk.counts[entry]++;
+   }
+
+   if (chunk.palette.size() == 1)
+      return chunk;
+
+   chunk.bits = BitsFor(chunk.palette.size());
+   chunk.data.assign(WordsFor(chunk.bits), 0);
+   for (size_t i = 0; i < ChunkVolume; i++)
+      chunk.writeIndex(i, indices[i]);
+
+   return chunk;
+}
+
+void PalettedChunk::toDense(Chunk& dense) const {
+   for (int32 z = 0; z < ChunkSize; z++)
+      for (int32 y = 0; y < ChunkSize; y++)
+         decodeRow(y, z, &dense.blocks[Chunk::Index(0, y, z)]);
+}
+
+void PalettedChunk::set(size_t index, BlockId block) {
+   if (bits == 0) {
+      if (palette[0] == block)
+         return;
+      bits = 1;
+      data.assign(WordsFor(bits), 0);
+   }
+
+   uint32 old = readIndex(index);
+   if (palette[old] == block)
+      return;
+   if (--counts[old] == 0)
+      freeEntries.push_back(old);
+
+   uint32 entry = findOrAdd(block);
+   if (palette.size() > (size_t(1) << bits))
+      repack(bits + 1);
+   writeIndex(index, entry);
+
+   if (++counts[entry] == ChunkVolume)
+      collapse(block);
+}
+
+namespace {
+/// decodeRow with the width known at compile time, so the loop unrolls into constant shifts and masks.
+template <uint32 Bits>
+void DecodeRow(const ubyte* bytes, size_t bit, const BlockId* palette, BlockId* out) {
+   constexpr uint32 Mask = (1u << Bits) - 1;
+   for (int32 x = 0; x < ChunkSize; x++, bit += Bits) {
+      uint64 value;
+      std::memcpy(&value, bytes + bit / 8, sizeof(value));
+      out[x] = palette[uint32(value >> (bit % 8)) & Mask];
+   }
+}
+
+template <uint32... Bits>
+void DecodeRow(uint8 bits, const ubyte* bytes, size_t bit, const BlockId* palette, BlockId* out,
+               std::integer_sequence<uint32, Bits...>) {
+   ((bits == Bits + 1 && (DecodeRow<Bits + 1>(bytes, bit, palette, out), true)) || ...);
+}
+}  // namespace
+
+void PalettedChunk::decodeRow(int32 y, int32 z, BlockId* out) const {
+   if (bits == 0) {
+      std::fill(out, out + ChunkSize, palette[0]);
+      return;
+   }
+
+   DecodeRow(bits, reinterpret_cast<const ubyte*>(data.data()), Chunk::Index(0, y, z) * bits, palette.data(), out,
+             std::make_integer_sequence<uint32, 16>());
+}
+
+void PalettedChunk::compact() {
+   if (bits == 0)
+      return;
+
+   std::vector<uint32>  remap(palette.size());
+   std::vector<BlockId> used;
+   std::vector<uint32>  usedCounts;
+   for (size_t i = 0; i < palette.size(); i++) {
+      if (counts[i] == 0)
+         continue;
+      remap[i] = used.size();
+      used.push_back(palette[i]);
+      usedCounts.push_back(counts[i]);
+   }
+
+   if (used.size() == 1) {
+      collapse(used[0]);
+      return;
+   }
+
+   uint8               newBits = BitsFor(used.size());
+   std::vector<uint64> packed(WordsFor(newBits), 0);
+   for (size_t i = 0; i < ChunkVolume; i++)
+      WritePacked(packed.data(), newBits, i, remap[readIndex(i)]);
+   bits = newBits;
+   data = std::move(packed);
+
+   palette = std::move(used);
+   counts  = std::move(usedCounts);
+   palette.shrink_to_fit();
+   counts.shrink_to_fit();
+   freeEntries.clear();
+   freeEntries.shrink_to_fit();
+
+   lookup.clear();
+   if (palette.size() > LinearSearchMax)
+      for (size_t i = 0; i < palette.size(); i++)
+         lookup[palette[i]] = i;
+}
+
+size_t PalettedChunk::memoryUsage() const {
+   size_t bytes = sizeof(*this) + data.capacity() * sizeof(uint64) + palette.capacity() * sizeof(BlockId) +
+                  counts.capacity() * sizeof(uint32) + freeEntries.capacity() * sizeof(uint32);
+   // A node per entry (pair, next pointer, cached hash) plus the bucket array
+   bytes += lookup.size() * (sizeof(std::pair<BlockId, uint32>) + 2 * sizeof(void*)) +
+            lookup.bucket_count() * sizeof(void*);
+   return bytes;
+}
+
+uint8 PalettedChunk::BitsFor(size_t paletteSize) {
+   uint8 bits = 1;
+   while ((size_t(1) << bits) < paletteSize)
+      bits++;
+   return bits;
+}
+
+void PalettedChunk::WritePacked(uint64* data, uint8 bits, size_t index, uint32 value) {
+   const uint64 mask  = (uint64(1) << bits) - 1;
+   size_t       bit   = index * bits;
+   size_t       word  = bit / 64;
+   uint32       shift = bit % 64;
+
+   data[word] = (data[word] & ~(mask << shift)) | (uint64(value) << shift);
+   if (shift + bits > 64) {
+      uint32 spill   = 64 - shift;
+      data[word + 1] = (data[word + 1] & ~(mask >> spill)) | (uint64(value) >> spill);
+   }
+}
+
+uint32 PalettedChunk::findOrAdd(BlockId block) {
+   // Entries that dropped to 0 keep their block until they're handed out again, so finding one revives it
+   if (!lookup.empty()) {
+      auto found = lookup.find(block);
+      if (found != lookup.end())
+         return found->second;
+   } else {
+      for (size_t i = 0; i < palette.size(); i++)
+         if (palette[i] == block)
+            return i;
+   }
+
+   while (!freeEntries.empty()) {
+      uint32 entry = freeEntries.back();
+      freeEntries.pop_back();
+      if (counts[entry] != 0)
+         continue;
+
+      if (!lookup.empty()) {
+         lookup.erase(palette[entry]);
+         lookup[block] = entry;
+      }
+      palette[entry] = block;
+      return entry;
+   }
+
+   uint32 entry = palette.size();
+   palette.push_back(block);
+   counts.push_back(0);
+
+   if (!lookup.empty())
+      lookup[block] = entry;
+   else if (palette.size() > LinearSearchMax)
+      for (size_t i = 0; i < palette.size(); i++)
+         lookup[palette[i]] = i;
+
+   return entry;
+}
+
+void PalettedChunk::repack(uint8 newBits) {
+   std::vector<uint64> packed(WordsFor(newBits), 0);
+   for (size_t i = 0; i < ChunkVolume; i++)
+      WritePacked(packed.data(), newBits, i, readIndex(i));
+   bits = newBits;
+   data = std::move(packed);
+}
+
+void PalettedChunk::collapse(BlockId block) {
+   bits = 0;
+   data.clear();
+   data.shrink_to_fit();
+   palette = {block};
+   counts  = {uint32(ChunkVolume)};
+   freeEntries.clear();
+   freeEntries.shrink_to_fit();
+   lookup.clear();
+}
@@ -0,0 +1,78 @@
+#pragma once
+/*
+ * Compressed chunk storage: a per-chunk palette of the block ids actually in it, and a bit-packed index into that
+ * palette per block.
+ *
+ * Indices are as wide as the palette needs (1 to 16 bits) and packed back to back, so one can straddle two words.
+ * The width only grows, one bit at a time when a new block doesn't fit, which keeps set() amortised O(1); compact()
+ * is what shrinks it again, so call it once a burst of edits is done (before saving, after worldgen...).
+ *
+ * A chunk that's all one block (the vast majority: air above ground, stone below) has no indices at all, just the
+ * one palette entry. set() collapses back to that whenever the last other block goes.
+ *
+ * Same at()/decodeRow() interface as Chunk, so PaddedChunk::fill() and the mesher take either.
+ */
+
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "Chunk.hpp"
+#include "Types.hpp"
+
+class PalettedChunk {
+  public:
+   explicit PalettedChunk(BlockId fill = 0);
+   static PalettedChunk FromDense(const Chunk& dense);
+   void                 toDense(Chunk& dense) const;
+
+   BlockId get(size_t index) const { return bits == 0 ? palette[0] : palette[readIndex(index)]; }
+   BlockId at(int32 x, int32 y, int32 z) const { return get(Chunk::Index(x, y, z)); }
+
+   void set(size_t index, BlockId block);
+   void set(int32 x, int32 y, int32 z, BlockId block) { set(Chunk::Index(x, y, z), block); }
+
+   /// Copies out the ChunkSize blocks of row (y, z), x-fastest like Chunk.
+   void decodeRow(int32 y, int32 z, BlockId* out) const;
+
+   /// Drops palette entries nothing uses any more and narrows the indices to match.
+   void compact();
+
+   bool   isUniform() const { return bits == 0; }
+   uint8  bitsPerBlock() const { return bits; }
+   size_t paletteSize() const { return palette.size(); }  // Including entries nothing uses until the next compact()
+   /// Heap and all, give or take the allocator's overhead.
+   size_t memoryUsage() const;
+
+  private:
+   /// Past this many entries finding a block in the palette goes through lookup instead of a linear scan.
+   static constexpr size_t LinearSearchMax = 16;
+
+   /// +1 for ReadPacked's 8 byte loads
+   static size_t WordsFor(uint8 bits) { return (ChunkVolume * bits + 63) / 64 + 1; }
+   static uint8  BitsFor(size_t paletteSize);
+
+   /// One unaligned little-endian load from the byte the index starts in. An index is at most 16 bits and starts at
+   /// most 7 bits in, so it's always inside those 8 bytes; no straddle checks needed.
+   static uint32 ReadPacked(const uint64* data, uint8 bits, size_t index) {
+      size_t bit = index * bits;
+      uint64 value;
+      std::memcpy(&value, reinterpret_cast<const ubyte*>(data) + bit / 8, sizeof(value));
+      return uint32(value >> (bit % 8)) & ((1u << bits) - 1);
+   }
+   static void WritePacked(uint64* data, uint8 bits, size_t index, uint32 value);
+
+   uint32 readIndex(size_t index) const { return ReadPacked(data.data(), bits, index); }
+   void   writeIndex(size_t index, uint32 value) { WritePacked(data.data(), bits, index, value); }
+
+   uint32 findOrAdd(BlockId block);
+   void   repack(uint8 newBits);
+   void   collapse(BlockId block);
+
+   uint8                               bits = 0;  // 0 means uniform: palette[0] everywhere and no data
+   std::vector<uint64>                 data;
+   std::vector<BlockId>                palette;
+   std::vector<uint32>                 counts;       // Blocks using each palette entry
+   std::vector<uint32>                 freeEntries;  // Entries whose count hit 0. Reused unless they've been revived.
+   std::unordered_map<BlockId, uint32> lookup;       // Block -> entry, only once the palette's too big to scan
+};
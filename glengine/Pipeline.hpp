@@ -0,0 +1,251 @@
+#pragma once
+/*
+ * Thin builder-style wrappers over vk::RenderPass and a graphics vk::Pipeline.
+ * Set everything through the chained setters, then build() once. Anything not set keeps a sane default.
+ */
+
+#include <memory>
+#include <vector>
+
+#include "VulkanBase.hpp"
+
+#include "Macros.hpp"
+#include "Shader.hpp"
+#include "VertexLayout.hpp"
+
+// Note that the values for each map to Vulkan enums, so will need to be translated for OpenGL
+enum class Topology {
+   Points        = VK_PRIMITIVE_TOPOLOGY_POINT_LIST,
+   Lines         = VK_PRIMITIVE_TOPOLOGY_LINE_LIST,
+   LineStrip     = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP,
+   Triangles     = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+   TriangleStrip = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+   TriangleFan   = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN,
+};
+
+enum class FillMode {
+   Fill  = VK_POLYGON_MODE_FILL,
+   Line  = VK_POLYGON_MODE_LINE,
+   Point = VK_POLYGON_MODE_POINT,
+};
+
+// Which winding counts as the front face
+enum class FrontFaceRule {
+   LeftHand  = VK_FRONT_FACE_CLOCKWISE,
+   RightHand = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+};
+
+using LogicOp = vk::LogicOp;
+
+struct DepthBias {
+   float constant, clamp, slope;
+};
+
+// Owning version of vk::SubpassDescription, so the attachment refs don't have to be kept alive elsewhere.
+struct SubpassDescription {
+   vk::PipelineBindPoint                pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+   std::vector<vk::AttachmentReference> inputAttachments, colorAttachments, resolveAttachments;
+   Optional<vk::AttachmentReference>    depthStencilAttachment;
+   std::vector<uint32>                  preserveAttachments;
+
+   vk::SubpassDescription toVk() const {
+      return vk::SubpassDescription()
+          .setPipelineBindPoint(pipelineBindPoint)
+          .setInputAttachmentCount(inputAttachments.size())
+          .setPInputAttachments(inputAttachments.data())
+          .setColorAttachmentCount(colorAttachments.size())
+          .setPColorAttachments(colorAttachments.data())
+          .setPResolveAttachments(resolveAttachments.empty() ? nullptr : resolveAttachments.data())
+          .setPDepthStencilAttachment(depthStencilAttachment ? &*depthStencilAttachment : nullptr)
+          .setPreserveAttachmentCount(preserveAttachments.size())
+          .setPPreserveAttachments(preserveAttachments.data());
+   }
+};
+
+struct RenderPass : VulkanObject {
+   RenderPass(vk::Device& dev) : VulkanObject(dev) {}
+   ~RenderPass() {
+      if (pass)
+         dev.destroyRenderPass(pass);
+   }
+
+   inline RenderPass& addPass(const SubpassDescription& subpass) {
+      passes.push_back(subpass);
+      return *this;
+   }
+   inline RenderPass& addDep(const vk::SubpassDependency& dep) {
+      deps.push_back(dep);
+      return *this;
+   }
+   inline RenderPass& addAttachment(const vk::AttachmentDescription& attachment) {
+      attachments.push_back(attachment);
+      return *this;
+   }
+
+   void build() {
+      std::vector<vk::SubpassDescription> vkPasses;
+      for (const auto& subpass : passes)
+         vkPasses.push_back(subpass.toVk());
+
+      auto info = vk::RenderPassCreateInfo()
+                      .setAttachmentCount(attachments.size())
+                      .setPAttachments(attachments.data())
+                      .setSubpassCount(vkPasses.size())
+                      .setPSubpasses(vkPasses.data())
+                      .setDependencyCount(deps.size())
+                      .setPDependencies(deps.data());
+
+      pass = dev.createRenderPass(info);
+   }
+
+   std::vector<SubpassDescription>        passes;
+   std::vector<vk::SubpassDependency>     deps;
+   std::vector<vk::AttachmentDescription> attachments;
+   vk::RenderPass                         pass;
+
+   CONVERTABLE_TO_MEMBER(pass)
+};
+
+struct GraphicsPipeline : VulkanObject {
+   GraphicsPipeline(vk::Device& dev) : VulkanObject(dev) {
+      inputAsmState.setTopology(vk::PrimitiveTopology::eTriangleList);
+      rasterState.setLineWidth(1.0f).setCullMode(vk::CullModeFlagBits::eBack);
+      multisampleState.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+   }
+
+   template <typename... Shaders>
+   inline GraphicsPipeline& addStages(const Shaders&... shaders) {
+      (stages.push_back(shaders.toPipelineCreateInfo()), ...);
+      return *this;
+   }
+
+   /// One binding per type, see VertexLayout.hpp. No types means no vertex input at all.
+   template <typename... Bindings>
+   inline GraphicsPipeline& setVertexInput() {
+      vertInputState = VertexInput<Bindings...>::State();
+      return *this;
+   }
+
+   inline GraphicsPipeline& setTopology(Topology topology) {
+      inputAsmState.setTopology(static_cast<vk::PrimitiveTopology>(topology));
+      return *this;
+   }
+
+   /// With eViewport/eScissor in the dynamic states these only count as placeholders; the real ones come from the
+   /// command buffer.
+   inline GraphicsPipeline& addViewport(const vk::Viewport& viewport, const vk::Rect2D& scissor) {
+      viewports.push_back(viewport);
+      scissors.push_back(scissor);
+      return *this;
+   }
+
+   template <typename... States>
+   inline GraphicsPipeline& addDynamicStates(States... states) {
+      (dynamicStates.push_back(states), ...);
+      return *this;
+   }
+
+   CHAINED_SETTER(rasterState.depthClampEnable, EnableDepthClamp, bool)
+   CHAINED_SETTER(rasterState.polygonMode, FillMode, FillMode)
+   CHAINED_SETTER(rasterState.lineWidth, LineWidth, float)
+   CHAINED_SETTER(rasterState.cullMode, CullMode, vk::CullModeFlags)
+   CHAINED_SETTER(rasterState.frontFace, FrontFaceRule, FrontFaceRule)
+
+   inline GraphicsPipeline& withDepthBias(const Optional<DepthBias>& bias) {
+      rasterState.setDepthBiasEnable(bias.has_value());
+      if (bias)
+         rasterState.setDepthBiasConstantFactor(bias->constant)
+             .setDepthBiasClamp(bias->clamp)
+             .setDepthBiasSlopeFactor(bias->slope);
+      return *this;
+   }
+
+   inline GraphicsPipeline& setMSAA(uint32 samples) {
+      multisampleState.setRasterizationSamples(vk::SampleCountFlagBits(samples));
+      return *this;
+   }
+
+   template <typename... Attachments>
+   inline GraphicsPipeline& addColorBlendAttachments(const Attachments&... attachments) {
+      (colorBlendAttachments.push_back(attachments), ...);
+      return *this;
+   }
+
+   inline GraphicsPipeline& setColorBlendOp(const Optional<LogicOp>& op) {
+      colorBlendState.setLogicOpEnable(op.has_value());
+      if (op)
+         colorBlendState.setLogicOp(*op);
+      return *this;
+   }
+
+   void build(vk::PipelineCache cache = nullptr) {
+      layout = dev.createPipelineLayoutUnique(layoutInfo);
+
+      auto viewportState = vk::PipelineViewportStateCreateInfo()
+                               .setViewportCount(viewports.size())
+                               .setPViewports(viewports.data())
+                               .setScissorCount(scissors.size())
+                               .setPScissors(scissors.data());
+
+      colorBlendState.setAttachmentCount(colorBlendAttachments.size())
+          .setPAttachments(colorBlendAttachments.data());
+
+      auto dynamicState = vk::PipelineDynamicStateCreateInfo()
+                              .setDynamicStateCount(dynamicStates.size())
+                              .setPDynamicStates(dynamicStates.data());
+
+      auto info = vk::GraphicsPipelineCreateInfo()
+                      .setStageCount(stages.size())
+                      .setPStages(stages.data())
+                      .setPVertexInputState(&vertInputState)
+                      .setPInputAssemblyState(&inputAsmState)
+                      .setPViewportState(&viewportState)
+                      .setPRasterizationState(&rasterState)
+                      .setPMultisampleState(&multisampleState)
+                      .setPColorBlendState(&colorBlendState)
+                      .setPDynamicState(dynamicStates.empty() ? nullptr : &dynamicState)
+                      .setLayout(*layout)
+                      .setRenderPass(*renderPass)
+                      .setSubpass(0);
+
+      pipe = dev.createGraphicsPipelineUnique(cache, info);
+   }
+
+   std::shared_ptr<RenderPass> renderPass;
+
+   std::vector<vk::PipelineShaderStageCreateInfo>     stages;
+   vk::PipelineVertexInputStateCreateInfo             vertInputState;
+   vk::PipelineInputAssemblyStateCreateInfo           inputAsmState;
+   std::vector<vk::Viewport>                          viewports;
+   std::vector<vk::Rect2D>                            scissors;
+   vk::PipelineRasterizationStateCreateInfo           rasterState;
+   vk::PipelineMultisampleStateCreateInfo             multisampleState;
+   std::vector<vk::PipelineColorBlendAttachmentState> colorBlendAttachments;
+   vk::PipelineColorBlendStateCreateInfo              colorBlendState;
+   std::vector<vk::DynamicState>                      dynamicStates;
+   vk::PipelineLayoutCreateInfo                       layoutInfo;
+
+   vk::UniquePipelineLayout layout;
+   vk::UniquePipeline       pipe;
+};
+
+struct ComputePipeline : VulkanObject {
+   ComputePipeline(vk::Device& dev) : VulkanObject(dev) {}
+
+   inline ComputePipeline& setStage(const VulkanShader& shader) {
+      stage = shader.toPipelineCreateInfo();
+      return *this;
+   }
+
+   void build(vk::PipelineCache cache = nullptr) {
+      layout = dev.createPipelineLayoutUnique(layoutInfo);
+      auto info = vk::ComputePipelineCreateInfo().setStage(stage).setLayout(*layout);
+      pipe      = dev.createComputePipelineUnique(cache, info);
+   }
+
+   vk::PipelineShaderStageCreateInfo stage;
+   vk::PipelineLayoutCreateInfo      layoutInfo;
+
+   vk::UniquePipelineLayout layout;
+   vk::UniquePipeline       pipe;
+};
@@ -0,0 +1,87 @@
+#include "PipelineCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "Macros.hpp"
+
+PipelineCache::PipelineCache(vk::Device& dev, const vk::PhysicalDevice& physical, const std::string& path)
+    : VulkanObject(dev), props{physical.getProperties()}, path{path} {
+   std::vector<byte> blob;
+
+   std::ifstream probe(path, std::ios::binary);
+   if (probe) {
+      probe.close();
+      blob = LoadFile(path);
+   }
+
+   Header       header;
+   const Header expected = makeHeader(blob.size() - std::min(blob.size(), sizeof(Header)));
+
+   if (blob.size() >= sizeof(Header))
+      std::memcpy(&header, blob.data(), sizeof(Header));
+
+   if (blob.empty())
+      Logger::Info("No pipeline cache at ", path, ", starting cold");
+   else if (blob.size() < sizeof(Header) || std::memcmp(&header, &expected, sizeof(Header)) != 0) {
+      Logger::Info("Pipeline cache ", path, " is from another device/driver (or corrupt), starting cold");
+      blob.clear();
+   }
+
+   auto info = vk::PipelineCacheCreateInfo();
+   if (!blob.empty())
+      info.setInitialDataSize(blob.size() - sizeof(Header)).setPInitialData(blob.data() + sizeof(Header));
+
+   cache = dev.createPipelineCache(info);
+   warm  = !blob.empty();
+
+   if (warm)
+      Logger::Info("Loaded ", blob.size() - sizeof(Header), " bytes of pipeline cache from ", path);
+}
+
+PipelineCache::~PipelineCache() {
+   save();
+   dev.destroyPipelineCache(cache);
+}
+
+bool PipelineCache::save() {
+   auto   data   = dev.getPipelineCacheData(cache);
+   Header header = makeHeader(data.size());
+
+   std::string tmpPath = path + ".tmp";
+   {
+      std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+      out.write(reinterpret_cast<const sbyte*>(&header), sizeof(header));
+      out.write(reinterpret_cast<const sbyte*>(data.data()), data.size());
+      out.flush();
+      if (!out) {
+         Logger::Error("Failed to write pipeline cache to ", tmpPath);
+         return false;
+      }
+   }
+
+   // rename() replaces the destination atomically, so readers see either the old cache or the new one. Never half.
+   if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+      Logger::Error("Failed to move pipeline cache into place at ", path);
+      std::remove(tmpPath.c_str());
+      return false;
+   }
+
+   Logger::Info("Saved ", data.size(), " bytes of pipeline cache to ", path);
+   return true;
+}
+
+PipelineCache::Header PipelineCache::makeHeader(uint64 dataSize) const {
+   Header header;
+   std::memset(&header, 0, sizeof(header));  // Padding gets memcmp'd too
+
+   std::memcpy(header.magic, Magic, sizeof(Magic));
+   header.vendorID      = props.vendorID;
+   header.deviceID      = props.deviceID;
+   header.driverVersion = props.driverVersion;
+   std::memcpy(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+   header.dataSize = dataSize;
+
+   return header;
+}
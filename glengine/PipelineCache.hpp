@@ -0,0 +1,49 @@
+#pragma once
+/*
+ * A vk::PipelineCache that lives on disk between runs.
+ *
+ * The file is our own small header followed by whatever vkGetPipelineCacheData gave us. The header pins the vendor,
+ * device, driver version and pipelineCacheUUID; if any of them differ from the device we're running on, the file is
+ * ignored and we start cold. The driver would usually reject a stale blob itself, but not all of them do so gracefully.
+ */
+
+#include <string>
+
+#include "VulkanBase.hpp"
+
+#include "Types.hpp"
+
+class PipelineCache : VulkanObject {
+  public:
+   /// Loads path if it's valid for physical, otherwise starts empty.
+   PipelineCache(vk::Device& dev, const vk::PhysicalDevice& physical, const std::string& path);
+   ~PipelineCache();
+
+   PipelineCache(const PipelineCache&) = delete;
+   PipelineCache& operator=(const PipelineCache&) = delete;
+
+   /// Writes the cache back to disk. Goes through a temp file + rename so a crash never leaves a torn cache.
+   bool save();
+
+   /// Did we start with something useful from disk?
+   bool isWarm() const { return warm; }
+
+   operator vk::PipelineCache() const { return cache; }
+
+  private:
+   struct Header {
+      char   magic[8];
+      uint32 vendorID, deviceID, driverVersion;
+      uint8  uuid[VK_UUID_SIZE];
+      uint64 dataSize;
+   };
+
+   static constexpr char Magic[8] = {'G', 'L', 'E', 'N', 'P', 'C', 'H', '1'};
+
+   Header makeHeader(uint64 dataSize) const;
+
+   vk::PipelineCache            cache;
+   vk::PhysicalDeviceProperties props;
+   std::string                  path;
+   bool                         warm = false;
+};
@@ -0,0 +1,108 @@
+#include "Profiler.hpp"
+
+#ifdef GLEN_PROFILE
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+
+#include "Logger.hpp"
+
+std::mutex                                           Profiler::registryLock;
+std::vector<std::unique_ptr<Profiler::ThreadEvents>> Profiler::threads;
+std::string                                          Profiler::exitDumpFile;
+
+namespace {
+/// Names come from string literals, so this is really just paranoia about quotes in __func__ on weird compilers
+void writeEscaped(std::ofstream& out, const std::string& str) {
+   for (char ch : str) {
+      if (ch == '"' || ch == '\\')
+         out << '\\';
+      out << ch;
+   }
+}
+}  // namespace
+
+const std::chrono::steady_clock::time_point Profiler::epoch = std::chrono::steady_clock::now();
+
+Profiler::ThreadEvents::ThreadEvents(uint32 tid) : tid{tid}, head{new Block()}, tail{head}, total{0} {}
+
+Profiler::ThreadEvents::~ThreadEvents() {
+   for (Block* block = head; block;) {
+      Block* next = block->next.load(std::memory_order_relaxed);
+      delete block;
+      block = next;
+   }
+}
+
+Profiler::ThreadEvents* Profiler::registerThread() {
+   std::lock_guard<std::mutex> lock(registryLock);
+
+   threads.push_back(std::make_unique<ThreadEvents>(threads.size() + 1));
+   auto* events = threads.back().get();
+   events->name = "Thread " + std::to_string(events->tid);
+   return events;
+}
+
+void Profiler::SetThreadName(const std::string& name) {
+   auto&                       events = local();
+   std::lock_guard<std::mutex> lock(registryLock);
+   events.name = name;
+}
+
+bool Profiler::Dump(const std::string& fileName) {
+   std::ofstream out(fileName);
+   if (!out) {
+      Logger::Error("Failed to open profiler dump ", fileName);
+      return false;
+   }
+
+   std::lock_guard<std::mutex> lock(registryLock);
+
+   // Chrome wants microseconds. Keep the ns around as fractional digits.
+   out << std::fixed << std::setprecision(3);
+   out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+   bool first = true;
+   auto sep   = [&] {
+      if (!first)
+         out << ",\n";
+      first = false;
+   };
+
+   size_t total = 0;
+   for (const auto& thread : threads) {
+      sep();
+      out << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << thread->tid << R"(,"args":{"name":")";
+      writeEscaped(out, thread->name);
+      out << "\"}}";
+
+      for (Block* block = thread->head; block; block = block->next.load(std::memory_order_acquire)) {
+         size_t count = block->count.load(std::memory_order_acquire);
+         for (size_t i = 0; i < count; i++) {
+            const auto& event = block->events[i];
+            sep();
+            out << R"({"name":")";
+            writeEscaped(out, event.name);
+            out << R"(","cat":"glen","ph":"X","pid":1,"tid":)" << thread->tid << ",\"ts\":" << event.start / 1000.0
+                << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+         }
+         total += count;
+      }
+   }
+
+   out << "\n]}\n";
+   Logger::Info("Dumped ", total, " profiler events to ", fileName);
+   return true;
+}
+
+void Profiler::DumpOnExit(const std::string& fileName) {
+   static bool registered = false;
+   exitDumpFile           = fileName;
+
+   if (!registered) {
+      std::atexit([] { Dump(exitDumpFile); });
+      registered = true;
+   }
+}
+
+#endif
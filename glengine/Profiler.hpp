@@ -0,0 +1,131 @@
+#pragma once
+/*
+ * Scoped CPU profiling zones, dumped as chrome://tracing / Perfetto JSON.
+ *
+ * PROFILE_ZONE("name") times everything until the end of the enclosing scope, PROFILE_FUNCTION() does the same with
+ * the function's name. Each thread appends to its own chain of fixed-size blocks, so recording is a couple of clock
+ * reads and a store; nobody locks anything unless it's the first zone on a brand new thread.
+ *
+ * Only compiled in when GLEN_PROFILE is defined (CMake does that for every config but Release). Without it the macros
+ * are empty and every Profiler function is an inline no-op.
+ */
+
+#include <string>
+
+#include "Types.hpp"
+
+#ifdef GLEN_PROFILE
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Profiler {
+  public:
+   /// One complete ("ph":"X") trace event.
+   struct Event {
+      const char* name;  // Must outlive the profiler. String literals and __func__ are fine.
+      uint64      start, end;  // ns since the profiler's epoch
+   };
+
+   static inline uint64 Now() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+   }
+
+   /// Appends to the calling thread's buffer. Past MaxEventsPerThread events just get dropped.
+   static inline void Record(const char* name, uint64 start, uint64 end) {
+      ThreadEvents& events = local();
+      Block*        block  = events.tail;
+      size_t        count  = block->count.load(std::memory_order_relaxed);
+
+      if (count == BlockSize) {
+         if (events.total >= MaxEventsPerThread)
+            return;
+
+         auto* next = new Block();
+         block->next.store(next, std::memory_order_release);
+         events.tail = block = next;
+         count               = 0;
+      }
+
+      block->events[count] = {name, start, end};
+      block->count.store(count + 1, std::memory_order_release);  // Publish to whoever's dumping
+      events.total++;
+   }
+
+   /// Shows up as the thread's name in the trace viewer.
+   static void SetThreadName(const std::string& name);
+
+   /// Writes everything recorded so far, on every thread. Safe to call while other threads keep recording; their
+   /// newest events just might not make it in.
+   static bool Dump(const std::string& fileName);
+
+   /// Dump(fileName) when the program exits.
+   static void DumpOnExit(const std::string& fileName);
+
+  private:
+   static constexpr size_t BlockSize          = 4096;
+   static constexpr size_t MaxEventsPerThread = 1 << 22;
+
+   struct Block {
+      Event               events[BlockSize];
+      std::atomic<size_t> count{0};
+      std::atomic<Block*> next{nullptr};
+   };
+
+   /// Owned by the profiler, not the thread, so we can still dump them after the thread is gone.
+   struct ThreadEvents {
+      ThreadEvents(uint32 tid);
+      ~ThreadEvents();
+
+      uint32      tid;
+      std::string name;
+      Block*      head;
+      Block*      tail;   // Only touched by the owning thread
+      size_t      total;  // Ditto
+   };
+
+   static ThreadEvents& local() {
+      static thread_local ThreadEvents* events = registerThread();
+      return *events;
+   }
+
+   static ThreadEvents* registerThread();
+
+   static const std::chrono::steady_clock::time_point epoch;
+   static std::mutex                                  registryLock;  // Guards threads and every ThreadEvents::name
+   static std::vector<std::unique_ptr<ThreadEvents>>  threads;
+   static std::string                                 exitDumpFile;
+};
+
+/// RAII half of PROFILE_ZONE
+class ProfileZone {
+  public:
+   inline ProfileZone(const char* name) : name{name}, start{Profiler::Now()} {}
+   inline ~ProfileZone() { Profiler::Record(name, start, Profiler::Now()); }
+
+  private:
+   const char* name;
+   uint64      start;
+};
+
+#define PROFILE_CONCAT_IMPL(A, B) A##B
+#define PROFILE_CONCAT(A, B) PROFILE_CONCAT_IMPL(A, B)
+#define PROFILE_ZONE(NAME) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(NAME)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+
+#else
+
+class Profiler {
+  public:
+   static inline void SetThreadName(const std::string&) {}
+   static inline bool Dump(const std::string&) { return false; }
+   static inline void DumpOnExit(const std::string&) {}
+};
+
+#define PROFILE_ZONE(NAME)
+#define PROFILE_FUNCTION()
+
+#endif
@@ -0,0 +1,262 @@
+#include "RegionFile.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Compression.hpp"
+#include "FileIO.hpp"
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+namespace {
+int32 FloorDiv(int32 a, int32 b) {
+   return a / b - (a % b < 0);
+}
+}  // namespace
+
+std::unique_ptr<RegionFile> RegionFile::Open(const std::string& path, bool create) {
+   int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+   if (fd < 0 && errno == ENOENT && create) {
+      // Header and an empty table, all in place before the file appears
+      std::vector<ubyte> contents(DataOffset, 0);
+      Header             header{{'G', 'L', 'R', 'G'}, Version, uint32(ChunkSize), uint32(RegionSize)};
+      std::memcpy(contents.data(), &header, sizeof(header));
+      if (!ReplaceFile(path, contents))
+         return nullptr;
+      fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+   }
+   if (fd < 0) {
+      if (errno != ENOENT)
+         Logger::Error("Couldn't open region ", path, ": ", std::strerror(errno));
+      return nullptr;
+   }
+
+   std::unique_ptr<RegionFile> region(new RegionFile(path, fd));
+
+   struct stat info;
+   if (::fstat(fd, &info) != 0 || uint64(info.st_size) < DataOffset) {
+      Logger::Error("Region ", path, " is truncated");
+      return nullptr;
+   }
+   if (!region->map())
+      return nullptr;
+
+   Header header;
+   std::memcpy(&header, region->mapped, sizeof(header));
+   if (std::memcmp(header.magic, "GLRG", 4) != 0 || header.version != Version) {
+      Logger::Error(path, " isn't a region file (or is from a newer version)");
+      return nullptr;
+   }
+   if (header.chunkSize != uint32(ChunkSize) || header.regionSize != uint32(RegionSize)) {
+      Logger::Error(path, " has ", header.chunkSize, "³ chunks and ", header.regionSize, "³ regions, but we use ",
+                    ChunkSize, "³ and ", RegionSize, "³");
+      return nullptr;
+   }
+
+   region->end = info.st_size;
+   for (size_t i = 0; i < RegionVolume; i++) {
+      uint64 entry;
+      std::memcpy(&entry, region->mapped + TableOffset + i * sizeof(uint64), sizeof(entry));
+
+      uint64 offset = entry >> SizeBits, size = entry & MaxChunkBytes;
+      if (entry && (offset < DataOffset || offset + size > uint64(info.st_size))) {
+         Logger::Error("Region ", path, " has a chunk past the end of the file; dropping it");
+         entry = 0;
+         size  = 0;
+      }
+      region->table[i].store(entry, std::memory_order_relaxed);
+      region->live += size;
+   }
+
+   return region;
+}
+
+RegionFile::RegionFile(std::string path, int fd)
+    : filePath{std::move(path)}, fd{fd}, table{new std::atomic<uint64>[RegionVolume]} {}
+
+RegionFile::~RegionFile() {
+   unmap();
+   if (fd >= 0)
+      ::close(fd);
+}
+
+bool RegionFile::map() {
+   // Past the end of the file is fine as long as nobody touches it, and appends show up in it for free
+   void* address = ::mmap(nullptr, MaxFileSize, PROT_READ, MAP_SHARED, fd, 0);
+   if (address == MAP_FAILED) {
+      Logger::Error("Couldn't map region ", filePath, ": ", std::strerror(errno));
+      return false;
+   }
+   mapped = static_cast<const ubyte*>(address);
+   return true;
+}
+
+void RegionFile::unmap() {
+   if (mapped)
+      ::munmap(const_cast<ubyte*>(mapped), MaxFileSize);
+   mapped = nullptr;
+}
+
+bool RegionFile::load(int32 x, int32 y, int32 z, Chunk& out) const {
+   PROFILE_FUNCTION();
+   uint64 entry = table[Index(x, y, z)].load(std::memory_order_acquire);
+   if (!entry)
+      return false;
+
+   uint64 offset = entry >> SizeBits, size = entry & MaxChunkBytes;
+   if (LZDecompress(mapped + offset, size, out.blocks, sizeof(out.blocks)) != int64(sizeof(out.blocks))) {
+      Logger::Error("Chunk ", x, ", ", y, ", ", z, " in ", filePath, " is corrupt");
+      return false;
+   }
+   return true;
+}
+
+bool RegionFile::save(const std::vector<ChunkWrite>& chunks) {
+   PROFILE_FUNCTION();
+   if (chunks.empty())
+      return true;
+
+   // Compress before taking the lock, so saves from several threads overlap
+   struct Placed {
+      size_t index;
+      uint64 offset, size;  // Offset relative to the start of this batch
+   };
+   std::vector<ubyte>  payload;
+   std::vector<Placed> placed;
+   for (auto& write : chunks) {
+      size_t start = payload.size();
+      payload.resize(start + LZCompressBound(sizeof(write.chunk->blocks)));
+      size_t size =
+          LZCompress(write.chunk->blocks, sizeof(write.chunk->blocks), &payload[start], payload.size() - start);
+      payload.resize(start + size);
+      placed.push_back({Index(write.x, write.y, write.z), start, size});
+   }
+
+   std::lock_guard<std::mutex> guard(writeLock);
+   uint64                      base = end.load(std::memory_order_relaxed);
+   if (base + payload.size() > MaxFileSize || base + payload.size() >= uint64(1) << (64 - SizeBits)) {
+      Logger::Error("Region ", filePath, " is full; compact() it");
+      return false;
+   }
+
+   // Payloads first, and on disk, before anything points at them
+   if (!WriteAll(fd, payload.data(), payload.size(), base) || ::fdatasync(fd) != 0) {
+      Logger::Error("Couldn't save to ", filePath, ": ", std::strerror(errno));
+      return false;
+   }
+   end.store(base + payload.size(), std::memory_order_relaxed);
+
+   // Then swing the entries over. Entries never straddle a sector, so however the table write gets split up each one
+   // is either all old or all new.
+   size_t first = RegionVolume, last = 0;
+   for (auto& chunk : placed) {
+      uint64 entry = (base + chunk.offset) << SizeBits | chunk.size;
+      uint64 old   = table[chunk.index].exchange(entry, std::memory_order_release);
+      live += chunk.size - (old & MaxChunkBytes);
+      first = std::min(first, chunk.index);
+      last  = std::max(last, chunk.index);
+   }
+
+   std::vector<uint64> entries(last - first + 1);
+   for (size_t i = first; i <= last; i++)
+      entries[i - first] = table[i].load(std::memory_order_relaxed);
+   if (!WriteAll(fd, entries.data(), entries.size() * sizeof(uint64), TableOffset + first * sizeof(uint64)) ||
+       ::fdatasync(fd) != 0) {
+      Logger::Error("Couldn't update the table of ", filePath, ": ", std::strerror(errno));
+      return false;
+   }
+
+   return true;
+}
+
+bool RegionFile::compact() {
+   PROFILE_FUNCTION();
+   std::lock_guard<std::mutex> guard(writeLock);
+
+   std::vector<ubyte> contents(DataOffset, 0);
+   std::memcpy(contents.data(), mapped, sizeof(Header));
+   contents.reserve(DataOffset + live);
+
+   std::vector<uint64> entries(RegionVolume, 0);
+   for (size_t i = 0; i < RegionVolume; i++) {
+      uint64 entry = table[i].load(std::memory_order_relaxed);
+      if (!entry)
+         continue;
+      uint64 offset = entry >> SizeBits, size = entry & MaxChunkBytes;
+      entries[i]    = uint64(contents.size()) << SizeBits | size;
+      contents.insert(contents.end(), mapped + offset, mapped + offset + size);
+   }
+   std::memcpy(&contents[TableOffset], entries.data(), entries.size() * sizeof(uint64));
+
+   if (!ReplaceFile(filePath, contents))
+      return false;
+
+   // The old file's gone from the directory, but we still have it open; switch over
+   int newFd = ::open(filePath.c_str(), O_RDWR | O_CLOEXEC);
+   if (newFd < 0) {
+      Logger::Error("Couldn't reopen ", filePath, " after compacting: ", std::strerror(errno));
+      return false;
+   }
+   unmap();
+   ::close(fd);
+   fd = newFd;
+   if (!map())
+      return false;
+
+   for (size_t i = 0; i < RegionVolume; i++)
+      table[i].store(entries[i], std::memory_order_relaxed);
+   end.store(contents.size(), std::memory_order_relaxed);
+   return true;
+}
+
+RegionStore::RegionStore(std::string directory) : directory{std::move(directory)} {
+   if (::mkdir(this->directory.c_str(), 0755) != 0 && errno != EEXIST)
+      Logger::Error("Couldn't create ", this->directory, ": ", std::strerror(errno));
+}
+
+bool RegionStore::load(int32 x, int32 y, int32 z, Chunk& out) {
+   int32       rx = FloorDiv(x, RegionSize), ry = FloorDiv(y, RegionSize), rz = FloorDiv(z, RegionSize);
+   RegionFile* file = region(rx, ry, rz, false);
+   return file && file->load(x - rx * RegionSize, y - ry * RegionSize, z - rz * RegionSize, out);
+}
+
+bool RegionStore::save(const std::vector<ChunkWrite>& chunks) {
+   std::map<std::tuple<int32, int32, int32>, std::vector<ChunkWrite>> byRegion;
+   for (auto& write : chunks) {
+      int32 rx = FloorDiv(write.x, RegionSize), ry = FloorDiv(write.y, RegionSize), rz = FloorDiv(write.z, RegionSize);
+      byRegion[{rx, ry, rz}].push_back(
+          {write.x - rx * RegionSize, write.y - ry * RegionSize, write.z - rz * RegionSize, write.chunk});
+   }
+
+   bool ok = true;
+   for (auto& [pos, writes] : byRegion) {
+      RegionFile* file = region(std::get<0>(pos), std::get<1>(pos), std::get<2>(pos), true);
+      ok &= file && file->save(writes);
+   }
+   return ok;
+}
+
+RegionFile* RegionStore::region(int32 rx, int32 ry, int32 rz, bool create) {
+   // 21 bits a coordinate is still a couple of billion blocks each way
+   uint64 key = (uint64(rx) & 0x1fffff) | (uint64(ry) & 0x1fffff) << 21 | (uint64(rz) & 0x1fffff) << 42;
+
+   std::lock_guard<std::mutex> guard(lock);
+   auto                        found = regions.find(key);
+   if (found != regions.end() && (found->second || !create))
+      return found->second.get();
+
+   // Misses are remembered too, so asking after empty space doesn't hit the filesystem every time
+   auto path = directory + "/r." + std::to_string(rx) + "." + std::to_string(ry) + "." + std::to_string(rz) + ".glr";
+   auto file = RegionFile::Open(path, create);
+   auto ptr  = file.get();
+   regions[key] = std::move(file);
+   return ptr;
+}
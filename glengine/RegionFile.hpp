@@ -0,0 +1,114 @@
+#pragma once
+/*
+ * On-disk world storage: RegionSize³ chunks per file, each one LZ compressed (see Compression.hpp).
+ *
+ * Layout: a Header, then a fixed table of one uint64 per chunk (offset << 24 | compressed size, 0 if it's never been
+ * saved), then payloads. The whole file is mmap'd read-only once, with enough address space reserved that appends
+ * never need a remap, so loading a chunk is a page fault and a decompress straight into the Chunk; no read() calls and
+ * no buffer in between.
+ *
+ * Saves never overwrite anything. The new payloads get appended and synced, and only then does each table entry swing
+ * over to point at them (an aligned 8 byte write, which a sector write can't tear). Die at any point and every entry
+ * still points at a complete payload, either the new one or the old one. The old payloads are just dead space until
+ * compact() rewrites the file and renames it over the original.
+ *
+ * Loads are safe from any number of threads, alongside saves. compact() isn't; nothing can be loading during it.
+ *
+ * POSIX only (mmap, pwrite, fdatasync).
+ */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Chunk.hpp"
+#include "Types.hpp"
+
+constexpr int32  RegionSize   = 16;
+constexpr size_t RegionVolume = size_t(RegionSize) * RegionSize * RegionSize;
+
+/// Chunk coordinates, local to a region for RegionFile or world-wide for RegionStore.
+struct ChunkWrite {
+   int32        x, y, z;
+   const Chunk* chunk;
+};
+
+class RegionFile {
+  public:
+   /// Returns null (and logs why) if it can't be opened, or isn't a region file for this ChunkSize/RegionSize.
+   static std::unique_ptr<RegionFile> Open(const std::string& path, bool create);
+   ~RegionFile();
+
+   RegionFile(const RegionFile&) = delete;
+   RegionFile& operator=(const RegionFile&) = delete;
+
+   bool contains(int32 x, int32 y, int32 z) const { return table[Index(x, y, z)].load(std::memory_order_acquire); }
+   /// False if the chunk's never been saved, or its payload is corrupt.
+   bool load(int32 x, int32 y, int32 z, Chunk& out) const;
+
+   /// All or nothing per chunk, and durable once it returns true. Batch them up; it's two fdatasyncs however many
+   /// chunks there are.
+   bool save(const std::vector<ChunkWrite>& chunks);
+   bool save(int32 x, int32 y, int32 z, const Chunk& chunk) { return save({{x, y, z, &chunk}}); }
+
+   /// Rewrites the file without the dead space. Nothing else can touch the region meanwhile.
+   bool compact();
+
+   uint64 fileSize() const { return end; }
+   uint64 liveBytes() const { return live; }  // Payloads the table actually points at
+
+   const std::string& path() const { return filePath; }
+
+  private:
+   struct Header {
+      char   magic[4];
+      uint32 version;
+      uint32 chunkSize, regionSize;
+   };
+
+   static constexpr uint32 Version       = 1;
+   static constexpr uint64 TableOffset   = sizeof(Header);
+   static constexpr uint64 DataOffset    = 64 * 1024;        // Table rounded up, so payloads start page aligned
+   static constexpr uint64 MaxFileSize   = uint64(1) << 36;  // Address space reserved for the mapping
+   static constexpr uint32 SizeBits      = 24;
+   static constexpr uint64 MaxChunkBytes = (uint64(1) << SizeBits) - 1;
+   static_assert(TableOffset + RegionVolume * sizeof(uint64) <= DataOffset, "Offset table overlaps the payloads");
+
+   static size_t Index(int32 x, int32 y, int32 z) {
+      return size_t(x) + size_t(y) * RegionSize + size_t(z) * RegionSize * RegionSize;
+   }
+
+   RegionFile(std::string path, int fd);
+   bool map();
+   void unmap();
+
+   std::string  filePath;
+   int          fd     = -1;
+   const ubyte* mapped = nullptr;
+
+   std::unique_ptr<std::atomic<uint64>[]> table;  // Mirror of the on-disk table
+   std::mutex                             writeLock;
+   std::atomic<uint64>                    end{DataOffset};
+   uint64                                 live = 0;
+};
+
+/// A directory of region files, opened as chunks in them are asked for. World chunk coordinates.
+class RegionStore {
+  public:
+   explicit RegionStore(std::string directory);
+
+   bool load(int32 x, int32 y, int32 z, Chunk& out);
+   /// Splits the batch up by region. True if every region's save went through.
+   bool save(const std::vector<ChunkWrite>& chunks);
+
+   /// Null if the region file doesn't exist and create is false.
+   RegionFile* region(int32 rx, int32 ry, int32 rz, bool create);
+
+  private:
+   std::string                                             directory;
+   std::mutex                                              lock;
+   std::unordered_map<uint64, std::unique_ptr<RegionFile>> regions;
+};
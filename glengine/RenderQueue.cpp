@@ -0,0 +1,145 @@
+#include "RenderQueue.hpp"
+
+#include <array>
+
+#include "Profiler.hpp"
+
+namespace {
+std::atomic<uint64> nextQueueId{1};
+}
+
+RenderQueue::RenderQueue() : id{nextQueueId++} {}
+
+RenderQueue::~RenderQueue() {}
+
+RenderQueue::Bucket& RenderQueue::bucket() {
+   struct Cached {
+      uint64  queue;
+      Bucket* bucket;
+   };
+   // Hardly ever more than one queue, so a linear search beats anything fancier
+   static thread_local std::vector<Cached> cache;
+
+   for (const auto& cached : cache)
+      if (cached.queue == this->id)
+         return *cached.bucket;
+
+   std::lock_guard<std::mutex> guard(this->bucketLock);
+   this->buckets.push_back(std::make_unique<Bucket>());
+   cache.push_back({this->id, this->buckets.back().get()});
+   return *this->buckets.back();
+}
+
+void RenderQueue::sort() {
+   PROFILE_FUNCTION();
+   this->sorted.clear();
+   for (uint32 b = 0; b < this->buckets.size(); b++) {
+      const auto& packets = this->buckets[b]->packets;
+      for (uint32 i = 0; i < packets.size(); i++)
+         this->sorted.push_back({packets[i].key, b, i});
+   }
+
+   const size_t count = this->sorted.size();
+   if (count < 2)
+      return;
+
+   // LSD radix sort, a byte at a time. Every histogram comes out of one pass over the keys, and any byte that's the
+   // same for every key gets skipped, which with mostly-zero passes and similar depths is usually half of them.
+   std::array<std::array<uint32, 256>, 8> histograms = {};
+   for (const auto& entry : this->sorted)
+      for (uint32 digit = 0; digit < 8; digit++)
+         histograms[digit][(entry.key >> (digit * 8)) & 0xFF]++;
+
+   this->scratch.resize(count);
+   for (uint32 digit = 0; digit < 8; digit++) {
+      auto&  histogram = histograms[digit];
+      uint32 shift     = digit * 8;
+      if (histogram[(this->sorted[0].key >> shift) & 0xFF] == count)
+         continue;
+
+      uint32 offset = 0;
+      for (auto& bin : histogram) {
+         uint32 binCount = bin;
+         bin             = offset;
+         offset += binCount;
+      }
+
+      for (const auto& entry : this->sorted)
+         this->scratch[histogram[(entry.key >> shift) & 0xFF]++] = entry;
+      this->sorted.swap(this->scratch);
+   }
+}
+
+void RenderQueue::record(vk::CommandBuffer cmd, size_t begin, size_t end, vk::Extent2D extent) {
+   PROFILE_FUNCTION();
+   cmd.setViewport(0, vk::Viewport(0.0f, 0.0f, extent.width, extent.height, 0.0f, 1.0f));
+   cmd.setScissor(0, vk::Rect2D({0, 0}, extent));
+
+   GraphicsPipeline*  pipeline = nullptr;
+   vk::PipelineLayout layout;
+   vk::DescriptorSet  material;
+   vk::Buffer         vertexBuffer, indexBuffer;
+   vk::DeviceSize     vertexOffset = 0, indexOffset = 0;
+   vk::IndexType      indexType    = vk::IndexType::eUint32;
+   Stats              counts       = {};
+
+   for (size_t i = begin; i < end && i < this->sorted.size(); i++) {
+      const auto& packet = this->buckets[this->sorted[i].bucket]->packets[this->sorted[i].index];
+
+      if (packet.pipeline != pipeline) {
+         pipeline = packet.pipeline;
+         cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline->pipe);
+         counts.pipelineBinds++;
+
+         // A different layout may have disturbed set 0
+         if (*pipeline->layout != layout) {
+            layout   = *pipeline->layout;
+            material = nullptr;
+         }
+      }
+
+      if (packet.material && packet.material != material) {
+         material = packet.material;
+         cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0, material, nullptr);
+         counts.materialBinds++;
+      }
+
+      if (packet.vertexBuffer &&
+          (packet.vertexBuffer != vertexBuffer || packet.vertexBufferOffset != vertexOffset)) {
+         vertexBuffer = packet.vertexBuffer;
+         vertexOffset = packet.vertexBufferOffset;
+         cmd.bindVertexBuffers(0, vertexBuffer, vertexOffset);
+         counts.vertexBinds++;
+      }
+
+      if (packet.indexBuffer) {
+         if (packet.indexBuffer != indexBuffer || packet.indexBufferOffset != indexOffset ||
+             packet.indexType != indexType) {
+            indexBuffer = packet.indexBuffer;
+            indexOffset = packet.indexBufferOffset;
+            indexType   = packet.indexType;
+            cmd.bindIndexBuffer(indexBuffer, indexOffset, indexType);
+            counts.indexBinds++;
+         }
+         cmd.drawIndexed(packet.count, packet.instanceCount, packet.first, packet.vertexOffset, packet.firstInstance);
+      } else
+         cmd.draw(packet.count, packet.instanceCount, packet.first, packet.firstInstance);
+
+      counts.draws++;
+   }
+
+   this->draws += counts.draws;
+   this->pipelineBinds += counts.pipelineBinds;
+   this->materialBinds += counts.materialBinds;
+   this->vertexBinds += counts.vertexBinds;
+   this->indexBinds += counts.indexBinds;
+}
+
+void RenderQueue::clear() {
+   for (auto& bucket : this->buckets)
+      bucket->packets.clear();
+   this->sorted.clear();
+
+   this->lastFrame = {this->draws.exchange(0), this->pipelineBinds.exchange(0), this->materialBinds.exchange(0),
+                      this->vertexBinds.exchange(0), this->indexBinds.exchange(0)};
+}
@@ -0,0 +1,120 @@
+#pragma once
+/*
+ * Sorted draw submission.
+ *
+ * Anything that wants to draw fills in a DrawPacket, tags it with a 64-bit sort key and submit()s it, from whatever
+ * thread it likes. Each thread appends to its own bucket, so there's no contention. Once a frame the backend gathers
+ * every bucket, radix sorts by key and records the packets in that order, only binding a pipeline, material or buffer
+ * when it actually differs from the last packet's. With the key laid out as pass | pipeline | material | depth,
+ * everything sharing a pipeline and material ends up back to back, so a scene full of the same few materials costs a
+ * handful of binds instead of several per object.
+ *
+ * Per-object data goes through firstInstance (index into a storage buffer) rather than per-draw descriptor sets, so it
+ * never breaks a run of draws.
+ */
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "VulkanBase.hpp"
+
+#include "Pipeline.hpp"
+#include "Types.hpp"
+
+/// Most significant first: pass (4 bits), pipeline (12), material (16), depth (32). Depth is whatever ordering you
+/// want within a material; front to back for opaque, back to front (inverted) for transparent.
+struct SortKey {
+   static constexpr uint64 MakeKey(uint32 pass, uint32 pipeline, uint32 material, uint32 depth) {
+      return (uint64(pass & 0xF) << 60) | (uint64(pipeline & 0xFFF) << 48) | (uint64(material & 0xFFFF) << 32) | depth;
+   }
+
+   /// Quantizes a view depth into the bottom bits. Positive floats sort the same as their bit patterns.
+   static uint32 Depth(float viewDepth, bool backToFront = false) {
+      uint32 bits;
+      viewDepth = viewDepth > 0.0f ? viewDepth : 0.0f;
+      std::memcpy(&bits, &viewDepth, sizeof(bits));
+      return backToFront ? ~bits : bits;
+   }
+
+   static constexpr uint32 Pass(uint64 key) { return key >> 60; }
+};
+
+struct DrawPacket {
+   uint64            key = 0;
+   GraphicsPipeline* pipeline = nullptr;
+   vk::DescriptorSet material;  // Bound at set 0. May be null.
+
+   vk::Buffer     vertexBuffer;
+   vk::DeviceSize vertexBufferOffset = 0;
+   vk::Buffer     indexBuffer;  // Null for a non-indexed draw
+   vk::DeviceSize indexBufferOffset = 0;
+   vk::IndexType  indexType         = vk::IndexType::eUint32;
+
+   uint32 count         = 0;  // Indices, or vertices if not indexed
+   uint32 instanceCount = 1;
+   uint32 first         = 0;  // First index or vertex
+   int32  vertexOffset  = 0;  // Only for indexed draws
+   uint32 firstInstance = 0;
+};
+
+class RenderQueue {
+  public:
+   struct Stats {
+      uint32 draws, pipelineBinds, materialBinds, vertexBinds, indexBinds;
+   };
+
+   RenderQueue();
+   ~RenderQueue();
+
+   RenderQueue(const RenderQueue&) = delete;
+   RenderQueue& operator=(const RenderQueue&) = delete;
+
+   /// Thread safe and lock free (after a thread's first submit). Everything submitted before the backend starts
+   /// recording makes it into that frame.
+   void submit(const DrawPacket& packet) { bucket().packets.push_back(packet); }
+   void submit(const DrawPacket* packets, size_t count) {
+      auto& into = bucket().packets;
+      into.insert(into.end(), packets, packets + count);
+   }
+
+   /// Gathers and sorts every bucket. Nobody can be submitting while this runs.
+   void sort();
+
+   /// Number of packets the last sort() found.
+   size_t size() const { return this->sorted.size(); }
+
+   /// Records sorted packets [begin, end). Safe to call for different ranges on different threads at once;
+   /// each range starts with nothing bound. Sets viewport and scissor, since secondaries don't inherit them.
+   void record(vk::CommandBuffer cmd, size_t begin, size_t end, vk::Extent2D extent);
+
+   /// Drops every packet, keeping the memory around for next frame. Call once the frame's recorded.
+   void clear();
+
+   /// Totals for the last frame that was clear()ed.
+   Stats stats() const { return this->lastFrame; }
+
+  private:
+   struct Bucket {
+      std::vector<DrawPacket> packets;
+   };
+
+   struct Sorted {
+      uint64 key;
+      uint32 bucket, index;
+   };
+
+   Bucket& bucket();
+
+   const uint64 id;  // Never reused, unlike addresses, so thread_local lookups can't mix queues up
+
+   std::mutex                           bucketLock;  // Only guards adding buckets
+   std::vector<std::unique_ptr<Bucket>> buckets;
+
+   std::vector<Sorted> sorted, scratch;
+
+   std::atomic<uint32> draws{0}, pipelineBinds{0}, materialBinds{0}, vertexBinds{0}, indexBinds{0};
+   Stats               lastFrame = {};
+};
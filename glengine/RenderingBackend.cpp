@@ -0,0 +1,133 @@
+#include "RenderingBackend.hpp"
+
+#include <utility>
+
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+RenderingBackend::~RenderingBackend() {
+   // Everything renderFrame() needs is gone by now, so all that's left is to complain
+   if (this->renderThread.joinable())
+      Logger::Error("Rendering backend destroyed with its render thread still running!");
+}
+
+FramePacket& RenderingBackend::beginFrame() {
+   auto& packet = this->packets.write();
+   if (!this->packetOpen) {
+      // All three start out null, and get made the first time they come round to the writer
+      if (!packet)
+         packet = createFramePacket();
+      packet->clear();
+      this->packetOpen = true;
+   }
+   return *packet;
+}
+
+void RenderingBackend::updateRender() {
+   PROFILE_FUNCTION();
+   if (this->failed.load(std::memory_order_acquire))
+      stopRenderThread();  // Rethrows whatever it died of
+
+   FramePacket& packet = beginFrame();
+   packet.number       = ++this->submitted;
+   this->packetOpen    = false;
+   finishPacket(packet);
+
+   if (!isThreaded()) {
+      this->packets.publish();
+      this->packets.update();
+      this->taken.store(packet.number, std::memory_order_relaxed);
+      renderFrame(packet);
+      return;
+   }
+
+   if (!this->skipStaleFrames) {
+      PROFILE_ZONE("WaitForRenderThread");
+      this->tookPacket.waitUntil([&] {
+         return this->taken.load(std::memory_order_acquire) + 1 >= packet.number ||
+                this->failed.load(std::memory_order_acquire);
+      });
+      if (this->failed.load(std::memory_order_acquire))
+         stopRenderThread();
+   }
+   this->packets.publish();
+}
+
+void RenderingBackend::setThreaded(bool threaded, bool skipStaleFrames) {
+   // Only the game thread reads it, so it can change any time. Stopping goes by the mode it was running in though,
+   // so a paced render thread still draws its last packet.
+   if (threaded == isThreaded()) {
+      this->skipStaleFrames = skipStaleFrames;
+      return;
+   }
+
+   if (!threaded) {
+      stopRenderThread();
+      this->skipStaleFrames = skipStaleFrames;
+      Logger::Info("Rendering on the game thread");
+      return;
+   }
+
+   this->skipStaleFrames = skipStaleFrames;
+   this->taken.store(this->submitted, std::memory_order_relaxed);
+   this->renderThread = std::thread(&RenderingBackend::renderLoop, this);
+   Logger::Info("Rendering on its own thread", skipStaleFrames ? ", skipping stale frames" : "");
+}
+
+void RenderingBackend::stopRenderThread() {
+   // The wake up packet replaces whatever was published last, so in paced mode let the render thread pick that up first
+   if (!this->skipStaleFrames) {
+      PROFILE_ZONE("WaitForRenderThread");
+      this->tookPacket.waitUntil([&] {
+         return this->taken.load(std::memory_order_acquire) >= this->submitted ||
+                this->failed.load(std::memory_order_acquire);
+      });
+   }
+
+   this->stopping.store(true, std::memory_order_release);
+   beginFrame();  // Just something to publish, so it wakes up and notices
+   this->packetOpen = false;
+   this->packets.publish();
+   this->renderThread.join();
+   this->stopping.store(false, std::memory_order_relaxed);
+   this->packets.update();  // Take the wake up packet back, or it'd be the first thing a new render thread draws
+
+   // Anything it never got to was skipped as much as if a newer packet had replaced it
+   uint64 taken = this->taken.load(std::memory_order_relaxed);
+   if (taken < this->submitted) {
+      this->skipped.fetch_add(this->submitted - taken, std::memory_order_relaxed);
+      this->taken.store(this->submitted, std::memory_order_relaxed);
+   }
+
+   if (this->failed.exchange(false, std::memory_order_acquire))
+      std::rethrow_exception(std::exchange(this->failure, nullptr));
+}
+
+void RenderingBackend::renderLoop() {
+   Profiler::SetThreadName("Render");
+   try {
+      onRenderThreadStart();
+      for (;;) {
+         const FramePacket& packet = *this->packets.waitForNew();
+         if (this->stopping.load(std::memory_order_acquire))
+            break;
+
+         uint64 last = this->taken.exchange(packet.number, std::memory_order_acq_rel);
+         if (packet.number > last + 1)
+            this->skipped.fetch_add(packet.number - last - 1, std::memory_order_relaxed);
+         this->tookPacket.notify();
+
+         renderFrame(packet);
+      }
+      onRenderThreadStop();
+   } catch (...) {
+      // Handed to the game thread to rethrow. Still has to give back whatever it took over.
+      this->failure = std::current_exception();
+      try {
+         onRenderThreadStop();
+      } catch (...) {
+      }
+      this->failed.store(true, std::memory_order_release);
+      this->tookPacket.notify();
+   }
+}
@@ -8,24 +8,111 @@
  *
  */
 
+#include <atomic>
+#include <exception>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <SDL2/SDL.h>
 
 #include <glm/glm.hpp>
 
+#include "ITC.hpp"
 #include "Types.hpp"
 
+/// Laid out to go straight into a uniform buffer (std140).
+struct FrameCamera {
+   glm::mat4 view{1.0f};
+   glm::mat4 proj{1.0f};
+   glm::vec4 position{0.0f};  // w is unused
+};
+
+/// Everything the game thread hands the renderer for a frame. Backends derive from it to add their own draw lists.
+/// Packets get reused, so the camera still holds whatever was set a couple of frames ago; set it every frame.
+struct FramePacket {
+   virtual ~FramePacket() = default;
+   /// Empties the packet before it's reused. Overrides have to call this one too.
+   virtual void clear() { uniforms.clear(); }
+
+   uint64             number = 0;  // Set by updateRender(), counting from 1
+   FrameCamera        camera;
+   std::vector<ubyte> uniforms;  // Anything else this frame's shaders want, copied into per-frame memory as is
+};
+
+/*
+ * Frames go through FramePackets. The game thread fills one in (beginFrame()) and hands it over with updateRender().
+ * Normally that renders it there and then, blocking on the GPU and vsync like always. In threaded mode a render thread
+ * owns the backend and updateRender() just publishes the packet and returns; the game thread gets on with the next one
+ * while the render thread draws the last. The packets go through a TripleBuffer, so neither side ever waits on the
+ * other unless asked to.
+ */
 class RenderingBackend {
   public:
    // Thou shalt not instantiate this class. Derive from it.
-   virtual ~RenderingBackend() {}
+   /// Backends have to setThreaded(false) first thing in their own destructor, while renderFrame() still works.
+   virtual ~RenderingBackend();
 
 
    virtual void init(const std::string& windowTitle, glm::ivec2 windowDims) = 0;
-   virtual void updateRender()                                              = 0;
+
+   /// Game thread. This frame's packet, emptied on the first call after each updateRender().
+   FramePacket& beginFrame();
+   /// Game thread. Hands this frame's packet over (an empty one if beginFrame() wasn't called) and renders it, or
+   /// leaves it to the render thread in threaded mode. Rethrows anything the render thread died of.
+   void updateRender();
+
+   /// Moves rendering onto its own thread (or back). Call between frames, after init(), from the game thread.
+   /// skipStaleFrames: the game thread never waits, and the render thread always draws the newest packet, skipping
+   ///                  any that were replaced before it got to them. Simulation runs as fast as it likes.
+   /// Otherwise:       every packet gets drawn. updateRender() waits for the render thread to pick up the last packet
+   ///                  before publishing, so the game is never more than a frame ahead of what's being drawn.
+   void setThreaded(bool threaded, bool skipStaleFrames = true);
+   bool isThreaded() const { return renderThread.joinable(); }
+   /// How many packets the render thread never drew, because a newer one turned up first.
+   uint64 getSkippedFrames() const { return skipped.load(std::memory_order_relaxed); }
+
+   /// How many frames the CPU may get ahead of the GPU. Lower is less latency, higher is more throughput.
+   virtual void   setFramesInFlight(size_t frames) = 0;
+   virtual size_t getFramesInFlight() const        = 0;
+   /// How long the renderer spent blocked on the GPU during the last frame, in milliseconds.
+   virtual double getGpuWaitTime() const = 0;
+   /// How long the GPU itself took over a recent frame, in milliseconds. Negative if the backend can't tell.
+   virtual double getGpuFrameTime() const = 0;
+
    SDL_Window*  window;
    glm::ivec2   windowDims;
+
+  protected:
+   /// Draws packet. Called on the render thread in threaded mode, so it can't touch anything the game thread does.
+   virtual void renderFrame(const FramePacket& packet) = 0;
+   /// For backends with their own packet type. Called on the game thread.
+   virtual std::unique_ptr<FramePacket> createFramePacket() { return std::make_unique<FramePacket>(); }
+   /// Game thread, just before packet is handed over, for anything the backend wants to add to every packet.
+   virtual void finishPacket(FramePacket& packet) {}
+   /// Run on the render thread as it starts and just before it stops, to move thread-bound state over.
+   virtual void onRenderThreadStart() {}
+   virtual void onRenderThreadStop() {}
+
+   bool skipStaleFrames = true;
+
+  private:
+   void renderLoop();
+   /// Game thread. Stops and joins the render thread, rethrowing whatever killed it if anything did.
+   void stopRenderThread();
+
+   TripleBuffer<std::unique_ptr<FramePacket>, true> packets;
+   bool                                             packetOpen = false;  // beginFrame() has emptied the write packet
+   uint64                                           submitted  = 0;
+
+   std::thread         renderThread;
+   std::atomic<bool>   stopping{false};
+   std::atomic<bool>   failed{false};  // The render thread threw; failure has what
+   std::exception_ptr  failure;
+   std::atomic<uint64> taken{0};  // Number of the last packet the renderer picked up
+   std::atomic<uint64> skipped{0};
+   FutexEvent          tookPacket;
 };
 
 
@@ -0,0 +1,167 @@
+#include "Serializer.hpp"
+
+#include <cstring>
+
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+namespace {
+constexpr char   Magic[8]      = {'G', 'L', 'E', 'N', 'S', 'N', 'A', 'P'};
+constexpr uint32 FormatVersion = 1;
+constexpr uint32 DeltaFlag     = 1;
+constexpr uint64 Alignment     = 64;
+
+struct FileHeader {
+   char   magic[8];
+   uint32 version, flags;
+   uint64 sequence, base;
+   uint32 columnCount, pad;
+   uint64 totalSize;
+};
+
+/// Offsets are from the start of the snapshot. 0 means the array's empty.
+struct ColumnHeader {
+   uint64 name;
+   uint32 version, elemSize;
+   uint64 count, entities, data;
+   uint64 removedCount, removed;
+};
+
+constexpr uint64 AlignUp(uint64 offset) {
+   return (offset + Alignment - 1) & ~(Alignment - 1);
+}
+}  // namespace
+
+SnapshotWriter::SnapshotWriter(uint64 sequence, Optional<uint64> base) : sequence{sequence}, base{base} {}
+
+std::vector<ubyte> SnapshotWriter::layout(std::vector<Piece>& pieces) const {
+   std::vector<ubyte> head(sizeof(FileHeader) + columns.size() * sizeof(ColumnHeader), 0);
+   uint64             offset = AlignUp(head.size());
+
+   auto place = [&](const void* data, size_t bytes) -> uint64 {
+      if (!bytes)
+         return 0;
+      uint64 at = offset;
+      pieces.push_back({data, bytes, at});
+      offset = AlignUp(offset + bytes);
+      return at;
+   };
+
+   auto* columnHeaders = reinterpret_cast<ColumnHeader*>(head.data() + sizeof(FileHeader));
+   for (size_t i = 0; i < columns.size(); i++) {
+      const auto&   column = columns[i];
+      ColumnHeader& out    = columnHeaders[i];
+
+      out.name         = column.name;
+      out.version      = column.version;
+      out.elemSize     = column.elemSize;
+      out.count        = column.count;
+      out.removedCount = column.removedCount;
+      out.entities     = place(column.entities, column.count * sizeof(uint32));
+      out.data         = column.data ? place(column.data, column.count * column.elemSize) : 0;
+      out.removed      = place(column.removed, column.removedCount * sizeof(uint32));
+   }
+
+   FileHeader header{};
+   std::memcpy(header.magic, Magic, sizeof(Magic));
+   header.version     = FormatVersion;
+   header.flags       = base ? DeltaFlag : 0;
+   header.sequence    = sequence;
+   header.base        = base.value_or(0);
+   header.columnCount = columns.size();
+   header.totalSize   = pieces.empty() ? head.size() : pieces.back().offset + pieces.back().bytes;
+   std::memcpy(head.data(), &header, sizeof(header));
+
+   return head;
+}
+
+size_t SnapshotWriter::size() const {
+   std::vector<Piece> pieces;
+   auto               head = layout(pieces);
+   return pieces.empty() ? head.size() : pieces.back().offset + pieces.back().bytes;
+}
+
+bool SnapshotWriter::write(const std::string& path) const {
+   PROFILE_FUNCTION();
+   std::vector<Piece> pieces;
+   auto               head = layout(pieces);
+
+   // Padding between arrays is left as holes, which read back as zeroes
+   return ReplaceFile(path, [&](int fd) {
+      if (!WriteAll(fd, head.data(), head.size(), 0))
+         return false;
+      for (auto& piece : pieces)
+         if (!WriteAll(fd, piece.data, piece.bytes, piece.offset))
+            return false;
+      return true;
+   });
+}
+
+void SnapshotWriter::write(std::vector<ubyte>& out) const {
+   PROFILE_FUNCTION();
+   std::vector<Piece> pieces;
+   auto               head = layout(pieces);
+
+   out.assign(pieces.empty() ? head.size() : pieces.back().offset + pieces.back().bytes, 0);
+   std::memcpy(out.data(), head.data(), head.size());
+   for (auto& piece : pieces)
+      std::memcpy(out.data() + piece.offset, piece.data, piece.bytes);
+}
+
+SnapshotView::SnapshotView(const ubyte* data, size_t size) {
+   if (!data || size < sizeof(FileHeader))
+      return;
+
+   FileHeader header;
+   std::memcpy(&header, data, sizeof(header));
+   if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0) {
+      Logger::Error("Not a snapshot");
+      return;
+   }
+   if (header.version != FormatVersion) {
+      Logger::Error("Snapshot format version ", header.version, ", we only read ", FormatVersion);
+      return;
+   }
+   if (header.totalSize > size || header.columnCount > (size - sizeof(FileHeader)) / sizeof(ColumnHeader)) {
+      Logger::Error("Snapshot is truncated");
+      return;
+   }
+
+   // Every array has to be inside the snapshot, without the size wrapping round to get there
+   auto inside = [&](uint64 offset, uint64 count, uint64 elemSize) {
+      if (!count)
+         return true;
+      return offset && elemSize <= header.totalSize / count && offset <= header.totalSize - count * elemSize;
+   };
+
+   auto columnHeaders = reinterpret_cast<const ColumnHeader*>(data + sizeof(FileHeader));
+   for (uint32 i = 0; i < header.columnCount; i++) {
+      ColumnHeader in;
+      std::memcpy(&in, &columnHeaders[i], sizeof(in));
+
+      bool hasData = in.elemSize && in.data;
+      if (!inside(in.entities, in.count, sizeof(uint32)) || (hasData && !inside(in.data, in.count, in.elemSize)) ||
+          !inside(in.removed, in.removedCount, sizeof(uint32))) {
+         Logger::Error("Snapshot column ", i, " runs off the end");
+         cols.clear();
+         return;
+      }
+
+      cols.push_back({in.name, in.version, in.elemSize, size_t(in.count),
+                      in.count ? reinterpret_cast<const uint32*>(data + in.entities) : nullptr,
+                      hasData ? data + in.data : nullptr, size_t(in.removedCount),
+                      in.removedCount ? reinterpret_cast<const uint32*>(data + in.removed) : nullptr});
+   }
+
+   seq = header.sequence;
+   if (header.flags & DeltaFlag)
+      base = header.base;
+   valid = true;
+}
+
+const SnapshotColumn* SnapshotView::find(uint64 name) const {
+   for (auto& column : cols)
+      if (column.name == name)
+         return &column;
+   return nullptr;
+}
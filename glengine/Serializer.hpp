@@ -0,0 +1,108 @@
+#pragma once
+/*
+ * Columnar binary snapshots. Knows nothing about EnTT; RegistrySnapshot.hpp is what feeds registries through it.
+ *
+ * A snapshot is a FileHeader, a ColumnHeader per column (the schema), then each column's arrays, every one 64 byte
+ * aligned. A column is one component type: which entities have it, their values packed back to back exactly as they
+ * sit in memory, and for deltas, which entities lost it. Columns are found by a hash of their name and carry a
+ * version, so a loader can tell a stale layout from a current one rather than misreading it.
+ *
+ * Everything is little-endian and values are raw bytes, so components have to be trivially copyable. In exchange,
+ * writing is a pwrite straight out of each array, and reading is a pointer into the file (mapped with SnapshotFile,
+ * or any buffer), ready to be bulk copied into wherever it's going.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FileIO.hpp"
+#include "Types.hpp"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Snapshots are written little-endian as is; a big-endian host would need to swap every column"
+#endif
+
+/// FNV-1a. Stable across compilers and runs, unlike typeid names.
+constexpr uint64 SnapshotHash(const char* name, uint64 hash = 0xcbf29ce484222325ull) {
+   return *name ? SnapshotHash(name + 1, (hash ^ uint8(*name)) * 0x100000001b3ull) : hash;
+}
+
+struct SnapshotColumn {
+   uint64        name;
+   uint32        version, elemSize;  // elemSize 0 for tags and the entity list
+   size_t        count;
+   const uint32* entities;  // count of them
+   const void*   data;      // count * elemSize bytes, or null
+   size_t        removedCount;
+   const uint32* removed;
+
+   template <typename T>
+   const T* as() const {
+      return static_cast<const T*>(data);
+   }
+};
+
+class SnapshotWriter {
+  public:
+   /// A delta applies on top of the snapshot numbered base; a full snapshot has no base.
+   explicit SnapshotWriter(uint64 sequence, Optional<uint64> base = None<uint64>());
+
+   /// Only the pointers are kept; the arrays are read at write() time, so they have to stay put until then.
+   void add(const SnapshotColumn& column) { columns.push_back(column); }
+
+   /// Through a temp file and a rename, so a crash mid-save leaves the previous file alone.
+   bool write(const std::string& path) const;
+   void write(std::vector<ubyte>& out) const;
+
+   size_t size() const;
+
+  private:
+   struct Piece {
+      const void* data;
+      size_t      bytes;
+      uint64      offset;
+   };
+
+   /// The header block and where every array goes.
+   std::vector<ubyte> layout(std::vector<Piece>& pieces) const;
+
+   uint64                      sequence;
+   Optional<uint64>            base;
+   std::vector<SnapshotColumn> columns;
+};
+
+/// Reads a snapshot in place. The buffer has to outlive the view, and be 64 byte aligned for the columns to be.
+class SnapshotView {
+  public:
+   /// Check isValid(); problems are logged.
+   SnapshotView(const ubyte* data, size_t size);
+
+   bool             isValid() const { return valid; }
+   bool             isDelta() const { return base.has_value(); }
+   uint64           sequence() const { return seq; }
+   Optional<uint64> baseSequence() const { return base; }
+
+   const std::vector<SnapshotColumn>& columns() const { return cols; }
+   /// Null if there's no column by that name.
+   const SnapshotColumn* find(uint64 name) const;
+
+  private:
+   bool                        valid = false;
+   uint64                      seq   = 0;
+   Optional<uint64>            base;
+   std::vector<SnapshotColumn> cols;
+};
+
+/// A snapshot file, mapped.
+class SnapshotFile {
+  public:
+   explicit SnapshotFile(const std::string& path) : file{path}, snapshot{file.data(), file.size()} {}
+
+   bool                isValid() const { return file.isOpen() && snapshot.isValid(); }
+   const SnapshotView& view() const { return snapshot; }
+
+  private:
+   MappedFile   file;
+   SnapshotView snapshot;
+};
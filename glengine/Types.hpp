@@ -7,7 +7,11 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include <stdint.h>
 #define STRIP_T(TYPE)        \
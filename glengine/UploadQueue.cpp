@@ -0,0 +1,328 @@
+#include "UploadQueue.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "Logger.hpp"
+#include "Profiler.hpp"
+
+namespace {
+constexpr vk::DeviceSize RingAlignment = 16;  // Comfortably over what vkCmdCopyBuffer needs
+}
+
+UploadQueue::UploadQueue(vk::Device& dev, GpuAllocator& allocator, vk::Queue transferQueue, uint32 transferFamily,
+                         uint32 graphicsFamily, vk::DeviceSize ringSize)
+    : VulkanObject(dev),
+      allocator{allocator},
+      transferQueue{transferQueue},
+      transferFamily{transferFamily},
+      graphicsFamily{graphicsFamily},
+      ringSize{ringSize} {
+   this->ring = allocator.createBuffer(ringSize, vk::BufferUsageFlagBits::eTransferSrc, MemoryUsage::Upload,
+                                       BufferFlags::Mapped);
+   this->pool = dev.createCommandPool(vk::CommandPoolCreateInfo()
+                                          .setQueueFamilyIndex(transferFamily)
+                                          .setFlags(vk::CommandPoolCreateFlagBits::eTransient |
+                                                    vk::CommandPoolCreateFlagBits::eResetCommandBuffer));
+   this->pending.ticket = this->nextTicket;
+
+   Logger::Info("Uploads go through ", isDedicated() ? "a dedicated transfer" : "the graphics", " queue family (",
+                transferFamily, ") with a ", ringSize >> 20, "MiB staging ring");
+}
+
+UploadQueue::~UploadQueue() {
+   this->inFlight.clear();
+   dev.destroyCommandPool(this->pool);
+   allocator.destroy(this->ring);
+}
+
+UploadTicket UploadQueue::upload(vk::Buffer dst, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size,
+                                 bool concurrent) {
+   PROFILE_FUNCTION();
+   // Bigger than a quarter of the ring goes in pieces, so one huge upload can't wedge itself
+   const vk::DeviceSize maxPiece = this->ringSize / 4;
+   const auto*          src      = static_cast<const ubyte*>(data);
+
+   UploadTicket ticket = 0;
+   for (vk::DeviceSize done = 0; done < size;) {
+      vk::DeviceSize piece = std::min(size - done, maxPiece);
+
+      std::unique_lock<std::mutex> guard(lock);
+      vk::DeviceSize               offset = reserve(guard, piece);
+      uint64                       start  = this->head - piece;
+      this->pending.copies.push_back({dst, vk::BufferCopy(offset, dstOffset + done, piece), concurrent, start});
+      guard.unlock();
+
+      // The copy can't be submitted until it's marked written, so there's no need to hold the lock for this
+      std::memcpy(static_cast<ubyte*>(this->ring.data()) + offset, src + done, piece);
+
+      guard.lock();
+      ticket = finishWrite(start, 1);
+      done += piece;
+   }
+
+   return ticket;
+}
+
+Optional<UploadTicket> UploadQueue::tryUpload(std::initializer_list<UploadRegion> regions) {
+   PROFILE_FUNCTION();
+   // A zero size VkBufferCopy isn't allowed, and there'd be nothing to copy anyway
+   std::vector<const UploadRegion*> nonEmpty;
+   for (const auto& region : regions)
+      if (region.size)
+         nonEmpty.push_back(&region);
+
+   std::vector<vk::DeviceSize> offsets;
+   std::vector<uint64>         starts;
+   offsets.reserve(nonEmpty.size());
+   starts.reserve(nonEmpty.size());
+
+   std::unique_lock<std::mutex> guard(lock);
+   // Nobody else can reserve while we hold the lock, so backing out is just putting head back
+   uint64 oldHead = this->head;
+   for (const auto* region : nonEmpty) {
+      auto offset = tryReserve(region->size);
+      if (!offset) {
+         this->head = oldHead;
+         return None<UploadTicket>();
+      }
+      offsets.push_back(*offset);
+      starts.push_back(this->head - region->size);
+   }
+   if (nonEmpty.empty())
+      return this->pending.ticket;
+
+   for (size_t i = 0; i < nonEmpty.size(); i++)
+      this->pending.copies.push_back({nonEmpty[i]->dst,
+                                      vk::BufferCopy(offsets[i], nonEmpty[i]->dstOffset, nonEmpty[i]->size),
+                                      nonEmpty[i]->concurrent, starts[i]});
+   guard.unlock();
+
+   for (size_t i = 0; i < nonEmpty.size(); i++)
+      std::memcpy(static_cast<ubyte*>(this->ring.data()) + offsets[i], nonEmpty[i]->data, nonEmpty[i]->size);
+
+   guard.lock();
+   // Reserved back to back, so their copies are next to each other too
+   return finishWrite(starts[0], nonEmpty.size());
+}
+
+UploadTicket UploadQueue::finishWrite(uint64 ringStart, size_t count) {
+   auto& copies = this->pending.copies;
+   auto  it     = std::lower_bound(copies.begin(), copies.end(), ringStart,
+                                   [](const Copy& copy, uint64 start) { return copy.ringStart < start; });
+   for (size_t i = 0; i < count; i++, it++)
+      it->written = true;
+   return this->pending.ticket;
+}
+
+vk::DeviceSize UploadQueue::reserve(std::unique_lock<std::mutex>& guard, vk::DeviceSize size) {
+   for (;;) {
+      if (auto offset = tryReserve(size))
+         return *offset;
+
+      PROFILE_ZONE("WaitForStagingSpace");
+      this->spaceFreed.wait(guard);
+   }
+}
+
+Optional<vk::DeviceSize> UploadQueue::tryReserve(vk::DeviceSize size) {
+   uint64 start = (this->head + RingAlignment - 1) & ~(RingAlignment - 1);
+   // Never straddle the end; skip to the start of the ring instead
+   if (start % this->ringSize + size > this->ringSize)
+      start += this->ringSize - start % this->ringSize;
+
+   if (start + size - this->tail > this->ringSize)
+      return None<vk::DeviceSize>();
+   this->head = start + size;
+   return start % this->ringSize;
+}
+
+const std::vector<vk::Semaphore>& UploadQueue::beginFrame(uint64 frame) {
+   PROFILE_FUNCTION();
+   this->frameWaits.clear();
+   this->frameAcquires.clear();
+
+   std::unique_lock<std::mutex> guard(lock);
+   // Copies someone's still halfway through memcpying stay pending for next frame; the rest go now. Their producers
+   // ask for the ticket once they're done, so they get the next one.
+   auto&  copies  = this->pending.copies;
+   size_t written = std::stable_partition(copies.begin(), copies.end(), [](const Copy& copy) { return copy.written; }) -
+                    copies.begin();
+   if (!written)
+      return this->frameWaits;
+
+   Batch batch   = std::move(this->pending);
+   this->pending = Batch();
+   this->pending.copies.assign(batch.copies.begin() + written, batch.copies.end());
+   batch.copies.resize(written);
+   // Recycling this batch mustn't hand back space that's still being written
+   batch.ringEnd        = this->pending.copies.empty() ? this->head : this->pending.copies.front().ringStart;
+   this->pending.ticket = ++this->nextTicket;
+   guard.unlock();
+
+   submit(batch);
+   batch.acquiredAt = frame;
+
+   this->frameWaits.push_back(*batch.done);
+   if (isDedicated())
+      for (auto dst : destinations(batch))
+         this->frameAcquires.push_back(vk::BufferMemoryBarrier()
+                                           .setSrcAccessMask({})
+                                           .setDstAccessMask(vk::AccessFlagBits::eIndirectCommandRead |
+                                                             vk::AccessFlagBits::eIndexRead |
+                                                             vk::AccessFlagBits::eVertexAttributeRead |
+                                                             vk::AccessFlagBits::eUniformRead |
+                                                             vk::AccessFlagBits::eShaderRead)
+                                           .setSrcQueueFamilyIndex(this->transferFamily)
+                                           .setDstQueueFamilyIndex(this->graphicsFamily)
+                                           .setBuffer(dst)
+                                           .setOffset(0)
+                                           .setSize(VK_WHOLE_SIZE));
+
+   // Whatever records this frame is ordered after the semaphore wait (and the acquires), so it's safe to draw from
+   this->readyTicket.store(batch.ticket, std::memory_order_release);
+   this->inFlight.push_back(std::move(batch));
+
+   return this->frameWaits;
+}
+
+void UploadQueue::submit(Batch& batch) {
+   PROFILE_FUNCTION();
+   auto take = [](auto& freeList, auto make) {
+      if (freeList.empty())
+         return make();
+      auto res = std::move(freeList.back());
+      freeList.pop_back();
+      return res;
+   };
+
+   batch.fence = take(this->freeFences, [&] { return dev.createFenceUnique({}); });
+   batch.done  = take(this->freeSemaphores, [&] { return dev.createSemaphoreUnique({}); });
+   batch.cmd   = take(this->freeCmds, [&] {
+      return dev.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+                                            .setCommandPool(this->pool)
+                                            .setLevel(vk::CommandBufferLevel::ePrimary)
+                                            .setCommandBufferCount(1))[0];
+   });
+
+   // One vkCmdCopyBuffer per destination, however many little uploads went into it. Its regions can't overlap.
+   trimOverlaps(batch.copies);
+   std::stable_sort(batch.copies.begin(), batch.copies.end(),
+                    [](const Copy& a, const Copy& b) { return a.dst < b.dst; });
+
+   auto& cmd = batch.cmd;
+   cmd.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+   std::vector<vk::BufferCopy> regions;
+   for (size_t i = 0; i < batch.copies.size();) {
+      auto dst = batch.copies[i].dst;
+      regions.clear();
+      for (; i < batch.copies.size() && batch.copies[i].dst == dst; i++)
+         regions.push_back(batch.copies[i].region);
+      cmd.copyBuffer(this->ring, dst, regions);
+   }
+
+   // The release half of the ownership transfer. The acquire goes in the frame's primary; see recordAcquires.
+   if (isDedicated()) {
+      std::vector<vk::BufferMemoryBarrier> releases;
+      for (auto dst : destinations(batch))
+         releases.push_back(vk::BufferMemoryBarrier()
+                                .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                                .setDstAccessMask({})
+                                .setSrcQueueFamilyIndex(this->transferFamily)
+                                .setDstQueueFamilyIndex(this->graphicsFamily)
+                                .setBuffer(dst)
+                                .setOffset(0)
+                                .setSize(VK_WHOLE_SIZE));
+      cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, nullptr,
+                          releases, nullptr);
+   }
+
+   cmd.end();
+
+   auto subInfo = vk::SubmitInfo()
+                      .setCommandBufferCount(1)
+                      .setPCommandBuffers(&cmd)
+                      .setSignalSemaphoreCount(1)
+                      .setPSignalSemaphores(&*batch.done);
+   this->transferQueue.submit(subInfo, *batch.fence);
+}
+
+void UploadQueue::recordAcquires(vk::CommandBuffer cmd) {
+   if (this->frameAcquires.empty())
+      return;
+
+   // The semaphore wait is at ConsumerStages, so starting the acquire from the top is enough
+   cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, ConsumerStages(), {}, nullptr, this->frameAcquires,
+                       nullptr);
+}
+
+void UploadQueue::collect(uint64 finishedBefore) {
+   bool freed = false;
+   while (!this->inFlight.empty()) {
+      auto& batch = this->inFlight.front();
+      if (batch.acquiredAt >= finishedBefore || dev.getFenceStatus(*batch.fence) != vk::Result::eSuccess)
+         break;
+
+      dev.resetFences(*batch.fence);
+      this->freeFences.push_back(std::move(batch.fence));
+      this->freeSemaphores.push_back(std::move(batch.done));  // Its wait is done, so it's unsignaled again
+      this->freeCmds.push_back(batch.cmd);
+
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         this->tail = batch.ringEnd;
+      }
+      this->inFlight.pop_front();
+      freed = true;
+   }
+
+   if (freed)
+      this->spaceFreed.notify_all();
+}
+
+void UploadQueue::trimOverlaps(std::vector<Copy>& copies) {
+   // Newest first, keeping only the bits nothing newer has covered. covered is start -> end, disjoint, per dst.
+   std::map<vk::Buffer, std::map<vk::DeviceSize, vk::DeviceSize>> coveredByDst;
+   std::vector<Copy>                                              kept;
+   for (auto copy = copies.rbegin(); copy != copies.rend(); copy++) {
+      auto&                covered = coveredByDst[copy->dst];
+      const vk::DeviceSize first   = copy->region.dstOffset;
+      const vk::DeviceSize last    = first + copy->region.size;
+
+      auto keep = [&](vk::DeviceSize from, vk::DeviceSize to) {
+         Copy piece = *copy;
+         piece.region.setSrcOffset(copy->region.srcOffset + (from - first)).setDstOffset(from).setSize(to - from);
+         kept.push_back(piece);
+      };
+
+      // Start from the span that could reach into [first, last), and merge everything it touches into one
+      auto it = covered.upper_bound(first);
+      if (it != covered.begin() && std::prev(it)->second > first)
+         it--;
+
+      vk::DeviceSize at = first, start = first, end = last;
+      for (; it != covered.end() && it->first < last; it = covered.erase(it)) {
+         if (it->first > at)
+            keep(at, it->first);
+         at    = std::max(at, it->second);
+         start = std::min(start, it->first);
+         end   = std::max(end, it->second);
+      }
+      if (at < last)
+         keep(at, last);
+      covered[start] = end;
+   }
+
+   copies.assign(kept.rbegin(), kept.rend());
+}
+
+std::vector<vk::Buffer> UploadQueue::destinations(const Batch& batch) {
+   // copies are sorted by dst by the time anyone asks
+   std::vector<vk::Buffer> res;
+   for (const auto& copy : batch.copies)
+      if (!copy.concurrent && (res.empty() || res.back() != copy.dst))
+         res.push_back(copy.dst);
+   return res;
+}
@@ -0,0 +1,155 @@
+#pragma once
+/*
+ * Streams data into device local buffers on the transfer queue, off the frame.
+ *
+ * Producers (any thread) memcpy into a persistently mapped staging ring and get a ticket back. Once a frame the render
+ * thread calls beginFrame(), which batches everything written since the last one into a single transfer submit that
+ * signals a semaphore. The same frame's graphics submit waits on those semaphores and recordAcquires() puts in the
+ * matching queue family ownership acquires, so the frame never waits on an upload; it just starts using the data one
+ * frame later. Staging space is handed back once both the copy and the frame that acquired it are done.
+ *
+ * Without a dedicated transfer family everything still works, it just goes through the graphics family (and there's no
+ * ownership to transfer).
+ *
+ * Ownership of an exclusive buffer is all or nothing, so only stream into exclusive buffers whose old contents don't
+ * matter. Anything that gets written piecemeal while the GPU reads the rest of it (arenas, object tables) should be
+ * created shared between families() instead, which skips the ownership transfer entirely.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+#include "VulkanBase.hpp"
+
+#include "GpuAllocator.hpp"
+#include "Types.hpp"
+
+/// 0 is "nothing to wait for". Tickets are handed out in order, so a later one being ready means an earlier one is too.
+using UploadTicket = uint64;
+
+/// One copy for tryUpload.
+struct UploadRegion {
+   UploadRegion(const VulkanBuffer& dst, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size)
+       : dst{dst.buffer}, dstOffset{dstOffset}, data{data}, size{size}, concurrent{dst.concurrent} {}
+
+   vk::Buffer     dst;
+   vk::DeviceSize dstOffset;
+   const void*    data;
+   vk::DeviceSize size;
+   bool           concurrent;
+};
+
+class UploadQueue : VulkanObject {
+  public:
+   UploadQueue(vk::Device& dev, GpuAllocator& allocator, vk::Queue transferQueue, uint32 transferFamily,
+               uint32 graphicsFamily, vk::DeviceSize ringSize = 32 * 1024 * 1024);
+   /// Only destroy once the device is idle.
+   ~UploadQueue();
+
+   UploadQueue(const UploadQueue&) = delete;
+   UploadQueue& operator=(const UploadQueue&) = delete;
+
+   /// Stages that wait on uploads before touching the data. Covers every way we read buffers.
+   static vk::PipelineStageFlags ConsumerStages() {
+      using Stage = vk::PipelineStageFlagBits;
+      return Stage::eDrawIndirect | Stage::eVertexInput | Stage::eVertexShader | Stage::eFragmentShader |
+             Stage::eComputeShader;
+   }
+
+   /// Copies data to dst + dstOffset. Thread safe. Blocks while the ring is full until the render thread frees some
+   /// space, so the render thread itself wants tryUpload instead.
+   UploadTicket upload(vk::Buffer dst, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size,
+                       bool concurrent = false);
+   UploadTicket upload(const VulkanBuffer& dst, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size) {
+      return upload(dst.buffer, dstOffset, data, size, dst.concurrent);
+   }
+
+   /// Never blocks, so it's the one for the render thread. Stages all of regions under one ticket, or none of them if
+   /// the ring can't take them all right now (it never will if they add up to more than the ring). Empty regions are
+   /// skipped.
+   Optional<UploadTicket> tryUpload(std::initializer_list<UploadRegion> regions);
+   Optional<UploadTicket> tryUpload(const VulkanBuffer& dst, vk::DeviceSize dstOffset, const void* data,
+                                    vk::DeviceSize size) {
+      return tryUpload({UploadRegion(dst, dstOffset, data, size)});
+   }
+
+   /// True once the data can be drawn with, from anything recorded in the same frame it turned true or later.
+   bool isReady(UploadTicket ticket) const { return ticket <= readyTicket.load(std::memory_order_acquire); }
+
+   /// Render thread only, once per frame before recording. Submits whatever's pending and returns the semaphores this
+   /// frame's graphics submit has to wait on (at ConsumerStages). frame is the backend's frameNumber.
+   const std::vector<vk::Semaphore>& beginFrame(uint64 frame);
+
+   /// Render thread only. Records the ownership acquires for what beginFrame submitted. Outside any render pass.
+   void recordAcquires(vk::CommandBuffer cmd);
+
+   /// Render thread only. Recycles batches whose copies are done and whose frame is older than finishedBefore,
+   /// handing their staging space back.
+   void collect(uint64 finishedBefore);
+
+   bool isDedicated() const { return transferFamily != graphicsFamily; }
+   /// For GpuAllocator::createBuffer's sharedFamilies.
+   std::vector<uint32> families() const { return {transferFamily, graphicsFamily}; }
+
+  private:
+   struct Copy {
+      vk::Buffer     dst;
+      vk::BufferCopy region;
+      bool           concurrent;       // No ownership to transfer
+      uint64         ringStart;        // Monotonic, like head. pending's copies are in this order.
+      bool           written = false;  // The producer's memcpy is done, so it can be submitted
+   };
+
+   struct Batch {
+      UploadTicket        ticket = 0;
+      std::vector<Copy>   copies;
+      uint64              ringEnd    = 0;  // Recycling the batch moves tail here
+      uint64              acquiredAt = 0;  // frame whose submit waited on it
+      vk::CommandBuffer   cmd;
+      vk::UniqueFence     fence;
+      vk::UniqueSemaphore done;
+   };
+
+   /// Reserves size bytes of the ring, waiting while it's full. Returns the offset into the ring.
+   vk::DeviceSize reserve(std::unique_lock<std::mutex>& guard, vk::DeviceSize size);
+   /// reserve without the waiting. None if it doesn't fit right now. Call with lock held.
+   Optional<vk::DeviceSize> tryReserve(vk::DeviceSize size);
+   /// Marks the count copies from ringStart on as written and returns the ticket they'll be ready under. Call with lock
+   /// held; unwritten copies never leave pending, so they're always still there.
+   UploadTicket finishWrite(uint64 ringStart, size_t count);
+   /// Records and submits the copies (and releases) for batch.
+   void submit(Batch& batch);
+   /// Trims away whatever part of each copy a later one overwrites, so no two regions of one vkCmdCopyBuffer overlap
+   /// and the newest upload wins. copies have to be in the order they were uploaded.
+   static void trimOverlaps(std::vector<Copy>& copies);
+   /// Every exclusive buffer batch writes to, once each.
+   static std::vector<vk::Buffer> destinations(const Batch& batch);
+
+   GpuAllocator& allocator;
+   vk::Queue     transferQueue;
+   uint32        transferFamily, graphicsFamily;
+
+   VulkanBuffer    ring;
+   vk::DeviceSize  ringSize;
+   vk::CommandPool pool;
+
+   // Shared with producers
+   std::mutex                lock;
+   std::condition_variable   spaceFreed;
+   Batch                     pending;
+   uint64                    head = 0, tail = 0;  // Monotonic byte counters; % ringSize for the actual offset
+   UploadTicket              nextTicket = 1;
+   std::atomic<UploadTicket> readyTicket{0};  // Everything up to here has been acquired by a frame
+
+   // Render thread only
+   std::deque<Batch>                    inFlight;  // Submitted, oldest first
+   std::vector<vk::UniqueFence>         freeFences;
+   std::vector<vk::UniqueSemaphore>     freeSemaphores;
+   std::vector<vk::CommandBuffer>       freeCmds;
+   std::vector<vk::Semaphore>           frameWaits;
+   std::vector<vk::BufferMemoryBarrier> frameAcquires;
+};
@@ -0,0 +1,270 @@
+#pragma once
+/*
+ * Vertex input state straight from the vertex struct, worked out entirely at compile time.
+ *
+ *    struct Vert {
+ *       glm::vec3             pos;
+ *       Normalized<u8vec4>    color;
+ *    };
+ *    VERTEX_LAYOUT(Vert, pos, color);
+ *
+ *    pipe.setVertexInput<Vert, PerInstance<InstanceData>>();
+ *
+ * Each type given to VertexInput gets its own binding (in order), and locations count up across all of them, so
+ * Vert::pos is location 0, Vert::color location 1, and InstanceData's first member location 2. Formats come from the
+ * member types: plain types map to the obvious float/int formats, Normalized<> picks the UNORM/SNORM one, and
+ * Packed<Format> takes whatever you give it.
+ *
+ * Things that get caught at build time: unsupported member types, a member whose size doesn't match its format,
+ * overlapping or out of order members, and members left out of the VERTEX_LAYOUT (vertex structs shouldn't have holes
+ * in them; bandwidth isn't free).
+ */
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include "VulkanBase.hpp"
+
+#include "Types.hpp"
+
+/// Fetched as floats in [0, 1] (unsigned) or [-1, 1] (signed).
+template <typename T>
+struct Normalized {
+   T value;
+};
+
+/// For the packed formats, e.g. Packed<VK_FORMAT_A2B10G10R10_UNORM_PACK32> for normals.
+template <VkFormat Format, typename Storage = uint32>
+struct Packed {
+   Storage value;
+};
+
+/// Marks a binding as advancing per instance rather than per vertex.
+template <typename T>
+struct PerInstance {};
+
+//==========================================================================
+// Member type -> format
+
+template <typename T>
+struct VertexFormat;  // Not defined for unsupported types, so using one is a compile error
+
+#define VERTEX_FORMAT(TYPE, FORMAT)             \
+   template <>                                  \
+   struct VertexFormat<TYPE> {                  \
+      static constexpr VkFormat value = FORMAT; \
+   };
+
+VERTEX_FORMAT(float, VK_FORMAT_R32_SFLOAT)
+VERTEX_FORMAT(glm::vec2, VK_FORMAT_R32G32_SFLOAT)
+VERTEX_FORMAT(glm::vec3, VK_FORMAT_R32G32B32_SFLOAT)
+VERTEX_FORMAT(glm::vec4, VK_FORMAT_R32G32B32A32_SFLOAT)
+VERTEX_FORMAT(int32, VK_FORMAT_R32_SINT)
+VERTEX_FORMAT(glm::ivec2, VK_FORMAT_R32G32_SINT)
+VERTEX_FORMAT(glm::ivec3, VK_FORMAT_R32G32B32_SINT)
+VERTEX_FORMAT(glm::ivec4, VK_FORMAT_R32G32B32A32_SINT)
+VERTEX_FORMAT(uint32, VK_FORMAT_R32_UINT)
+VERTEX_FORMAT(glm::uvec2, VK_FORMAT_R32G32_UINT)
+VERTEX_FORMAT(glm::uvec3, VK_FORMAT_R32G32B32_UINT)
+VERTEX_FORMAT(glm::uvec4, VK_FORMAT_R32G32B32A32_UINT)
+VERTEX_FORMAT(glm::u8vec2, VK_FORMAT_R8G8_UINT)
+VERTEX_FORMAT(glm::u8vec4, VK_FORMAT_R8G8B8A8_UINT)
+VERTEX_FORMAT(glm::i8vec4, VK_FORMAT_R8G8B8A8_SINT)
+VERTEX_FORMAT(glm::u16vec2, VK_FORMAT_R16G16_UINT)
+VERTEX_FORMAT(glm::u16vec4, VK_FORMAT_R16G16B16A16_UINT)
+VERTEX_FORMAT(glm::i16vec2, VK_FORMAT_R16G16_SINT)
+VERTEX_FORMAT(glm::i16vec4, VK_FORMAT_R16G16B16A16_SINT)
+VERTEX_FORMAT(Normalized<glm::u8vec2>, VK_FORMAT_R8G8_UNORM)
+VERTEX_FORMAT(Normalized<glm::u8vec4>, VK_FORMAT_R8G8B8A8_UNORM)
+VERTEX_FORMAT(Normalized<glm::i8vec4>, VK_FORMAT_R8G8B8A8_SNORM)
+VERTEX_FORMAT(Normalized<glm::u16vec2>, VK_FORMAT_R16G16_UNORM)
+VERTEX_FORMAT(Normalized<glm::u16vec4>, VK_FORMAT_R16G16B16A16_UNORM)
+VERTEX_FORMAT(Normalized<glm::i16vec2>, VK_FORMAT_R16G16_SNORM)
+VERTEX_FORMAT(Normalized<glm::i16vec4>, VK_FORMAT_R16G16B16A16_SNORM)
+
+template <VkFormat Format, typename Storage>
+struct VertexFormat<Packed<Format, Storage>> {
+   static constexpr VkFormat value = Format;
+};
+
+/// Bytes per vertex for every format above (plus the packed ones worth having). 0 for anything else.
+constexpr uint32 VertexFormatSize(VkFormat format) {
+   switch (format) {
+      case VK_FORMAT_R8G8_UINT:
+      case VK_FORMAT_R8G8_UNORM: return 2;
+      case VK_FORMAT_R32_SFLOAT:
+      case VK_FORMAT_R32_SINT:
+      case VK_FORMAT_R32_UINT:
+      case VK_FORMAT_R8G8B8A8_UINT:
+      case VK_FORMAT_R8G8B8A8_SINT:
+      case VK_FORMAT_R8G8B8A8_UNORM:
+      case VK_FORMAT_R8G8B8A8_SNORM:
+      case VK_FORMAT_R16G16_UINT:
+      case VK_FORMAT_R16G16_SINT:
+      case VK_FORMAT_R16G16_UNORM:
+      case VK_FORMAT_R16G16_SNORM:
+      case VK_FORMAT_R16G16_SFLOAT:
+      case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+      case VK_FORMAT_A2B10G10R10_SNORM_PACK32:
+      case VK_FORMAT_B10G11R11_UFLOAT_PACK32: return 4;
+      case VK_FORMAT_R32G32_SFLOAT:
+      case VK_FORMAT_R32G32_SINT:
+      case VK_FORMAT_R32G32_UINT:
+      case VK_FORMAT_R16G16B16A16_UINT:
+      case VK_FORMAT_R16G16B16A16_SINT:
+      case VK_FORMAT_R16G16B16A16_UNORM:
+      case VK_FORMAT_R16G16B16A16_SNORM:
+      case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+      case VK_FORMAT_R32G32B32_SFLOAT:
+      case VK_FORMAT_R32G32B32_SINT:
+      case VK_FORMAT_R32G32B32_UINT: return 12;
+      case VK_FORMAT_R32G32B32A32_SFLOAT:
+      case VK_FORMAT_R32G32B32A32_SINT:
+      case VK_FORMAT_R32G32B32A32_UINT: return 16;
+      default: return 0;
+   }
+}
+
+//==========================================================================
+// Per-struct layouts
+
+/// One member of a vertex struct.
+template <size_t Offset, typename Member>
+struct VertexAttr {
+   static constexpr uint32   offset = Offset;
+   static constexpr uint32   size   = sizeof(Member);
+   static constexpr VkFormat format = VertexFormat<Member>::value;
+
+   static_assert(VertexFormatSize(format) != 0, "Add the format to VertexFormatSize");
+   static_assert(VertexFormatSize(format) == size, "Member's size doesn't match its vertex format");
+};
+
+template <typename... Attrs>
+constexpr bool VertexAttrsInOrder() {
+   constexpr std::array<uint32, sizeof...(Attrs)> offsets = {Attrs::offset...}, sizes = {Attrs::size...};
+
+   uint32 end = 0;
+   for (size_t i = 0; i < sizeof...(Attrs); i++) {
+      if (offsets[i] < end)
+         return false;
+      end = offsets[i] + sizes[i];
+   }
+   return true;
+}
+
+/// What VERTEX_LAYOUT specializes VertexLayout as.
+template <typename T, typename... Attrs>
+struct VertexAttribs {
+   struct Attr {
+      uint32   offset;
+      VkFormat format;
+   };
+
+   static constexpr uint32                             stride = sizeof(T);
+   static constexpr size_t                             count  = sizeof...(Attrs);
+   static constexpr std::array<Attr, sizeof...(Attrs)> attrs  = {Attr{Attrs::offset, Attrs::format}...};
+
+   static_assert(std::is_standard_layout_v<T>, "Vertex structs need to be standard layout for offsetof");
+   static_assert(VertexAttrsInOrder<Attrs...>(), "VERTEX_LAYOUT members overlap or aren't in declaration order");
+   static_assert((Attrs::size + ... + 0) == sizeof(T),
+                 "VERTEX_LAYOUT doesn't cover the whole struct. Either a member is missing or there's padding");
+};
+
+template <typename T>
+struct VertexLayout {
+   static_assert(sizeof(T) == 0, "No VERTEX_LAYOUT for this type");
+};
+
+#define GLEN_VERTEX_ATTR(TYPE, MEMBER) VertexAttr<offsetof(TYPE, MEMBER), decltype(TYPE::MEMBER)>
+
+// FOR_EACH for up to 16 members, comma separated
+#define GLEN_FE_1(M, T, X) M(T, X)
+#define GLEN_FE_2(M, T, X, ...) M(T, X), GLEN_FE_1(M, T, __VA_ARGS__)
+#define GLEN_FE_3(M, T, X, ...) M(T, X), GLEN_FE_2(M, T, __VA_ARGS__)
+#define GLEN_FE_4(M, T, X, ...) M(T, X), GLEN_FE_3(M, T, __VA_ARGS__)
+#define GLEN_FE_5(M, T, X, ...) M(T, X), GLEN_FE_4(M, T, __VA_ARGS__)
+#define GLEN_FE_6(M, T, X, ...) M(T, X), GLEN_FE_5(M, T, __VA_ARGS__)
+#define GLEN_FE_7(M, T, X, ...) M(T, X), GLEN_FE_6(M, T, __VA_ARGS__)
+#define GLEN_FE_8(M, T, X, ...) M(T, X), GLEN_FE_7(M, T, __VA_ARGS__)
+#define GLEN_FE_9(M, T, X, ...) M(T, X), GLEN_FE_8(M, T, __VA_ARGS__)
+#define GLEN_FE_10(M, T, X, ...) M(T, X), GLEN_FE_9(M, T, __VA_ARGS__)
+#define GLEN_FE_11(M, T, X, ...) M(T, X), GLEN_FE_10(M, T, __VA_ARGS__)
+#define GLEN_FE_12(M, T, X, ...) M(T, X), GLEN_FE_11(M, T, __VA_ARGS__)
+#define GLEN_FE_13(M, T, X, ...) M(T, X), GLEN_FE_12(M, T, __VA_ARGS__)
+#define GLEN_FE_14(M, T, X, ...) M(T, X), GLEN_FE_13(M, T, __VA_ARGS__)
+#define GLEN_FE_15(M, T, X, ...) M(T, X), GLEN_FE_14(M, T, __VA_ARGS__)
+#define GLEN_FE_16(M, T, X, ...) M(T, X), GLEN_FE_15(M, T, __VA_ARGS__)
+#define GLEN_FE_PICK(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, NAME, ...) NAME
+#define GLEN_FOR_EACH(M, T, ...)                                                                                   \
+   GLEN_FE_PICK(__VA_ARGS__, GLEN_FE_16, GLEN_FE_15, GLEN_FE_14, GLEN_FE_13, GLEN_FE_12, GLEN_FE_11, GLEN_FE_10, \
+                GLEN_FE_9, GLEN_FE_8, GLEN_FE_7, GLEN_FE_6, GLEN_FE_5, GLEN_FE_4, GLEN_FE_3, GLEN_FE_2,           \
+                GLEN_FE_1)                                                                                         \
+   (M, T, __VA_ARGS__)
+
+/// List the members in declaration order. At global scope.
+#define VERTEX_LAYOUT(TYPE, ...) \
+   template <>                   \
+   struct VertexLayout<TYPE> : VertexAttribs<TYPE, GLEN_FOR_EACH(GLEN_VERTEX_ATTR, TYPE, __VA_ARGS__)> {}
+
+//==========================================================================
+// Whole vertex input state
+
+template <typename T>
+struct VertexBinding {
+   using Layout                             = VertexLayout<T>;
+   static constexpr VkVertexInputRate rate = VK_VERTEX_INPUT_RATE_VERTEX;
+};
+
+template <typename T>
+struct VertexBinding<PerInstance<T>> {
+   using Layout                             = VertexLayout<T>;
+   static constexpr VkVertexInputRate rate = VK_VERTEX_INPUT_RATE_INSTANCE;
+};
+
+/// Every binding and attribute description is a static constexpr array, so there's nothing to build at runtime and
+/// the pointers in Info stay valid forever.
+template <typename... Bindings>
+struct VertexInput {
+   static constexpr size_t BindingCount   = sizeof...(Bindings);
+   static constexpr size_t AttributeCount = (VertexBinding<Bindings>::Layout::count + ... + 0);
+
+   // 16 is the minimum every implementation has to support
+   static_assert(AttributeCount <= 16, "More vertex attributes than maxVertexInputAttributes guarantees");
+
+   static constexpr std::array<VkVertexInputBindingDescription, BindingCount> bindings = [] {
+      std::array<VkVertexInputBindingDescription, BindingCount> res{};
+      uint32 binding = 0;
+      ((res[binding] = {binding, VertexBinding<Bindings>::Layout::stride, VertexBinding<Bindings>::rate}, binding++),
+       ...);
+      return res;
+   }();
+
+   static constexpr std::array<VkVertexInputAttributeDescription, AttributeCount> attributes = [] {
+      std::array<VkVertexInputAttributeDescription, AttributeCount> res{};
+      uint32 binding = 0, location = 0;
+      [[maybe_unused]] auto add = [&](const auto& attrs) {
+         for (const auto& attr : attrs) {
+            res[location] = {location, binding, attr.format, attr.offset};
+            location++;
+         }
+         binding++;
+      };
+      (add(VertexBinding<Bindings>::Layout::attrs), ...);
+      return res;
+   }();
+
+   static constexpr VkPipelineVertexInputStateCreateInfo Info = {
+       VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+       nullptr,
+       0,
+       uint32(BindingCount),
+       BindingCount ? bindings.data() : nullptr,
+       uint32(AttributeCount),
+       AttributeCount ? attributes.data() : nullptr};
+
+   static vk::PipelineVertexInputStateCreateInfo State() { return vk::PipelineVertexInputStateCreateInfo(Info); }
+};
@@ -1,44 +1,364 @@
 #include "VulkanBackend.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <set>
 
+#include "BinLog.hpp"
 #include "Logger.hpp"
+#include "Profiler.hpp"
 
 using namespace std;
 
 VulkanBackend::~VulkanBackend() {
+   try {
+      setThreaded(false);
+   } catch (const std::exception& e) {
+      Logger::Error("Render thread died: ", e.what());
+   }
    const auto& dev = logical;
 
-   dev->destroyShaderModule(this->vert);
-   dev->destroyShaderModule(this->frag);
-
    dev->waitIdle();
-   vkDestroySwapchainKHR(*dev, this->swapchain, nullptr);
+   this->imagesInFlight.clear();
+   this->inFlightFences.clear();
+   this->imageAvailSems.clear();
+   this->renderFinishedSems.clear();
+   this->timestampPool.reset();
+
+   SDL_DelEventWatch(onWindowEvent, this);
+   collectRetired(true);
+   for (auto view : this->swapViews)
+      dev->destroyImageView(view);
+   this->swapFramebuffers.clear();
+   this->pipelineBuilder.reset();
+   this->pipe.reset();
+   this->renderPass.reset();
+   this->pipelineCache.reset();  // Saves it
+   this->recorder.reset();
+   this->indirect.reset();
+   for (auto& image : this->offscreenImages)
+      this->allocator->destroy(image);
+   this->uploads.reset();
+   this->frameRing.reset();
+   this->allocator.reset();  // Logs stats and complains about leaks
+
+   if (this->swapchain)
+      vkDestroySwapchainKHR(*dev, this->swapchain, nullptr);
    dev->destroy();
 
    this->instance->destroy();
-   SDL_DestroyWindow(window);
+   if (window)
+      SDL_DestroyWindow(window);
 }
 
 void VulkanBackend::init(const string& windowTitle, glm::ivec2 windowDims) {
-   SDL_Init(SDL_INIT_EVERYTHING);
+   PROFILE_FUNCTION();
+   auto initStart   = chrono::steady_clock::now();
    this->windowDims = windowDims;
-   window =
-       SDL_CreateWindow(windowTitle.c_str(), 0, 0, windowDims.x, windowDims.y, SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN);
-   if (!window)
-      Logger::ErrorOut("Failed to create a window: ", SDL_GetError());
+   if (this->headless) {
+      // Just the event queue, so Input (and its replays) still work with no display. windowDims is the resolution.
+      SDL_Init(SDL_INIT_EVENTS);
+      window = nullptr;
+   } else {
+      SDL_Init(SDL_INIT_EVERYTHING);
+      window = SDL_CreateWindow(windowTitle.c_str(), 0, 0, windowDims.x, windowDims.y,
+                                SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+      if (!window)
+         Logger::ErrorOut("Failed to create a window: ", SDL_GetError());
+
+      SDL_AddEventWatch(onWindowEvent, this);
+   }
 
    createInstance();
-   createSurface();
+   if (!this->headless)
+      createSurface();
    getPhysical();
    getLogical();
-   createSwapchain();
+   createAllocator();
+   createUploadQueue();
+   createFrameRing();
+   createPipelineCache();
+   if (this->headless)
+      createOffscreenTargets();
+   else
+      createSwapchain();
    createRenderPasses();
    createGraphicsPipeline();
    createFrameBuffers();
-   createCommandPools();
-   createCommandBuffs();
-   createSemaphores();
+   createCommandPools(this->framesInFlight);
+   createSyncObjects(this->framesInFlight);
+   createTimestampQueries();
+
+   // Pipelines build in the background, so their times (and the cache's part in them) get logged as they finish
+   Logger::Info("Renderer init took ", chrono::duration<double, milli>(chrono::steady_clock::now() - initStart).count(),
+                "ms (pipeline cache ", this->pipelineCache->isWarm() ? "warm" : "cold", ")");
+
+   // Temp: the vulkan-tutorial triangle
+   addRecorder([this](vk::CommandBuffer cmd) {
+      auto* pipeline = this->pipe->get();
+      if (!pipeline)
+         return;  // Still compiling
+
+      cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline->pipe);
+      cmd.setViewport(0, vk::Viewport(0.0f, 0.0f, this->swapInfo.res.width, this->swapInfo.res.height, 0.0f, 1.0f));
+      cmd.setScissor(0, vk::Rect2D({0, 0}, this->swapInfo.res));
+      cmd.draw(3, 1, 0, 0);
+   });
+}
+
+void VulkanBackend::renderFrame(const FramePacket& packet) {
+   PROFILE_FUNCTION();
+   using Clock = chrono::steady_clock;
+
+   // Don't let the CPU get more than framesInFlight frames ahead. This is also what makes it safe to reuse this
+   // frame's semaphores.
+   auto        waitStart  = Clock::now();
+   const auto& frameFence = *this->inFlightFences[currentFrame];
+   {
+      PROFILE_ZONE("WaitForFrameFence");
+      this->logical->waitForFences(frameFence, true, numeric_limits<uint64>::max());
+   }
+   readGpuTime();
+
+   // Waiting on that fence also finished off the oldest frame, which may have been the last user of something retired.
+   collectRetired();
+   this->uploads->collect(this->frameNumber + 1 >= this->framesInFlight ? this->frameNumber + 1 - this->framesInFlight
+                                                                        : 0);
+   this->frameRing->beginFrame(this->currentFrame);
+
+   // Ours, since createFramePacket() made it
+   this->currentPacket = static_cast<const VulkanFramePacket*>(&packet);
+   if (this->indirect) {
+      // Before beginFrame, so the objects they write go out this frame
+      this->indirectApplied.store(this->indirect->apply(this->currentPacket->indirectChanges),
+                                  std::memory_order_release);
+      this->indirect->setViewProj(packet.camera.proj * packet.camera.view);
+      this->indirect->beginFrame(this->currentFrame, this->frameNumber);
+   }
+   this->frameCamera   = this->frameRing->push(packet.camera);
+   this->frameUniforms = FrameAlloc();
+   if (!packet.uniforms.empty())
+      this->frameUniforms = this->frameRing->push(packet.uniforms.data(), packet.uniforms.size());
+
+   if (this->swapchainDirty && !recreateSwapchain())
+      return;  // Minimized. Nothing to draw to.
+
+   // Todo: All of this should be re-encapsulated into a vulkan backend object.
+   uint32 imageIndex = uint32(currentFrame);  // Headless, each frame in flight has its own image
+   if (!this->headless) {
+      try {
+         // eSuboptimalKHR still gives us a usable image (and signals the semaphore), so render this one and recreate
+         // after presenting.
+         auto acquired = logical->acquireNextImageKHR(swapchain, numeric_limits<uint32>::max(),
+                                                      *imageAvailSems[currentFrame], vk::Fence(nullptr));
+         imageIndex    = acquired.value;
+         if (acquired.result == vk::Result::eSuboptimalKHR)
+            this->swapchainDirty = true;
+      } catch (const vk::OutOfDateKHRError&) {
+         // Nothing was signaled and the frame fence is still signaled, so we can just skip this frame.
+         recreateSwapchain();
+         return;
+      }
+   }
+
+   // With more swap images than frames in flight (or an out-of-order acquire), the image we just got may still be
+   // in use by an older frame.
+   if (this->imagesInFlight[imageIndex] && this->imagesInFlight[imageIndex] != frameFence) {
+      PROFILE_ZONE("WaitForImageFence");
+      this->logical->waitForFences(this->imagesInFlight[imageIndex], true, numeric_limits<uint64>::max());
+   }
+   this->imagesInFlight[imageIndex] = frameFence;
+
+   this->gpuWaitMs = chrono::duration<double, milli>(Clock::now() - waitStart).count();
+
+   // Submitted before recording so anything recorded this frame can already see the uploads as ready.
+   const auto& uploadWaits = this->uploads->beginFrame(this->frameNumber);
+
+   // Only now we know the frame's going ahead, or a skipped frame's draws would turn up twice in the next one.
+   this->renderQueue.submit(this->currentPacket->draws.data(), this->currentPacket->draws.size());
+
+   // Both fences are done, so this frame's pools are free to recycle.
+   recordFrame(imageIndex);
+   vk::CommandBuffer primary = this->recorder->primary();
+
+   // Headless, there's no acquire to wait for and no present to signal
+   vector<vk::Semaphore>          waitSemaphores;
+   vector<vk::PipelineStageFlags> waitStages;
+   if (!this->headless) {
+      waitSemaphores.push_back(*imageAvailSems[currentFrame]);
+      waitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+   }
+   for (auto sem : uploadWaits) {
+      waitSemaphores.push_back(sem);
+      waitStages.push_back(UploadQueue::ConsumerStages());
+   }
+
+   vk::Semaphore signalSemaphores[] = {*renderFinishedSems[currentFrame]};
+
+
+   auto subInfo = vk::SubmitInfo()
+                      .setWaitSemaphoreCount(waitSemaphores.size())
+                      .setPWaitSemaphores(waitSemaphores.data())
+                      .setPWaitDstStageMask(waitStages.data())
+                      .setCommandBufferCount(1)
+                      .setPCommandBuffers(&primary)
+                      .setSignalSemaphoreCount(this->headless ? 0 : 1)
+                      .setPSignalSemaphores(signalSemaphores);
+
+   this->logical->resetFences(frameFence);
+   graphicsQueue.submit(subInfo, frameFence);
+   this->timestampsPending[currentFrame] = bool(this->timestampPool);
+
+   if (!this->headless) {
+      vk::SwapchainKHR swapchains[] = {swapchain};
+
+      auto presentInfo = vk::PresentInfoKHR()
+                             .setWaitSemaphoreCount(1)
+                             .setPWaitSemaphores(signalSemaphores)
+                             .setSwapchainCount(1)
+                             .setPSwapchains(swapchains)
+                             .setPImageIndices(&imageIndex)
+                             .setPResults(nullptr);
+      try {
+         if (presentQueue.presentKHR(presentInfo) == vk::Result::eSuboptimalKHR)
+            this->swapchainDirty = true;
+      } catch (const vk::OutOfDateKHRError&) {
+         this->swapchainDirty = true;
+      }
+   }
+
+   currentFrame = (currentFrame + 1) % framesInFlight;
+   frameNumber++;
+   this->currentPacket = nullptr;
+}
+
+void VulkanBackend::finishPacket(FramePacket& base) {
+   auto& packet = static_cast<VulkanFramePacket&>(base);
+   if (packet.indirectChanges.empty() && this->indirectUnapplied.empty())
+      return;
+   if (!this->indirect) {
+      Logger::Error("Indirect meshes sent without enableIndirect(); they're dropped");
+      packet.indirectChanges.clear();
+      return;
+   }
+
+   uint64 applied = this->indirectApplied.load(std::memory_order_acquire);
+   auto&  log     = this->indirectUnapplied;
+   auto   newer   = std::find_if(log.begin(), log.end(), [&](const auto& change) { return change.seq > applied; });
+   log.erase(log.begin(), newer);
+   for (auto& change : packet.indirectChanges) {
+      change.seq = ++this->indirectSeq;
+      log.push_back(change);
+   }
+   packet.indirectChanges = log;
+}
+
+void VulkanBackend::onRenderThreadStart() {
+   // Recording's a short burst once a frame, and the game's still got Main()'s workers busy, so half as many is plenty.
+   // The old pools may still be in use by frames in flight.
+   this->renderJobs = std::make_unique<JobSystem>(max<size_t>(1, JobSystem::Main().workerCount() / 2));
+   this->logical->waitIdle();
+   createCommandPools(this->framesInFlight);
+}
+
+void VulkanBackend::onRenderThreadStop() {
+   // renderJobs has to go on the thread that made it, even if the device is lost. The recorder isn't used again before
+   // it's replaced.
+   this->renderJobs.reset();
+   this->logical->waitIdle();
+   createCommandPools(this->framesInFlight);
+}
+
+int VulkanBackend::onWindowEvent(void* self, SDL_Event* event) {
+   auto* backend = static_cast<VulkanBackend*>(self);
+   if (event->type == SDL_WINDOWEVENT && SDL_GetWindowFromID(event->window.windowID) == backend->window &&
+       (event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED || event->window.event == SDL_WINDOWEVENT_RESTORED))
+      backend->swapchainDirty = true;
+
+   return 0;
+}
+
+bool VulkanBackend::recreateSwapchain() {
+   PROFILE_FUNCTION();
+
+   int width, height;
+   SDL_Vulkan_GetDrawableSize(window, &width, &height);
+   if (width == 0 || height == 0)
+      return false;  // Stay dirty; we'll try again once we're visible.
+
+   this->windowDims     = {width, height};
+   this->swapchainDirty = false;
+
+   auto oldFormat = this->swapInfo.format;
+   this->retiredSwapchains.push_back(
+       {this->frameNumber, this->swapchain, move(this->swapViews), move(this->swapFramebuffers)});
+   this->swapViews.clear();
+   this->swapFramebuffers.clear();
+
+   createSwapchain(this->swapchain);
+   // Todo: The render pass (and so the pipeline) bakes in the format. Rebuild them if this ever actually happens.
+   if (this->swapInfo.format != oldFormat)
+      Logger::Error("Swapchain format changed on recreation. The render pass is now incompatible!");
+
+   createFrameBuffers();
+   this->imagesInFlight.assign(this->swapImages.size(), vk::Fence(nullptr));
+
+   // Once per frame while a window's being dragged around
+   if (BinLog::IsOpen())
+      BINLOG("INFO", "Recreated swapchain at {}x{}", this->swapInfo.res.width, this->swapInfo.res.height);
+   else
+      Logger::Info("Recreated swapchain at ", this->swapInfo.res.width, "x", this->swapInfo.res.height);
+   return true;
+}
+
+void VulkanBackend::collectRetired(bool force) {
+   // Every renderFrame waits on the fence from framesInFlight frames ago, so once that many more frames have started,
+   // everything submitted before the swap is done.
+   while (!this->retiredSwapchains.empty() &&
+          (force || this->frameNumber >= this->retiredSwapchains.front().retiredAt + this->framesInFlight)) {
+      auto& old = this->retiredSwapchains.front();
+
+      old.framebuffers.clear();
+      for (auto view : old.views)
+         this->logical->destroyImageView(view);
+      this->logical->destroySwapchainKHR(old.swapchain);
+
+      this->retiredSwapchains.pop_front();
+   }
+}
+
+void VulkanBackend::setFramesInFlight(size_t frames) {
+   frames = clamp<size_t>(frames, 1, MaxFramesInFlight);
+   if (frames == this->framesInFlight)
+      return;
+
+   // Not init()ed yet. createSyncObjects will pick the new count up.
+   if (!this->logical) {
+      this->framesInFlight = frames;
+      return;
+   }
+
+   // Rare enough (settings menu, startup config) that idling is fine. The render thread reads framesInFlight and
+   // indexes all of this every frame, so park it before touching any of it. If it had died, that rethrows here with
+   // nothing changed yet.
+   bool threaded = isThreaded();
+   setThreaded(false, this->skipStaleFrames);
+   this->logical->waitIdle();
+   collectRetired(true);
+
+   // createSyncObjects swaps everything in at once or not at all, so only the recorder needs putting back
+   auto oldRecorder = std::move(this->recorder);
+   try {
+      createCommandPools(frames);
+      createSyncObjects(frames);
+   } catch (...) {
+      this->recorder = std::move(oldRecorder);
+      setThreaded(threaded, this->skipStaleFrames);
+      throw;
+   }
+   this->framesInFlight = frames;
+   setThreaded(threaded, this->skipStaleFrames);
+   Logger::Info("Now running ", frames, " frames in flight");
 }
 
 
@@ -46,11 +366,16 @@ VkBool32 VulkanBackend::debugCallback(VkDebugReportFlagsEXT flags, VkDebugReport
                                       size_t location, int32_t code, const char* layerPrefix, const char* msg,
                                       void* userData) {
    // if (!(flags & VK_DEBUG_REPORT_INFORMATION_BIT_EXT))
-   Logger::Write("VULKAN", layerPrefix, " said: ", msg);
+   // Validation can fire on every draw, so when there's a binlog it goes there instead of being formatted here
+   if (BinLog::IsOpen())
+      BINLOG("VULKAN", "{} said: {}", layerPrefix, msg);
+   else
+      Logger::Write("VULKAN", layerPrefix, " said: ", msg);
    return true;
 }
 
 void VulkanBackend::createInstance() {
+   PROFILE_FUNCTION();
    Logger::Info("Creating instance...");
    auto appInfo = vk::ApplicationInfo()
                       .setApplicationVersion(1)
@@ -58,14 +383,19 @@ void VulkanBackend::createInstance() {
                       .setPEngineName("GLENgine")
                       .setApiVersion(VK_API_VERSION_1_1);
 
-   // Get required instance extensions
-   uint32_t count = 0;
-   SDL_Vulkan_GetInstanceExtensions(window, &count, nullptr);
-   vector<const char*> extensions(count);
-   SDL_Vulkan_GetInstanceExtensions(window, &count, &extensions[0]);
+   // Get required instance extensions. Headless, there's no surface so it doesn't need any.
+   vector<const char*> extensions;
+   if (window) {
+      uint32_t count = 0;
+      SDL_Vulkan_GetInstanceExtensions(window, &count, nullptr);
+      extensions.resize(count);
+      SDL_Vulkan_GetInstanceExtensions(window, &count, extensions.data());
+   }
 
-   // Enable debug reporting
-   extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+   // Enable debug reporting, if anything offers it. Software implementations don't always.
+   for (const auto& ext : vk::enumerateInstanceExtensionProperties())
+      if (string(ext.extensionName) == VK_EXT_DEBUG_REPORT_EXTENSION_NAME)
+         extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 
    auto createInfo = vk::InstanceCreateInfo()
                          .setPApplicationInfo(&appInfo)
@@ -102,6 +432,7 @@ void VulkanBackend::setupDebugCallback() {
 
 
 void VulkanBackend::createSurface() {
+   PROFILE_FUNCTION();
    VkSurfaceKHR surface;
    if (!SDL_Vulkan_CreateSurface(window, this->instance.get(), &surface))
       Logger::ErrorOut("Failed to create vulkan surface!");
@@ -111,16 +442,12 @@ void VulkanBackend::createSurface() {
 
 
 bool VulkanBackend::isDeviceSuitable(const vk::PhysicalDevice& dev, const vk::SurfaceKHR& surface) {
-   vk::PhysicalDeviceProperties props;
-   vk::PhysicalDeviceFeatures   features;
+   // Any type of device will do, CPU ones (lavapipe, SwiftShader) included; getPhysical() prefers real GPUs. Nothing
+   // uses geometry shaders, so they aren't asked for.
+   bool suitable = getQueueFamilyIndices(dev, surface).isComplete();
 
-   dev.getProperties(&props);
-   dev.getFeatures(&features);
 
-   bool suitable = features.geometryShader && (props.deviceType == vk::PhysicalDeviceType::eDiscreteGpu);
-
-
-   if (suitable) {
+   if (suitable && surface) {
       // Avoid querying anything else if we're already false.
 
       SwapchainSupportInfo swapInfo;
@@ -130,8 +457,6 @@ bool VulkanBackend::isDeviceSuitable(const vk::PhysicalDevice& dev, const vk::Su
       swapInfo.modes   = dev.getSurfacePresentModesKHR(surface);
 
       suitable = suitable && !swapInfo.formats.empty() && !swapInfo.modes.empty();
-
-      suitable = suitable && getQueueFamilyIndices(dev, surface).isComplete();
    }
 
    return suitable;
@@ -180,7 +505,19 @@ vk::Extent2D VulkanBackend::chooseResolution(const vk::SurfaceCapabilitiesKHR& c
    }
 }
 
+/// Higher is better. Real GPUs first, then whatever else can do the job.
+static int DeviceRank(vk::PhysicalDeviceType type) {
+   switch (type) {
+      case vk::PhysicalDeviceType::eDiscreteGpu: return 4;
+      case vk::PhysicalDeviceType::eIntegratedGpu: return 3;
+      case vk::PhysicalDeviceType::eVirtualGpu: return 2;
+      case vk::PhysicalDeviceType::eCpu: return 1;
+      default: return 0;
+   }
+}
+
 void VulkanBackend::getPhysical() {
+   PROFILE_FUNCTION();
    Logger::Info("Getting Physical Device...");
 
    // At the moment I only have 1 physical device, so this is rather useless, but whatever.
@@ -190,13 +527,19 @@ void VulkanBackend::getPhysical() {
       Logger::ErrorOut("Failed to enumerate physical devices!");
 
    vector<vk::PhysicalDevice> physDevices(count);
-   this->instance->enumeratePhysicalDevices(&count, &physDevices[0]);
+   this->instance->enumeratePhysicalDevices(&count, physDevices.data());
+   int bestRank = -1;
    for (auto& dev : physDevices) {
-      if (isDeviceSuitable(dev, this->surface.get())) {
+      int rank = DeviceRank(dev.getProperties().deviceType);
+      if (rank > bestRank && isDeviceSuitable(dev, this->surface.get())) {
          this->physical = dev;
-         break;
+         bestRank       = rank;
       }
    }
+
+   if (!this->physical)
+      Logger::ErrorOut("No suitable Vulkan device!");
+   Logger::Info("Using ", static_cast<const char*>(this->physical.getProperties().deviceName));
 }
 
 QueueIndices VulkanBackend::getQueueFamilyIndices(const vk::PhysicalDevice& physical, const vk::SurfaceKHR& surface) {
@@ -207,24 +550,40 @@ QueueIndices VulkanBackend::getQueueFamilyIndices(const vk::PhysicalDevice& phys
       if (qFamilyProps[i].queueCount > 0 && (qFamilyProps[i].queueFlags & vk::QueueFlagBits::eGraphics))
          result.graphics = i;
 
-      if (qFamilyProps[i].queueCount > 0 && physical.getSurfaceSupportKHR(i, surface))
+      // Headless there's nothing to present to, so graphics stands in
+      bool presents = surface ? physical.getSurfaceSupportKHR(i, surface) : result.graphics == i;
+      if (qFamilyProps[i].queueCount > 0 && presents)
          result.present = i;
 
       if (result.isComplete())
          break;
    }
 
+   // Transfer-only families are the DMA engines. Anything that can do graphics can transfer too, so fall back on that.
+   result.transfer = result.graphics;
+   for (int i = 0; i < qFamilyProps.size(); i++) {
+      auto flags = qFamilyProps[i].queueFlags;
+      if (qFamilyProps[i].queueCount > 0 && (flags & vk::QueueFlagBits::eTransfer) &&
+          !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))) {
+         result.transfer = i;
+         break;
+      }
+   }
+
    return result;
 }
 
 void VulkanBackend::getExtensions() {
    // Logger::Info("Getting Extensions");
-   auto                extensions = this->physical.enumerateDeviceExtensionProperties();
-   vector<const char*> desired    = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+   auto extensions = this->physical.enumerateDeviceExtensionProperties();
+   // Everything but the swapchain is optional; check hasExtension before relying on one. Headless, even that is.
+   vector<const char*> desired = {"VK_KHR_draw_indirect_count"};
+   if (!this->headless)
+      desired.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
    for (auto& ext : extensions) {
       for (auto& desiredExt : desired)
          if (string(ext.extensionName) == desiredExt) {
-            this->deviceExtensions.push_back(ext.extensionName);
+            this->deviceExtensions.push_back(desiredExt);  // Not ext's name; extensions is gone once we return
             // Logger::Info("Added extension: ", ext.extensionName);
             break;
          }
@@ -248,6 +607,7 @@ void VulkanBackend::getLayers() {
 }
 
 void VulkanBackend::getLogical() {
+   PROFILE_FUNCTION();
    Logger::Info("Creating Logical Device...");
    getExtensions();
    getLayers();
@@ -256,9 +616,13 @@ void VulkanBackend::getLogical() {
    // By the time we're here, we have finalized our physical device, so cache the indices.
    this->queueIndices = getQueueFamilyIndices(this->physical, this->surface.get());
 
-   vk::PhysicalDeviceFeatures deviceFeatures;
+   // Only what we use, and only if it's there. GPU-driven drawing wants the indirect ones.
+   auto supported = this->physical.getFeatures();
+   this->enabledFeatures.setMultiDrawIndirect(supported.multiDrawIndirect)
+       .setDrawIndirectFirstInstance(supported.drawIndirectFirstInstance);
 
-   set<int>                          queueFamilies = {this->queueIndices.present, this->queueIndices.graphics};
+   set<int>                          queueFamilies = {this->queueIndices.present, this->queueIndices.graphics,
+                                                      this->queueIndices.transfer};
    vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
 
    float qPriority = 1.0f;
@@ -275,16 +639,61 @@ void VulkanBackend::getLogical() {
                           //.setPpEnabledLayerNames(this->deviceLayers.data())
                           .setPQueueCreateInfos(queueCreateInfos.data())
                           .setQueueCreateInfoCount(queueCreateInfos.size())
-                          .setPEnabledFeatures(&deviceFeatures);
+                          .setPEnabledFeatures(&this->enabledFeatures);
 
    this->logical = vk::UniqueDevice(this->physical.createDevice(logicalInfo));
 
 
    this->graphicsQueue = this->logical->getQueue(this->queueIndices.graphics, 0);
    this->presentQueue  = this->logical->getQueue(this->queueIndices.present, 0);
+   this->transferQueue = this->logical->getQueue(this->queueIndices.transfer, 0);
+}
+
+void VulkanBackend::createAllocator() {
+   PROFILE_FUNCTION();
+   this->allocator = std::make_unique<GpuAllocator>(*this->logical, this->physical);
 }
 
-void VulkanBackend::createSwapchain() {
+void VulkanBackend::createUploadQueue() {
+   PROFILE_FUNCTION();
+   this->uploads = std::make_unique<UploadQueue>(*this->logical, *this->allocator, this->transferQueue,
+                                                 this->queueIndices.transfer, this->queueIndices.graphics);
+}
+
+void VulkanBackend::createFrameRing() {
+   PROFILE_FUNCTION();
+   // One segment per possible frame in flight, so changing framesInFlight never has to touch it
+   this->frameRing = std::make_unique<FrameRing>(*this->logical, *this->allocator, this->physical, MaxFramesInFlight);
+}
+
+IndirectRenderer& VulkanBackend::enableIndirect(const IndirectRenderer::Config& config) {
+   if (this->indirect)
+      return *this->indirect;
+
+   if (!this->enabledFeatures.drawIndirectFirstInstance)
+      Logger::Error("No drawIndirectFirstInstance, so gl_InstanceIndex won't find per-object data");
+
+   IndirectRenderer::Features features;
+   features.drawIndirectCount = hasExtension("VK_KHR_draw_indirect_count");
+   features.multiDrawIndirect = this->enabledFeatures.multiDrawIndirect;
+
+   this->indirect = std::make_unique<IndirectRenderer>(*this->logical, *this->allocator, *this->uploads,
+                                                       *this->pipelineCache, config, features, MaxFramesInFlight);
+   addPrePass([this](vk::CommandBuffer cmd) { this->indirect->recordCull(cmd, this->currentFrame); });
+   addRecorder([this](vk::CommandBuffer cmd) {
+      this->indirect->recordDraw(cmd, this->currentFrame, this->swapInfo.res);
+   });
+
+   return *this->indirect;
+}
+
+void VulkanBackend::createPipelineCache() {
+   PROFILE_FUNCTION();
+   this->pipelineCache = std::make_unique<PipelineCache>(*this->logical, this->physical, this->pipelineCachePath);
+}
+
+void VulkanBackend::createSwapchain(vk::SwapchainKHR oldSwapchain) {
+   PROFILE_FUNCTION();
    Logger::Info("Creating Swapchain");
    SwapchainSupportInfo info = {this->physical.getSurfaceCapabilitiesKHR(*this->surface),
                                 this->physical.getSurfaceFormatsKHR(*this->surface),
@@ -310,7 +719,7 @@ void VulkanBackend::createSwapchain() {
                              .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
                              .setPresentMode(presentMode)
                              .setClipped(true)
-                             .setOldSwapchain(vk::SwapchainKHR(nullptr))
+                             .setOldSwapchain(oldSwapchain)
                              .setSurface(*this->surface);
 
 
@@ -328,7 +737,36 @@ void VulkanBackend::createSwapchain() {
 
    this->swapchain  = this->logical->createSwapchainKHR(swapCreateInfo);
    this->swapImages = this->logical->getSwapchainImagesKHR(this->swapchain);
+   createSwapViews();
+}
 
+void VulkanBackend::createOffscreenTargets() {
+   PROFILE_FUNCTION();
+   Logger::Info("Creating offscreen targets");
+   this->swapInfo = {{vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear},
+                     vk::Extent2D(uint32(windowDims.x), uint32(windowDims.y))};
+
+   auto imageInfo = vk::ImageCreateInfo()
+                        .setImageType(vk::ImageType::e2D)
+                        .setFormat(this->swapInfo.format.format)
+                        .setExtent(vk::Extent3D(this->swapInfo.res.width, this->swapInfo.res.height, 1))
+                        .setMipLevels(1)
+                        .setArrayLayers(1)
+                        .setSamples(vk::SampleCountFlagBits::e1)
+                        .setTiling(vk::ImageTiling::eOptimal)
+                        .setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc)
+                        .setSharingMode(vk::SharingMode::eExclusive)
+                        .setInitialLayout(vk::ImageLayout::eUndefined);
+
+   // Enough for any framesInFlight, so changing it never has to touch these
+   for (size_t i = 0; i < MaxFramesInFlight; i++) {
+      this->offscreenImages.push_back(this->allocator->createImage(imageInfo));
+      this->swapImages.push_back(this->offscreenImages.back().image);
+   }
+   createSwapViews();
+}
+
+void VulkanBackend::createSwapViews() {
    for (const auto& image : this->swapImages) {
       // Method chaining factories are truly beautiful.
       //... or perhaps terrible, I can't tell which yet.
@@ -353,6 +791,7 @@ void VulkanBackend::createSwapchain() {
 }
 
 void VulkanBackend::createRenderPasses() {
+   PROFILE_FUNCTION();
    auto colorAttachDesc = vk::AttachmentDescription()
                               .setFormat(this->swapInfo.format.format)
                               .setSamples(vk::SampleCountFlagBits::e1)
@@ -361,7 +800,8 @@ void VulkanBackend::createRenderPasses() {
                               .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
                               .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
                               .setInitialLayout(vk::ImageLayout::eUndefined)
-                              .setFinalLayout(vk::ImageLayout::ePresentSrcKHR);
+                              .setFinalLayout(this->headless ? vk::ImageLayout::eTransferSrcOptimal
+                                                             : vk::ImageLayout::ePresentSrcKHR);
 
 
    // Todo: Factorize this
@@ -381,75 +821,72 @@ void VulkanBackend::createRenderPasses() {
            .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite);
 
 
-   this->pipe             = std::make_shared<GraphicsPipeline>(*this->logical);
-   this->pipe->renderPass = std::make_shared<RenderPass>(*this->logical);
-   this->pipe->renderPass->addPass(subpass).addDep(dep).addAttachment(colorAttachDesc).build();
+   this->renderPass = std::make_shared<RenderPass>(*this->logical);
+   this->renderPass->addPass(subpass).addDep(dep).addAttachment(colorAttachDesc).build();
 }
 
 void VulkanBackend::createGraphicsPipeline() {
-   auto vertSrc = LoadFile("vert.spv");
-   auto fragSrc = LoadFile("frag.spv");
-
-   // Todo: Factorize these too
-   this->vert = Shader::FromSrc(vertSrc, Shader::Stage::Vertex, *this->logical);
-   this->frag = Shader::FromSrc(fragSrc, Shader::Stage::Fragment, *this->logical);
-
-   this->pipe->addStages(this->vert, this->frag);
-
-
-   // Todo: Find a way to force clang-format to put this stuff on multiple lines, like a sane person.
-   auto vertPipelineInfo =
-       vk::PipelineVertexInputStateCreateInfo().setVertexBindingDescriptionCount(0).setVertexAttributeDescriptionCount(
-           0);
-
-   this->pipe->vertInputState = vertPipelineInfo;
-
-   auto inputAsmInfo = vk::PipelineInputAssemblyStateCreateInfo()
-                           .setTopology(vk::PrimitiveTopology::eTriangleList)
-                           .setPrimitiveRestartEnable(false);
-
-   this->pipe->setTopology(Topology::Triangles);
-
-   auto viewport = vk::Viewport()
-                       .setX(0.0f)
-                       .setY(0.0f)
-                       .setHeight(this->swapInfo.res.height)
-                       .setWidth(this->swapInfo.res.width)
-                       .setMinDepth(0.0f)
-                       .setMaxDepth(1.0f);
-
-
-   auto scissor = vk::Rect2D().setOffset({0, 0}).setExtent(this->swapInfo.res);
-
-   this->pipe->addViewport(viewport, scissor);
-
-   this->pipe->setEnableDepthClamp(false)
-       .setFillMode(FillMode::Fill)
-       .setLineWidth(1.0f)
-       .setCullMode(vk::CullModeFlagBits::eBack)
-       .setFrontFaceRule(FrontFaceRule::LeftHand)
-       .withDepthBias(None<DepthBias>());
-
-   this->pipe->setMSAA(2);
-
-   auto colorBlendState = vk::PipelineColorBlendAttachmentState()
-                              .setColorWriteMask(vk::ColorComponentFlagBits::eA | vk::ColorComponentFlagBits::eB |
-                                                 vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eR)
-                              .setBlendEnable(false);
-
-   this->pipe->addColorBlendAttachments(colorBlendState).setColorBlendOp(None<LogicOp>());
+   PROFILE_FUNCTION();
+   this->pipelineBuilder = std::make_unique<AsyncPipelineBuilder>(*this->logical, *this->pipelineCache,
+                                                                  this->pipelineCache->isWarm());
+
+   PipelineDesc desc;
+   desc.vertPath   = "vert.spv";
+   desc.fragPath   = "frag.spv";
+   desc.renderPass = this->renderPass;
+
+   // Runs on a builder thread, so take copies of anything from the backend.
+   desc.configure = [res = this->swapInfo.res](GraphicsPipeline& pipe) {
+      // The triangle's verts are baked into the shader
+      pipe.setVertexInput<>().setTopology(Topology::Triangles);
+
+      auto viewport = vk::Viewport()
+                          .setX(0.0f)
+                          .setY(0.0f)
+                          .setHeight(res.height)
+                          .setWidth(res.width)
+                          .setMinDepth(0.0f)
+                          .setMaxDepth(1.0f);
+
+      auto scissor = vk::Rect2D().setOffset({0, 0}).setExtent(res);
+
+      // Only a placeholder. Viewport and scissor are dynamic so a resize doesn't mean a new pipeline.
+      pipe.addViewport(viewport, scissor).addDynamicStates(vk::DynamicState::eViewport, vk::DynamicState::eScissor);
+
+      pipe.setEnableDepthClamp(false)
+          .setFillMode(FillMode::Fill)
+          .setLineWidth(1.0f)
+          .setCullMode(vk::CullModeFlagBits::eBack)
+          .setFrontFaceRule(FrontFaceRule::LeftHand)
+          .withDepthBias(None<DepthBias>());
+
+      pipe.setMSAA(1);  // Has to match the render pass' attachment
+
+      auto colorBlendState = vk::PipelineColorBlendAttachmentState()
+                                 .setColorWriteMask(vk::ColorComponentFlagBits::eA | vk::ColorComponentFlagBits::eB |
+                                                    vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eR)
+                                 .setBlendEnable(false);
+
+      pipe.addColorBlendAttachments(colorBlendState).setColorBlendOp(None<LogicOp>());
+   };
+
+   // Nothing waits on this. The triangle just doesn't draw until it's ready.
+   this->pipe = buildPipelineAsync(desc);
+}
 
-   this->pipe->build();
+std::shared_ptr<PipelineHandle> VulkanBackend::buildPipelineAsync(const PipelineDesc& desc) {
+   return this->pipelineBuilder->build(desc);
 }
 
 void VulkanBackend::createFrameBuffers() {
+   PROFILE_FUNCTION();
    this->swapFramebuffers.resize(this->swapViews.size());
 
    for (auto i = 0; i < this->swapViews.size(); i++) {
       vk::ImageView attachments[] = {this->swapViews[i]};
 
       auto frameBuffInfo = vk::FramebufferCreateInfo()
-                               .setRenderPass(*this->pipe->renderPass)
+                               .setRenderPass(*this->renderPass)
                                .setAttachmentCount(1)
                                .setPAttachments(attachments)
                                .setWidth(this->swapInfo.res.width)
@@ -459,50 +896,114 @@ void VulkanBackend::createFrameBuffers() {
    }
 }
 
-void VulkanBackend::createCommandPools() {
-   auto poolInfo = vk::CommandPoolCreateInfo()
-                       .setQueueFamilyIndex(getQueueFamilyIndices(this->physical, *this->surface).graphics)
-                       .setFlags(vk::CommandPoolCreateFlagBits(0));
-
-   this->commandPool = this->logical->createCommandPoolUnique(poolInfo);
+void VulkanBackend::createCommandPools(size_t frames) {
+   PROFILE_FUNCTION();
+   this->recorder = std::make_unique<CommandRecorder>(*this->logical, this->queueIndices.graphics, frames,
+                                                      this->renderJobs ? *this->renderJobs : JobSystem::Main());
+   Logger::Info("Recording commands on ", this->recorder->workerCount(), " threads");
 }
 
-void VulkanBackend::createCommandBuffs() {
-   auto allocInfo = vk::CommandBufferAllocateInfo()
-                        .setCommandPool(*this->commandPool)
-                        .setLevel(vk::CommandBufferLevel::ePrimary)
-                        .setCommandBufferCount(this->swapFramebuffers.size());
-
-   this->cmdBuffs = this->logical->allocateCommandBuffers(allocInfo);
+void VulkanBackend::addRecorder(const CommandRecorder::RecordFunc& func) { this->recorders.push_back(func); }
+
+void VulkanBackend::recordFrame(uint32 imageIndex) {
+   PROFILE_FUNCTION();
+   this->recorder->beginFrame(this->currentFrame);
+
+   auto inherit = vk::CommandBufferInheritanceInfo()
+                      .setRenderPass(*this->renderPass)
+                      .setSubpass(0)
+                      .setFramebuffer(*this->swapFramebuffers[imageIndex]);
+
+   // The sorted queue gets cut into contiguous runs, one per worker. Each run costs a full set of binds, so don't
+   // bother splitting small queues.
+   static constexpr size_t MinDrawsPerRun = 256;
+
+   this->renderQueue.sort();
+   size_t workers = this->recorder->workerCount();
+   size_t perRun  = max(MinDrawsPerRun, (this->renderQueue.size() + workers - 1) / workers);
+   auto   funcs   = this->recorders;
+   for (size_t begin = 0; begin < this->renderQueue.size(); begin += perRun)
+      funcs.push_back([this, begin, end = begin + perRun](vk::CommandBuffer cmd) {
+         this->renderQueue.record(cmd, begin, end, this->swapInfo.res);
+      });
+
+   const auto& secondaries = this->recorder->record(funcs, inherit);
+   this->renderQueue.clear();  // Everything's recorded, so the packets aren't needed any more
+
+   auto cmd = this->recorder->primary();
+   cmd.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+   uint32 firstQuery = uint32(this->currentFrame * 2);
+   if (this->timestampPool) {
+      cmd.resetQueryPool(*this->timestampPool, firstQuery, 2);
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *this->timestampPool, firstQuery);
+   }
+   this->uploads->recordAcquires(cmd);
+   for (const auto& prePass : this->prePasses)
+      prePass(cmd);
+
+   this->clearColor.setColor(array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f});
+   cmd.beginRenderPass(vk::RenderPassBeginInfo()
+                           .setRenderPass(*this->renderPass)
+                           .setRenderArea({{0, 0}, this->swapInfo.res})
+                           .setFramebuffer(*this->swapFramebuffers[imageIndex])
+                           .setClearValueCount(1)
+                           .setPClearValues(&clearColor),
+                       vk::SubpassContents::eSecondaryCommandBuffers);
+
+   if (!secondaries.empty())
+      cmd.executeCommands(secondaries);
+
+   cmd.endRenderPass();
+   if (this->timestampPool)
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *this->timestampPool, firstQuery + 1);
+   cmd.end();
+}
 
-   for (size_t i = 0; i < this->cmdBuffs.size(); i++) {
-      const auto& cmd = this->cmdBuffs[i];
+void VulkanBackend::createSyncObjects(size_t frames) {
+   PROFILE_FUNCTION();
+   vector<vk::UniqueSemaphore> imageAvail, renderFinished;
+   vector<vk::UniqueFence>     fences;
 
-      auto beginInfo = vk::CommandBufferBeginInfo()
-                           .setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse)
-                           .setPInheritanceInfo(nullptr);
-      cmd.begin(beginInfo);
+   vk::SemaphoreCreateInfo semInfo;
+   // Start signaled so the first wait on each one doesn't hang forever
+   auto fenceInfo = vk::FenceCreateInfo().setFlags(vk::FenceCreateFlagBits::eSignaled);
+   for (size_t i = 0; i < frames; i++) {
+      imageAvail.push_back(this->logical->createSemaphoreUnique(semInfo));
+      renderFinished.push_back(this->logical->createSemaphoreUnique(semInfo));
+      fences.push_back(this->logical->createFenceUnique(fenceInfo));
+   }
 
-      this->clearColor.setColor(array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f});
-      cmd.beginRenderPass(vk::RenderPassBeginInfo()
-                              .setRenderPass(*this->pipe->renderPass)
-                              .setRenderArea({{0, 0}, this->swapInfo.res})
-                              .setFramebuffer(*this->swapFramebuffers[i])
-                              .setClearValueCount(1)
-                              .setPClearValues(&clearColor),
-                          vk::SubpassContents::eInline);
+   // Nothing past here throws, so it's the new set or the old one, never half of each
+   this->imageAvailSems     = std::move(imageAvail);
+   this->renderFinishedSems = std::move(renderFinished);
+   this->inFlightFences     = std::move(fences);
+   this->currentFrame       = 0;
+   this->timestampsPending.fill(false);  // Slots are about to mean different frames
+   this->imagesInFlight.assign(this->swapImages.size(), vk::Fence(nullptr));
+}
 
-      cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *this->pipe->pipe);
-      cmd.draw(3, 1, 0, 0);
-      cmd.endRenderPass();
-      cmd.end();
+void VulkanBackend::createTimestampQueries() {
+   PROFILE_FUNCTION();
+   uint32 validBits = this->physical.getQueueFamilyProperties()[this->queueIndices.graphics].timestampValidBits;
+   if (!validBits) {
+      Logger::Info("No timestamps on the graphics queue, so no GPU frame times");
+      return;
    }
+
+   this->timestampPeriod = this->physical.getProperties().limits.timestampPeriod;
+   this->timestampMask   = validBits >= 64 ? ~uint64(0) : (uint64(1) << validBits) - 1;
+   this->timestampPool   = this->logical->createQueryPoolUnique(
+       vk::QueryPoolCreateInfo().setQueryType(vk::QueryType::eTimestamp).setQueryCount(MaxFramesInFlight * 2));
 }
 
-void VulkanBackend::createSemaphores() {
-   vk::SemaphoreCreateInfo semInfo;
-   for (size_t i = 0; i < this->maxFramesInFlight; i++) {
-      this->imageAvailSems.push_back(this->logical->createSemaphoreUnique(semInfo));
-      this->renderFinishedSems.push_back(this->logical->createSemaphoreUnique(semInfo));
-   }
+void VulkanBackend::readGpuTime() {
+   if (!this->timestampsPending[currentFrame])
+      return;
+   this->timestampsPending[currentFrame] = false;
+
+   uint64 ticks[2];
+   auto   result = this->logical->getQueryPoolResults(*this->timestampPool, uint32(currentFrame * 2), 2, sizeof(ticks),
+                                                      ticks, sizeof(uint64), vk::QueryResultFlagBits::e64);
+   if (result == vk::Result::eSuccess)
+      this->gpuFrameMs = double((ticks[1] - ticks[0]) & this->timestampMask) * this->timestampPeriod / 1e6;
 }
@@ -1,17 +1,33 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <deque>
+
 #include <vulkan/vulkan.hpp>
 
 #include <SDL2/SDL.h>
+#include <SDL2/SDL_vulkan.h>
 
 #include "RenderingBackend.hpp"
 
+#include "AsyncPipelineBuilder.hpp"
+#include "CommandRecorder.hpp"
+#include "FrameRing.hpp"
+#include "GpuAllocator.hpp"
+#include "IndirectRenderer.hpp"
 #include "Macros.hpp"
+#include "Pipeline.hpp"
+#include "PipelineCache.hpp"
+#include "Profiler.hpp"
+#include "RenderQueue.hpp"
 
 #include "Shader.hpp"
+#include "UploadQueue.hpp"
 
 struct QueueIndices {
    int graphics = -1;
    int present  = -1;
+   int transfer = -1;  // A transfer-only family if there is one, otherwise graphics
 
    bool isComplete() { return AllAreNot(-1, graphics, present); }
 };
@@ -27,6 +43,34 @@ struct SwapchainInfo {
    vk::Extent2D         res;
 };
 
+/// Everything that hung off a swapchain we've since replaced. Kept around until the frames that used it are done.
+struct RetiredSwapchain {
+   uint64                             retiredAt;  // frameNumber when it was replaced
+   vk::SwapchainKHR                   swapchain;
+   std::vector<vk::ImageView>         views;
+   std::vector<vk::UniqueFramebuffer> framebuffers;
+};
+
+/// Draws go in the packet instead of straight into renderQueue, so the game thread never touches the render thread's.
+struct VulkanFramePacket : FramePacket {
+   void clear() override {
+      FramePacket::clear();
+      draws.clear();
+      indirectChanges.clear();
+   }
+
+   /// Adds (or replaces) a mesh for GPU-driven drawing, once enableIndirect() has been called. key is whatever the
+   /// game wants to call it by. Unlike draws these stick, so the backend keeps resending them in later packets until
+   /// the render thread has applied them; skipped frames don't lose any.
+   void addIndirect(uint64 key, IndirectRenderer::Mesh mesh) {
+      indirectChanges.push_back({0, key, std::make_shared<const IndirectRenderer::Mesh>(std::move(mesh))});
+   }
+   void removeIndirect(uint64 key) { indirectChanges.push_back({0, key, nullptr}); }
+
+   std::vector<DrawPacket>               draws;
+   std::vector<IndirectRenderer::Change> indirectChanges;  // In order. seq is 0 until the packet's handed over.
+};
+
 class VulkanBackend : public RenderingBackend {
   public:
    virtual ~VulkanBackend();
@@ -40,57 +84,96 @@ class VulkanBackend : public RenderingBackend {
    void createSurface();
    void getPhysical();
    void getLogical();
-   void createSwapchain();
+   void createAllocator();
+   void createUploadQueue();
+   void createFrameRing();
+   void createPipelineCache();
+   void createSwapchain(vk::SwapchainKHR oldSwapchain = nullptr);
+   /// Headless stand-in for createSwapchain: one image per possible frame in flight, in the format a swapchain would
+   /// most likely have given us.
+   void createOffscreenTargets();
+   /// swapViews for whatever's in swapImages.
+   void createSwapViews();
    void createRenderPasses();
    void createGraphicsPipeline();
    void createFrameBuffers();
-   void createCommandPools();
-   void createCommandBuffs();
-   void createSemaphores();
+   void createCommandPools(size_t frames);
+   /// Resets this frame's pools, records every recorder (and the sorted render queue, split across workers) into
+   /// secondaries and stitches them into the primary.
+   void recordFrame(uint32 imageIndex);
+   /// One set per frame in flight. Builds the lot before swapping any of it in.
+   void createSyncObjects(size_t frames);
+   /// A start and end timestamp per frame in flight, if the graphics queue can do timestamps at all.
+   void createTimestampQueries();
+   /// Picks up the GPU time of the frame that last used currentFrame's slot. Only once its fence is done.
+   void readGpuTime();
 
    void getExtensions();
    void getLayers();
+   bool hasExtension(const std::string& name) const {
+      for (auto ext : this->deviceExtensions)
+         if (name == ext)
+            return true;
+      return false;
+   }
 
-   virtual void updateRender() {
-      // Todo: All of this should be re-encapsulated into a vulkan backend object.
-      uint32 imageIndex = logical
-                              ->acquireNextImageKHR(swapchain, std::numeric_limits<uint32>::max(),
-                                                    *imageAvailSems[currentFrame], vk::Fence(nullptr))
-                              .value;
-      vk::Semaphore          waitSemaphores[] = {*imageAvailSems[currentFrame]};
-      vk::PipelineStageFlags waitStages[]     = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
-
-      vk::Semaphore signalSemaphores[] = {*renderFinishedSems[currentFrame]};
-
-
-      auto subInfo = vk::SubmitInfo()
-                         .setWaitSemaphoreCount(1)
-                         .setPWaitSemaphores(waitSemaphores)
-                         .setPWaitDstStageMask(waitStages)
-                         .setCommandBufferCount(1)
-                         .setPCommandBuffers(&cmdBuffs[imageIndex])
-                         .setSignalSemaphoreCount(1)
-                         .setPSignalSemaphores(signalSemaphores);
-
-      graphicsQueue.submit(subInfo, vk::Fence(nullptr));
-
-
-      vk::SwapchainKHR swapchains[] = {swapchain};
+   /// Rebuilds the swapchain and only what depends on it (views, framebuffers, command buffers). The old swapchain
+   /// is handed to the new one and everything old is destroyed later by collectRetired, so this never idles the GPU.
+   /// Returns false if there's nothing to present to right now (i.e. minimized).
+   bool recreateSwapchain();
+   /// Destroys retired swapchain resources whose frames are done. force destroys all of them; only do that once the
+   /// device is idle.
+   void collectRetired(bool force = false);
+   /// SDL event watch so resizes get noticed whoever happens to be pumping events.
+   static int onWindowEvent(void* self, SDL_Event* event);
+
+   virtual void                         renderFrame(const FramePacket& packet);
+   virtual std::unique_ptr<FramePacket> createFramePacket() { return std::make_unique<VulkanFramePacket>(); }
+   /// Numbers the packet's indirect changes, and puts every one the render thread hasn't applied yet in front of them.
+   virtual void finishPacket(FramePacket& packet);
+   /// The render thread gets its own JobSystem to record with, since CommandRecorder wants to be called from a worker.
+   virtual void onRenderThreadStart();
+   virtual void onRenderThreadStop();
+
+   /// This frame's packet, as a VulkanFramePacket. See RenderingBackend::beginFrame().
+   VulkanFramePacket& beginFrame() { return static_cast<VulkanFramePacket&>(RenderingBackend::beginFrame()); }
+
+   /// func gets called every frame (possibly on another thread) to record into a secondary buffer inside the main
+   /// render pass. Secondaries are executed in the order they were added. Add recorders and pre-passes before going
+   /// threaded; the render thread reads the lists every frame.
+   void addRecorder(const CommandRecorder::RecordFunc& func);
+
+   /// func gets recorded straight into the primary every frame, before the render pass begins (so compute, copies and
+   /// the like). Pre-passes run in the order they were added, on the render thread.
+   void addPrePass(const CommandRecorder::RecordFunc& func) { this->prePasses.push_back(func); }
+
+   /// Turns on GPU-driven drawing (see IndirectRenderer.hpp). Call once, after init() and before going threaded. From
+   /// then on meshes come in through VulkanFramePacket::addIndirect(), and the cull pass uses each packet's camera.
+   IndirectRenderer& enableIndirect(const IndirectRenderer::Config& config);
+
+   /// Compiles desc on a background thread. Check the handle before drawing with it.
+   std::shared_ptr<PipelineHandle> buildPipelineAsync(const PipelineDesc& desc);
+
+   /// Sub-allocated from allocator. Free with allocator->destroy(buffer).
+   VulkanBuffer createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
+                             MemoryUsage memUsage = MemoryUsage::GpuOnly, FlagSet<BufferFlags> flags = BufferFlags(0)) {
+      return this->allocator->createBuffer(size, usage, memUsage, flags);
+   }
 
-      auto presentInfo = vk::PresentInfoKHR()
-                             .setWaitSemaphoreCount(1)
-                             .setPWaitSemaphores(signalSemaphores)
-                             .setSwapchainCount(1)
-                             .setPSwapchains(swapchains)
-                             .setPImageIndices(&imageIndex)
-                             .setPResults(nullptr);
-      presentQueue.presentKHR(presentInfo);
+   /// Writes the pipeline cache to pipelineCachePath now instead of waiting for shutdown.
+   bool savePipelineCache() { return this->pipelineCache && this->pipelineCache->save(); }
 
-      currentFrame = (currentFrame + 1) % maxFramesInFlight;
-   }
+   /// Clamped to [1, MaxFramesInFlight]. Safe to call at runtime; it idles the GPU and rebuilds the sync objects.
+   virtual void   setFramesInFlight(size_t frames);
+   virtual size_t getFramesInFlight() const { return framesInFlight; }
+   /// How long the last frame sat waiting on fences, in milliseconds.
+   virtual double getGpuWaitTime() const { return gpuWaitMs; }
+   /// From timestamps around each frame's primary command buffer. Runs framesInFlight frames behind.
+   virtual double getGpuFrameTime() const { return gpuFrameMs; }
 
    // Perhaps exchange the references with a single (const) reference to a VulkanBoilerplate?
    static QueueIndices         getQueueFamilyIndices(const vk::PhysicalDevice& physical, const vk::SurfaceKHR& surface);
+   /// surface is null when headless, which skips the swapchain checks.
    static bool                 isDeviceSuitable(const vk::PhysicalDevice& dev, const vk::SurfaceKHR& surface);
    static vk::SurfaceFormatKHR chooseSurfaceFormat(const std::vector<vk::SurfaceFormatKHR>& formats);
    static vk::PresentModeKHR   choosePresentMode(const std::vector<vk::PresentModeKHR>& modes);
@@ -101,18 +184,33 @@ class VulkanBackend : public RenderingBackend {
                                                        const char* layerPrefix, const char* msg, void* userData);
 
 
+   static constexpr size_t MaxFramesInFlight = 4;
+
    // POD
-   const size_t   maxFramesInFlight = 2;
-   size_t         currentFrame      = 0;
-   vk::ClearValue clearColor;
+   size_t              framesInFlight = 2;
+   size_t              currentFrame   = 0;
+   uint64              frameNumber    = 0;  // Total frames submitted. Never wraps in practice.
+   std::atomic<double> gpuWaitMs{0.0};
+   std::atomic<double> gpuFrameMs{-1.0};  // Negative until the first frame's timestamps are in, or if there are none
+   std::atomic<bool>   swapchainDirty{false};  // Set on resize; handled at the start of the next frame
+   std::atomic<uint64> indirectApplied{0};     // Newest IndirectRenderer::Change seq the render thread has applied
+   vk::ClearValue      clearColor;
+   std::string         pipelineCachePath = "pipeline.cache";  // Set before init() to move it
+   bool                headless          = false;             // Set before init(): no window or swapchain
+
+   // The frame being rendered, for recorders to read from. Only valid while they're running.
+   const VulkanFramePacket* currentPacket = nullptr;
+   FrameAlloc               frameCamera;    // currentPacket->camera, in frameRing
+   FrameAlloc               frameUniforms;  // currentPacket->uniforms, in frameRing. Empty if there weren't any.
 
    // Constructor-ordered
-   std::vector<const char*> deviceExtensions, deviceLayers;
-   vk::PhysicalDevice       physical;
-   vk::UniqueInstance       instance;
-   vk::UniqueDevice         logical;
-   vk::UniqueSurfaceKHR     surface;
-   vk::Queue                graphicsQueue, presentQueue;
+   std::vector<const char*>   deviceExtensions, deviceLayers;
+   vk::PhysicalDevice         physical;
+   vk::PhysicalDeviceFeatures enabledFeatures;
+   vk::UniqueInstance         instance;
+   vk::UniqueDevice           logical;
+   vk::UniqueSurfaceKHR       surface;
+   vk::Queue                  graphicsQueue, presentQueue, transferQueue;
 
 
    vk::DebugReportCallbackEXT debugCallbackObj;
@@ -124,15 +222,39 @@ class VulkanBackend : public RenderingBackend {
 
 
    std::vector<vk::UniqueFramebuffer> swapFramebuffers;
-
-   vk::UniqueCommandPool commandPool;
+   std::deque<RetiredSwapchain>       retiredSwapchains;
+
+   // Headless, frames render into these instead (swapImages has the same handles), one per frame in flight so
+   // imageIndex is just currentFrame. Nothing is presented; they're left in eTransferSrcOptimal to read back.
+   std::vector<VulkanImage> offscreenImages;
+
+   std::unique_ptr<GpuAllocator>         allocator;
+   std::unique_ptr<UploadQueue>          uploads;
+   std::unique_ptr<FrameRing>            frameRing;  // Per-frame scratch; see FrameRing.hpp
+   std::unique_ptr<IndirectRenderer>     indirect;   // Only once enableIndirect() is called
+   std::vector<IndirectRenderer::Change> indirectUnapplied;  // Game thread. Sent, but not applied as of the last look.
+   uint64                                indirectSeq = 0;    // Game thread
+   std::unique_ptr<PipelineCache>        pipelineCache;
+   std::unique_ptr<AsyncPipelineBuilder> pipelineBuilder;
+   std::shared_ptr<RenderPass>           renderPass;
+   std::shared_ptr<PipelineHandle>       pipe;
 
    QueueIndices queueIndices;
 
-   std::vector<vk::CommandBuffer> cmdBuffs;
+   std::unique_ptr<CommandRecorder>         recorder;
+   std::vector<CommandRecorder::RecordFunc> recorders;
+   std::vector<CommandRecorder::RecordFunc> prePasses;
+   RenderQueue                              renderQueue;  // Recorded after the recorders. Render thread only.
+   std::unique_ptr<JobSystem>               renderJobs;   // Records with this instead of Main() when threaded
 
+   // One of each per frame in flight, indexed by currentFrame
    std::vector<vk::UniqueSemaphore> imageAvailSems, renderFinishedSems;
-
-   // Temp stuff for following the vulkan-tutorial
-   VulkanShader vert, frag;
+   std::vector<vk::UniqueFence>     inFlightFences;
+   // One per swapchain image. Whichever inFlightFence last submitted work rendering to that image, or null.
+   std::vector<vk::Fence> imagesInFlight;
+
+   vk::UniqueQueryPool                 timestampPool;          // Null if the graphics queue has no timestamps
+   double                              timestampPeriod = 0.0;  // Nanoseconds per tick
+   uint64                              timestampMask   = 0;    // The bits of a timestamp that are valid
+   std::array<bool, MaxFramesInFlight> timestampsPending{};     // Per frame slot: written, and not read back yet
 };
@@ -0,0 +1,225 @@
+// GLENgine_bench: renders a fixed number of frames headless (no window or swapchain, so a CPU device like lavapipe is
+// fine) and writes frame time stats as JSON, for CI to track rendering throughput.
+// Usage: GLENgine_bench [--indirect] [--replay session.rec] [frames] [width] [height] [framesInFlight] [out.json]
+//
+// --replay plays back a session recorded with the test app's --record, one recorded frame per rendered frame, and
+// times however many frames that is instead of frames. Input gets no window, like the renderer, so SDL's dummy video
+// driver does fine.
+//
+// --indirect also puts a grid of little meshes through GPU-driven drawing (needs cull.spv) and checks that the number
+// the cull pass let through matches what the same test on the CPU says it should. Exits with 1 if it doesn't.
+//
+//   cpuFrameMs  how long updateRender() took on the game thread, fence waits included
+//   gpuWaitMs   how much of that was spent waiting on the GPU
+//   gpuFrameMs  GPU timestamps around each frame's command buffer. null if the device has no timestamps.
+// Each has mean, p50, p99 and max. Frames only count once the pipeline's built and a few more have gone by.
+// pipelineBuildMs is how long the triangle's pipeline took to build in the background, warm cache or cold.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLENgine.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+constexpr int32  WarmupFrames     = 32;
+constexpr double PipelineTimeoutS = 30.0;
+constexpr int32  GridSize         = 64;  // --indirect's scene is GridSize^2 meshes
+constexpr float  GridSpacing      = 4.0f;
+constexpr float  MeshRadius       = 0.75f;
+constexpr float  PlaneMargin      = 0.01f;  // Leave out meshes closer than this to being culled or not
+
+/// --indirect's scene: a flat grid of triangles around the origin, seen from above one corner so the frustum cuts
+/// right through it.
+struct IndirectScene {
+   FrameCamera                    camera;
+   vector<IndirectRenderer::Mesh> meshes;
+   uint32                         expectedVisible = 0;
+
+   IndirectScene(float aspect) {
+      camera.view = glm::lookAt(glm::vec3(-40.0f, 30.0f, -40.0f), glm::vec3(10.0f, 0.0f, 10.0f), glm::vec3(0, 1, 0));
+      camera.proj = glm::perspective(glm::radians(60.0f), aspect, 0.1f, 120.0f);
+
+      glm::vec4 planes[6];
+      IndirectRenderer::ExtractPlanes(camera.proj * camera.view, planes);
+
+      for (int32 x = 0; x < GridSize; x++)
+         for (int32 z = 0; z < GridSize; z++) {
+            glm::vec3 center((x - GridSize / 2) * GridSpacing, 0.0f, (z - GridSize / 2) * GridSpacing);
+
+            // Same test as cull.comp. Anything too close to call could go either way on the GPU, so skip it.
+            bool visible = true, close = false;
+            for (const auto& plane : planes) {
+               float dist = glm::dot(glm::vec3(plane), center) + plane.w + MeshRadius;
+               close |= fabs(dist) < PlaneMargin;
+               visible &= dist >= 0.0f;
+            }
+            if (close)
+               continue;
+
+            glm::vec3 verts[] = {center + glm::vec3(-0.5f, 0.0f, 0.0f), center + glm::vec3(0.5f, 0.0f, 0.0f),
+                                 center + glm::vec3(0.0f, 0.0f, 0.5f)};
+            IndirectRenderer::Mesh mesh;
+            mesh.vertices.resize(sizeof(verts));
+            memcpy(mesh.vertices.data(), verts, sizeof(verts));
+            mesh.indices = {0, 1, 2};
+            mesh.center  = center;
+            mesh.radius  = MeshRadius;
+            meshes.push_back(move(mesh));
+            expectedVisible += visible;
+         }
+   }
+};
+
+/// Nearest rank. times has to be sorted.
+static double Percentile(const vector<double>& times, double p) {
+   size_t rank = size_t(ceil(p * times.size()));
+   return times[clamp<size_t>(rank, 1, times.size()) - 1];
+}
+
+static void WriteStats(FILE* out, const char* name, vector<double> times, bool last = false) {
+   if (times.empty()) {
+      fprintf(out, "  \"%s\": null%s\n", name, last ? "" : ",");
+      return;
+   }
+   sort(times.begin(), times.end());
+   double mean = accumulate(times.begin(), times.end(), 0.0) / times.size();
+   fprintf(out, "  \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n", name, mean,
+           Percentile(times, 0.5), Percentile(times, 0.99), times.back(), last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+   bool          indirectCheck = false;
+   string        replayPath;
+   vector<char*> args;
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "--indirect"))
+         indirectCheck = true;
+      else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+         replayPath = argv[++i];
+      else
+         args.push_back(argv[i]);
+   }
+   size_t frames         = args.size() > 0 ? strtoul(args[0], nullptr, 10) : 1000;
+   int32  width          = args.size() > 1 ? atoi(args[1]) : 1600;
+   int32  height         = args.size() > 2 ? atoi(args[2]) : 900;
+   size_t framesInFlight = args.size() > 3 ? strtoul(args[3], nullptr, 10) : 2;
+   string outPath        = args.size() > 4 ? args[4] : "bench.json";
+
+   Logger::SetLogFile("bench.log");
+   Profiler::SetThreadName("Main");
+   JobSystem::Main();
+
+   auto renderer      = make_unique<VulkanBackend>();
+   renderer->headless = true;
+   renderer->setFramesInFlight(framesInFlight);
+   renderer->init("bench", {width, height});
+
+   // Packets are reused, so the camera goes in every one. The meshes only have to go in the first.
+   unique_ptr<IndirectScene> scene;
+   IndirectRenderer*         indirect = nullptr;
+   if (indirectCheck) {
+      IndirectRenderer::Config config;
+      config.vertexStride = sizeof(glm::vec3);
+      indirect            = &renderer->enableIndirect(config);
+      if (!indirect->isEnabled())
+         Logger::ErrorOut("--indirect needs GPU-driven drawing, which needs cull.spv");
+
+      scene      = make_unique<IndirectScene>(float(width) / height);
+      auto& head = renderer->beginFrame();
+      for (size_t i = 0; i < scene->meshes.size(); i++)
+         head.addIndirect(i, move(scene->meshes[i]));
+   }
+   auto renderFrame = [&] {
+      if (scene)
+         renderer->beginFrame().camera = scene->camera;
+      renderer->updateRender();
+   };
+
+   // The triangle's pipeline builds in the background; timing before it's there would only measure clears
+   auto waitStart = Clock::now();
+   while (!renderer->pipe->get()) {
+      if (chrono::duration<double>(Clock::now() - waitStart).count() > PipelineTimeoutS)
+         Logger::ErrorOut("Pipeline still isn't built after ", PipelineTimeoutS, "s");
+      renderFrame();
+      JobSystem::Main().runPinnedJobs();
+   }
+   for (int32 i = 0; i < WarmupFrames; i++) {
+      renderFrame();
+      JobSystem::Main().runPinnedJobs();
+   }
+
+   // A frame's GPU time turns up framesInFlight frames later, so by now every one read is a warmed up frame's
+   // Started only now, so none of the session goes on warming up
+   Input input{nullptr};
+   if (!replayPath.empty() && !input.startReplay(replayPath))
+      Logger::ErrorOut("Can't replay ", replayPath);
+
+   vector<double> cpuTimes, gpuWaits, gpuTimes;
+   cpuTimes.reserve(frames);
+   gpuWaits.reserve(frames);
+   gpuTimes.reserve(frames);
+   auto runStart = Clock::now();
+   bool replaying = input.isReplaying();  // It's dropped once it's over
+   for (size_t i = 0; replaying ? !input.shouldQuit() : i < frames; i++) {
+      auto start = Clock::now();
+      renderFrame();
+      input.update();
+      cpuTimes.push_back(chrono::duration<double, milli>(Clock::now() - start).count());
+      gpuWaits.push_back(renderer->getGpuWaitTime());
+      if (renderer->getGpuFrameTime() >= 0.0)
+         gpuTimes.push_back(renderer->getGpuFrameTime());
+      JobSystem::Main().runPinnedJobs();
+   }
+   double seconds = chrono::duration<double>(Clock::now() - runStart).count();
+   frames         = cpuTimes.size();
+
+   FILE* out = fopen(outPath.c_str(), "w");
+   if (!out)
+      Logger::ErrorOut("Can't write ", outPath);
+   fprintf(out, "{\n");
+   fprintf(out, "  \"device\": \"%s\",\n", static_cast<const char*>(renderer->physical.getProperties().deviceName));
+   fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n", width, height);
+   fprintf(out, "  \"framesInFlight\": %zu,\n", renderer->getFramesInFlight());
+   fprintf(out, "  \"pipelineCacheWarm\": %s,\n", renderer->pipelineCache->isWarm() ? "true" : "false");
+   fprintf(out, "  \"pipelineBuildMs\": %.4f,\n", renderer->pipe->buildTime());
+   fprintf(out, "  \"frames\": %zu,\n", frames);
+   if (!replayPath.empty())
+      fprintf(out, "  \"replay\": \"%s\",\n  \"replayMismatches\": %llu,\n", replayPath.c_str(),
+              static_cast<unsigned long long>(input.getReplayMismatches()));
+   fprintf(out, "  \"seconds\": %.4f,\n", seconds);
+   fprintf(out, "  \"fps\": %.2f,\n", frames / seconds);
+   WriteStats(out, "cpuFrameMs", cpuTimes);
+   WriteStats(out, "gpuWaitMs", gpuWaits);
+   if (indirect)
+      fprintf(out, "  \"indirect\": {\"objects\": %u, \"visible\": %u, \"expected\": %u},\n",
+              indirect->objectCount(), indirect->visibleCount(), scene->expectedVisible);
+   WriteStats(out, "gpuFrameMs", gpuTimes, true);
+   fprintf(out, "}\n");
+   fclose(out);
+
+   Logger::Info(frames, " frames in ", seconds, "s (", frames / seconds, " fps), stats in ", outPath);
+
+   // By now every mesh is long since on the GPU and the count read back is from this same camera
+   int result = 0;
+   if (indirect) {
+      if (indirect->visibleCount() != scene->expectedVisible)
+         result = 1;
+      Logger::Write(result ? "ERROR" : "INFO", "Cull pass drew ", indirect->visibleCount(), " of ",
+                    indirect->objectCount(), " objects, expected ", scene->expectedVisible);
+   }
+
+   renderer.reset();
+   return result;
+}
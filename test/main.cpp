@@ -1,7 +1,11 @@
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <string>
 #include <vector>
 
 
@@ -15,16 +19,38 @@ struct Vert {
    glm::vec3 pos;
    glm::vec4 color;
 };
+VERTEX_LAYOUT(Vert, pos, color);
 
 
-int main() {
+/// --record <file> saves this session's input, --replay <file> plays one back instead of the real thing and quits at
+/// the end, for runs that can be compared.
+int main(int argc, char** argv) {
+   std::string recordPath, replayPath;
+   for (int i = 1; i + 1 < argc; i++) {
+      if (!strcmp(argv[i], "--record"))
+         recordPath = argv[++i];
+      else if (!strcmp(argv[i], "--replay"))
+         replayPath = argv[++i];
+   }
+
    try {
       bool running = true;
       Logger::SetLogFile("mcpp.log");
+      Logger::SetAsync(true);
+      BinLog::Open("mcpp.binlog");
+      Profiler::SetThreadName("Main");
+      JobSystem::Main();  // Before anything else uses it, so this thread is the one that runs pinned jobs
+      Profiler::DumpOnExit("mcpp.trace.json");
       RenderingBackend* renderer = new VulkanBackend();
+      renderer->setFramesInFlight(2);
       renderer->init("mcpp", {1600, 900});
+      renderer->setThreaded(true);  // So the loop below never waits on vsync
 
       Input input{renderer->window};
+      if (!replayPath.empty() && !input.startReplay(replayPath))
+         Logger::ErrorOut("Can't replay ", replayPath);
+      if (!recordPath.empty())
+         input.startRecording(recordPath);
 
       std::vector<Vert>     verts    = {{{-0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f, 1.0f}},
                                  {{0.5f, -0.5f, 0.0f}, {0.0f, 0.0f, 1.0f, 1.0f}},
@@ -32,10 +58,19 @@ int main() {
       std::vector<unsigned> indicies = {0, 1, 2};
 
 
+      uint64 frames = 0;
+      auto   start  = std::chrono::steady_clock::now();
       while (!input.shouldQuit()) {
+         PROFILE_ZONE("Frame");
          renderer->updateRender();
          input.update();
+         JobSystem::Main().runPinnedJobs();
+         frames++;
       }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      Logger::Info(frames, " frames, ", seconds * 1000.0 / std::max<uint64>(frames, 1), " ms each");
+      input.stopRecording();
+      renderer->setThreaded(false);  // Before exit() starts tearing down statics it's still using
    } catch (const std::runtime_error& e) {
       Logger::Error("UNCAUGHT EXCEPTION: ", e.what());
       // TODO: Forcible cleanup.
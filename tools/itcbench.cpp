@@ -0,0 +1,212 @@
+// glen-itcbench: ITC.hpp channels against a std::mutex + std::deque queue, and checks they don't lose, duplicate,
+// reorder or tear anything while they're at it.
+// Usage: glen-itcbench [items] [producers]
+//
+//   throughput  one producer (or several, for MPSC) pushing items as fast as they can to one consumer
+//   latency     a ping-pong between two threads, one item each way per round trip
+//   mailbox     a TripleBuffer written flat out while a reader checks every value it sees is whole and newer
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ITC.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+constexpr size_t Capacity = 1024;
+
+/// The baseline, with the same interface and bound as the real ones.
+template <typename T>
+class LockedQueue {
+  public:
+   bool tryPush(T item) {
+      {
+         lock_guard<mutex> guard(lock);
+         if (items.size() == Capacity)
+            return false;
+         items.push_back(move(item));
+      }
+      ready.notify_one();
+      return true;
+   }
+
+   bool tryPop(T& out) {
+      lock_guard<mutex> guard(lock);
+      if (items.empty())
+         return false;
+      out = move(items.front());
+      items.pop_front();
+      return true;
+   }
+
+   void push(T item) {
+      while (!tryPush(item))
+         this_thread::yield();
+   }
+
+   T pop() {
+      unique_lock<mutex> guard(lock);
+      ready.wait(guard, [&] { return !items.empty(); });
+      T item = move(items.front());
+      items.pop_front();
+      return item;
+   }
+
+  private:
+   mutex              lock;
+   condition_variable ready;
+   deque<T>           items;
+};
+
+static double Seconds(Clock::time_point start) { return chrono::duration<double>(Clock::now() - start).count(); }
+
+/// Items are producer << 48 | sequence. Every producer's have to come out in order, and all of them exactly once.
+template <typename Queue>
+static bool Throughput(const char* name, size_t items, size_t producers) {
+   auto queue = make_unique<Queue>();
+
+   atomic<bool>   go{false};
+   vector<thread> threads;
+   for (size_t p = 0; p < producers; p++)
+      threads.emplace_back([&, p] {
+         while (!go.load(memory_order_acquire))
+            this_thread::yield();
+         for (uint64 i = 0; i < items; i++)
+            while (!queue->tryPush(uint64(p) << 48 | i))
+               this_thread::yield();
+      });
+
+   vector<uint64> next(producers, 0);
+   size_t         wrong = 0;
+   auto           start = Clock::now();
+   go.store(true, memory_order_release);
+   for (size_t received = 0; received < items * producers;) {
+      uint64 item;
+      if (!queue->tryPop(item)) {
+         this_thread::yield();
+         continue;
+      }
+      uint64 p = item >> 48, i = item & ((uint64(1) << 48) - 1);
+      wrong += p >= producers || i != next[p]++;
+      received++;
+   }
+   double seconds = Seconds(start);
+   for (auto& t : threads)
+      t.join();
+
+   printf("  %-34s %8.2f M items/s %s\n", name, items * producers / seconds / 1e6, wrong ? "  OUT OF ORDER!" : "");
+   return wrong == 0;
+}
+
+/// Round trips of one item through a pair of queues.
+template <typename Queue>
+static void Latency(const char* name, size_t trips) {
+   auto there = make_unique<Queue>(), back = make_unique<Queue>();
+
+   thread echo([&] {
+      for (size_t i = 0; i < trips; i++)
+         back->push(there->pop());
+   });
+
+   vector<double> times(trips);
+   for (size_t i = 0; i < trips; i++) {
+      auto start = Clock::now();
+      there->push(i);
+      back->pop();
+      times[i] = chrono::duration<double, micro>(Clock::now() - start).count();
+   }
+   echo.join();
+
+   sort(times.begin(), times.end());
+   printf("  %-34s %8.2f us median %8.2f us p99\n", name, times[trips / 2], times[trips * 99 / 100]);
+}
+
+/// Every field gets the same sequence number, so a torn read shows up as a mismatch.
+struct Frame {
+   uint64 seq;
+   uint64 payload[31];
+};
+
+template <bool Blocking>
+static bool Mailbox(const char* name, size_t publishes) {
+   TripleBuffer<Frame, Blocking> mailbox;
+   atomic<bool>                  done{false};
+
+   thread writer([&] {
+      for (uint64 i = 1; i <= publishes; i++) {
+         Frame& frame = mailbox.write();
+         frame.seq    = i;
+         fill(begin(frame.payload), end(frame.payload), i);
+         mailbox.publish();
+      }
+      done.store(true, memory_order_release);
+   });
+
+   size_t seen = 0, torn = 0, stale = 0;
+   uint64 last = 0;
+   auto   start = Clock::now();
+   for (;;) {
+      bool finished = done.load(memory_order_acquire);  // Before update(), so the last publish can't be missed
+      if (!mailbox.update()) {
+         if (finished)
+            break;
+         this_thread::yield();
+         continue;
+      }
+      const Frame& frame = mailbox.read();
+      torn += any_of(begin(frame.payload), end(frame.payload), [&](uint64 v) { return v != frame.seq; });
+      stale += frame.seq <= last;
+      last = frame.seq;
+      seen++;
+   }
+   double seconds = Seconds(start);
+   writer.join();
+
+   bool ok = !torn && !stale && last == publishes;
+   printf("  %-34s %8.2f M publishes/s, reader saw %zu%s\n", name, publishes / seconds / 1e6, seen,
+          ok ? "" : "  TORN/STALE/LOST!");
+   return ok;
+}
+
+int main(int argc, char** argv) {
+   size_t items     = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+   size_t producers = argc > 2 ? strtoul(argv[2], nullptr, 10) : max(2u, thread::hardware_concurrency() - 1);
+   bool   ok        = true;
+
+   printf("%zu items, %zu producers for MPSC, capacity %zu, %u hardware threads\n", items, producers, Capacity,
+          thread::hardware_concurrency());
+
+   printf("throughput, 1 producer\n");
+   ok &= Throughput<LockedQueue<uint64>>("mutex + deque", items, 1);
+   ok &= Throughput<SpscRing<uint64, Capacity>>("SpscRing", items, 1);
+   ok &= Throughput<SpscRing<uint64, Capacity, true>>("SpscRing (blocking)", items, 1);
+   ok &= Throughput<MpscQueue<uint64, Capacity>>("MpscQueue", items, 1);
+
+   printf("throughput, %zu producers\n", producers);
+   ok &= Throughput<LockedQueue<uint64>>("mutex + deque", items / producers, producers);
+   ok &= Throughput<MpscQueue<uint64, Capacity>>("MpscQueue", items / producers, producers);
+   ok &= Throughput<MpscQueue<uint64, Capacity, true>>("MpscQueue (blocking)", items / producers, producers);
+
+   size_t trips = max<size_t>(1000, items / 1000);
+   printf("latency, %zu round trips\n", trips);
+   Latency<LockedQueue<uint64>>("mutex + deque + condvar", trips);
+   Latency<SpscRing<uint64, Capacity>>("SpscRing (spinning)", trips);
+   Latency<SpscRing<uint64, Capacity, true>>("SpscRing (futex)", trips);
+   Latency<MpscQueue<uint64, Capacity, true>>("MpscQueue (futex)", trips);
+
+   printf("mailbox\n");
+   ok &= Mailbox<false>("TripleBuffer", items / 10);
+   ok &= Mailbox<true>("TripleBuffer (blocking)", items / 10);
+
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+// glen-jobbench: how JobSystem scales from 1 worker up to N.
+// Usage: glen-jobbench [maxWorkers] [repeats]
+//
+// For 1, 2, 4, ... maxWorkers workers (and maxWorkers itself), times:
+//   parallelFor  a big loop of floating point work, with the automatic grain size
+//   fork-join    recursive fib, where every call spawns a job and waits on it: mostly scheduling and stealing
+//   tiny jobs    a flood of empty jobs from one thread, so it's pure per-job overhead
+//   meshing      terrain chunks through a MeshingPool
+// and reports each against the 1 worker time. Best of repeats runs.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ChunkMesher.hpp"
+#include "JobSystem.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+constexpr size_t LoopSize   = 1 << 24;
+constexpr int32  FibN       = 36;
+constexpr size_t TinyJobs   = 1 << 20;
+constexpr int32  MeshChunks = 128;
+
+static BlockId Terrain(int32 x, int32 y, int32 z) {
+   float height = 16.0f + 12.0f * sinf(x * 0.05f) * cosf(z * 0.04f) + 4.0f * sinf(x * 0.21f + z * 0.17f);
+   return y > height ? 0 : y > height - 1 ? 1 : 3;
+}
+
+static long Fib(int32 n) {
+   long a = 0, b = 1;
+   for (int32 i = 0; i < n; i++)
+      a = exchange(b, a + b);
+   return a;
+}
+
+static long Fib(JobSystem& jobs, int32 n) {
+   if (n < 16)
+      return Fib(n);  // Below this a job costs more than the work
+
+   long       x, y;
+   JobCounter counter;
+   jobs.run([&] { x = Fib(jobs, n - 1); }, &counter);
+   y = Fib(jobs, n - 2);
+   jobs.wait(counter);
+   return x + y;
+}
+
+template <typename F>
+static double Best(int32 repeats, F&& f) {
+   double best = 1e30;
+   for (int32 r = 0; r < repeats; r++) {
+      auto start = Clock::now();
+      f();
+      best = min(best, chrono::duration<double, milli>(Clock::now() - start).count());
+   }
+   return best;
+}
+
+int main(int argc, char** argv) {
+   size_t maxWorkers = argc > 1 ? strtoul(argv[1], nullptr, 10) : max(1u, thread::hardware_concurrency());
+   int32  repeats    = argc > 2 ? atoi(argv[2]) : 5;
+
+   vector<size_t> counts;
+   for (size_t n = 1; n < maxWorkers; n *= 2)
+      counts.push_back(n);
+   counts.push_back(maxWorkers);
+
+   // Chunks to mesh; stacked in a column so every one has terrain going through it
+   vector<shared_ptr<const PaddedChunk>> chunks;
+   for (int32 i = 0; i < MeshChunks; i++) {
+      Chunk chunk;
+      for (int32 z = 0; z < ChunkSize; z++)
+         for (int32 y = 0; y < ChunkSize; y++)
+            for (int32 x = 0; x < ChunkSize; x++)
+               chunk.at(x, y, z) = Terrain(i * ChunkSize + x, y, z);
+      const Chunk* neighbours[27] = {};
+      neighbours[13]              = &chunk;
+      auto padded                 = make_shared<PaddedChunk>();
+      padded->fill(neighbours);
+      chunks.push_back(move(padded));
+   }
+
+   printf("%zu hardware threads, best of %d\n", size_t(thread::hardware_concurrency()), repeats);
+   printf("%8s  %20s  %20s  %20s  %20s\n", "workers", "parallelFor", "fork-join", "tiny jobs", "meshing");
+
+   double base[4] = {};
+   for (size_t workers : counts) {
+      JobSystem jobs(workers);
+      double    times[4];
+
+      vector<float> out(LoopSize);
+      times[0] = Best(repeats, [&] {
+         jobs.parallelFor(0, LoopSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+               out[i] = sqrtf(float(i)) * sinf(float(i) * 0.001f);
+         });
+      });
+
+      long fib = 0;
+      times[1] = Best(repeats, [&] { fib = Fib(jobs, FibN); });
+      if (fib != Fib(FibN))
+         printf("  fib came out as %ld!\n", fib);
+
+      atomic<size_t> ran{0};
+      times[2] = Best(repeats, [&] {
+         JobCounter counter;
+         for (size_t i = 0; i < TinyJobs; i++)
+            jobs.run([&] { ran.fetch_add(1, memory_order_relaxed); }, &counter);
+         jobs.wait(counter);
+      });
+
+      {
+         MeshingPool pool(jobs);
+         times[3] = Best(repeats, [&] {
+            for (auto& chunk : chunks)
+               pool.submit(chunk, nullptr);
+            pool.waitIdle();
+         });
+      }
+
+      if (workers == 1)
+         copy(begin(times), end(times), begin(base));
+
+      printf("%8zu", workers);
+      for (int32 i = 0; i < 4; i++)
+         printf("  %9.2f ms (%5.2fx)", times[i], base[i] / times[i]);
+      printf("\n");
+   }
+
+   printf("(tiny jobs is %.0f ns a job on 1 worker)\n", base[2] * 1e6 / TinyJobs);
+   return 0;
+}
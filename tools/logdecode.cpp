@@ -0,0 +1,180 @@
+// glen-logdecode: turns a .binlog written by BinLog back into the same [TYPE]@<time>s: msg text Logger writes.
+// Usage: glen-logdecode <in.binlog> [out.log]
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BinLog.hpp"
+
+using namespace std;
+
+struct Format {
+   string                  type, format;
+   vector<BinLog::ArgType> signature;
+};
+
+struct Event {
+   uint64 ticks;
+   string message;
+};
+
+class Reader {
+  public:
+   Reader(const vector<ubyte>& data) : cur{data.data()}, end{data.data() + data.size()} {}
+
+   bool   done() const { return cur >= end; }
+   size_t left() const { return end - cur; }
+
+   template <typename T>
+   T get() {
+      T val{};
+      if (left() < sizeof(T))
+         throw runtime_error("Truncated .binlog");
+      memcpy(&val, cur, sizeof(T));
+      cur += sizeof(T);
+      return val;
+   }
+
+   string getStr() {
+      auto len = get<uint16>();
+      if (left() < len)
+         throw runtime_error("Truncated .binlog");
+      string res(reinterpret_cast<const sbyte*>(cur), len);
+      cur += len;
+      return res;
+   }
+
+   Reader sub(size_t len) {
+      if (left() < len)
+         throw runtime_error("Truncated .binlog");
+      Reader res(cur, cur + len);
+      cur += len;
+      return res;
+   }
+
+  private:
+   Reader(const ubyte* begin, const ubyte* end) : cur{begin}, end{end} {}
+
+   const ubyte* cur;
+   const ubyte* end;
+};
+
+static void decodeArg(Reader& in, BinLog::ArgType type, stringstream& out) {
+   using T = BinLog::ArgType;
+   switch (type) {
+      // Widen the ubyte-sized ones so they print as numbers, like they would have through Logger
+      case T::I8: out << static_cast<int>(in.get<int8>()); break;
+      case T::U8: out << static_cast<unsigned>(in.get<uint8>()); break;
+      case T::I16: out << in.get<int16>(); break;
+      case T::U16: out << in.get<uint16>(); break;
+      case T::I32: out << in.get<int32>(); break;
+      case T::U32: out << in.get<uint32>(); break;
+      case T::I64: out << in.get<int64>(); break;
+      case T::U64: out << in.get<uint64>(); break;
+      case T::F32: out << in.get<float>(); break;
+      case T::F64: out << in.get<double>(); break;
+      case T::Bool: out << in.get<bool>(); break;
+      case T::Char: out << in.get<char>(); break;
+      case T::Str: out << in.getStr(); break;
+      default: throw runtime_error("Unknown argument type " + to_string(ToBase(type)));
+   }
+}
+
+/// Rebuilds exactly what Logger::Write would have printed
+static string decodeEvent(Reader& in, const Format& fmt, double secs) {
+   stringstream out;
+   out << "[" << fmt.type << "]@" << secs << "s: ";
+
+   size_t arg = 0;
+   for (size_t i = 0; i < fmt.format.size(); i++) {
+      if (fmt.format[i] == '{' && i + 1 < fmt.format.size() && fmt.format[i + 1] == '}') {
+         decodeArg(in, fmt.signature.at(arg++), out);
+         i++;
+      } else
+         out << fmt.format[i];
+   }
+
+   auto message = out.str();
+   for (char& ch : message)
+      if (ch == '\n')
+         ch = ' ';
+   return message;
+}
+
+int main(int argc, char** argv) {
+   if (argc < 2) {
+      cerr << "Usage: " << argv[0] << " <in.binlog> [out.log]" << endl;
+      return 1;
+   }
+
+   try {
+      ifstream file(argv[1], ios::binary);
+      if (!file)
+         throw runtime_error(string("Failed to open ") + argv[1]);
+      vector<ubyte> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+      Reader in(data);
+
+      char magic[sizeof(BinLog::Magic)];
+      for (auto& ch : magic)
+         ch = in.get<char>();
+      if (memcmp(magic, BinLog::Magic, sizeof(magic)) != 0)
+         throw runtime_error("Not a .binlog");
+      if (auto version = in.get<uint32>(); version != BinLog::Version)
+         throw runtime_error("Unsupported .binlog version " + to_string(version));
+
+      auto ticksPerSec = in.get<double>();
+      auto baseTicks   = in.get<uint64>();
+
+      vector<Format> formats;
+      vector<Event>  events;
+
+      while (!in.done()) {
+         auto entry = in.get<BinLog::Entry>();
+         if (entry == BinLog::Entry::Format) {
+            auto id = in.get<uint32>();
+            if (id >= formats.size())
+               formats.resize(id + 1);
+
+            auto& fmt  = formats[id];
+            fmt.type   = in.getStr();
+            fmt.format = in.getStr();
+            fmt.signature.resize(in.get<uint8>());
+            for (auto& arg : fmt.signature)
+               arg = in.get<BinLog::ArgType>();
+         } else if (entry == BinLog::Entry::Chunk) {
+            auto chunk = in.sub(in.get<uint32>());
+            while (!chunk.done()) {
+               auto id    = chunk.get<uint32>();
+               auto ticks = chunk.get<uint64>();
+               // Signed, so a thread whose TSC is a little behind the calibrating one's doesn't wrap to ~centuries
+               auto since = static_cast<int64>(ticks - baseTicks);
+               events.push_back({ticks, decodeEvent(chunk, formats.at(id), since / ticksPerSec)});
+            }
+         } else
+            throw runtime_error("Unknown entry tag " + to_string(ToBase(entry)));
+      }
+
+      // Each chunk is from one thread, so the file as a whole isn't in time order.
+      stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.ticks < b.ticks; });
+
+      ofstream outFile;
+      if (argc > 2)
+         outFile.open(argv[2]);
+      ostream& out = argc > 2 ? outFile : cout;
+
+      for (const auto& event : events)
+         out << event.message << '\n';
+   } catch (const std::exception& e) {
+      cerr << "glen-logdecode: " << e.what() << endl;
+      return 1;
+   }
+
+   return 0;
+}
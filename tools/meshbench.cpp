@@ -0,0 +1,149 @@
+// glen-meshbench: how many blocks a second ChunkMesher gets through, on one thread and across a MeshingPool.
+// Usage: glen-meshbench [threads] [repeats]
+//
+// Meshes a few worlds' worth of chunks: rolling terrain (the normal case), noisy caves (lots of small faces) and a
+// checkerboard (the worst case, nothing merges). Pool results get copied into one big buffer, as they would be into
+// an upload, so that's counted too.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ChunkMesher.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+constexpr int32 GridX = 8, GridY = 4, GridZ = 8;
+
+static uint32 Hash(int32 x, int32 y, int32 z) {
+   uint32 h = uint32(x) * 0x8da6b343u ^ uint32(y) * 0xd8163841u ^ uint32(z) * 0xcb1ab31fu;
+   h ^= h >> 15;
+   h *= 0x2c1b3c6du;
+   h ^= h >> 12;
+   return h;
+}
+
+static BlockId Terrain(int32 x, int32 y, int32 z) {
+   float height = 48.0f + 20.0f * sinf(x * 0.05f) * cosf(z * 0.04f) + 6.0f * sinf(x * 0.21f + z * 0.17f);
+   if (y > height)
+      return 0;
+   if (y > height - 1)
+      return 1;  // Grass
+   return y > height - 4 ? 2 : 3 + (Hash(x, y, z) % 64 == 0);  // Dirt, stone, some ore
+}
+
+static BlockId Caves(int32 x, int32 y, int32 z) {
+   return Hash(x >> 1, y >> 1, z >> 1) % 100 < 55 ? 3 : 0;
+}
+
+static BlockId Checkerboard(int32 x, int32 y, int32 z) {
+   return (x + y + z) & 1;
+}
+
+struct World {
+   string                                name;
+   vector<unique_ptr<Chunk>>             chunks;
+   vector<shared_ptr<const PaddedChunk>> padded;
+};
+
+static World Generate(const string& name, function<BlockId(int32, int32, int32)> block) {
+   World world{name, {}, {}};
+   world.chunks.resize(GridX * GridY * GridZ);
+
+   auto index = [](int32 cx, int32 cy, int32 cz) { return cx + cy * GridX + cz * GridX * GridY; };
+   for (int32 cz = 0; cz < GridZ; cz++)
+      for (int32 cy = 0; cy < GridY; cy++)
+         for (int32 cx = 0; cx < GridX; cx++) {
+            auto chunk = make_unique<Chunk>();
+            for (int32 z = 0; z < ChunkSize; z++)
+               for (int32 y = 0; y < ChunkSize; y++)
+                  for (int32 x = 0; x < ChunkSize; x++)
+                     chunk->at(x, y, z) = block(cx * ChunkSize + x, cy * ChunkSize + y, cz * ChunkSize + z);
+            world.chunks[index(cx, cy, cz)] = move(chunk);
+         }
+
+   for (int32 cz = 0; cz < GridZ; cz++)
+      for (int32 cy = 0; cy < GridY; cy++)
+         for (int32 cx = 0; cx < GridX; cx++) {
+            const Chunk* neighbours[27];
+            for (int32 dz = -1; dz <= 1; dz++)
+               for (int32 dy = -1; dy <= 1; dy++)
+                  for (int32 dx = -1; dx <= 1; dx++) {
+                     int32 nx = cx + dx, ny = cy + dy, nz = cz + dz;
+                     bool  in = nx >= 0 && ny >= 0 && nz >= 0 && nx < GridX && ny < GridY && nz < GridZ;
+                     neighbours[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 9] =
+                         in ? world.chunks[index(nx, ny, nz)].get() : nullptr;
+                  }
+
+            auto padded = make_shared<PaddedChunk>();
+            padded->fill(neighbours);
+            world.padded.push_back(move(padded));
+         }
+
+   return world;
+}
+
+static void Report(const char* what, size_t chunks, size_t quads, double seconds) {
+   double blocks = double(chunks) * ChunkVolume;
+   printf("  %-10s %8.0f chunks/s  %8.2f Mblocks/s  %10zu quads  %7.2f ms/chunk\n", what, chunks / seconds,
+          blocks / seconds / 1e6, quads, seconds * 1e3 / chunks);
+}
+
+int main(int argc, char** argv) {
+   size_t threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : max(1u, thread::hardware_concurrency());
+   int32  repeats = argc > 2 ? atoi(argv[2]) : 8;
+
+   printf("%d³ chunks, %d chunks per world, %zu threads, %d repeats\n", ChunkSize, GridX * GridY * GridZ, threads,
+          repeats);
+
+   World worlds[] = {Generate("terrain", Terrain), Generate("caves", Caves), Generate("checker", Checkerboard)};
+
+   JobSystem           jobs(threads);
+   ChunkMesher         mesher;
+   MeshingPool         pool(jobs);
+   vector<VoxelVertex> vertices;
+   vector<ubyte>       upload;
+   atomic<size_t>      uploadHead{0};
+
+   for (auto& world : worlds) {
+      printf("%s\n", world.name.c_str());
+
+      // One thread
+      size_t quads = 0;
+      auto   start = Clock::now();
+      for (int32 r = 0; r < repeats; r++)
+         for (auto& padded : world.padded) {
+            vertices.clear();
+            quads += mesher.mesh(*padded, vertices);
+         }
+      Report("1 thread", world.padded.size() * repeats, quads / repeats,
+             chrono::duration<double>(Clock::now() - start).count());
+
+      // Pool, straight into the "upload" buffer
+      upload.resize(quads / repeats * 4 * sizeof(VoxelVertex));
+      atomic<size_t> poolQuads{0};
+      start = Clock::now();
+      for (int32 r = 0; r < repeats; r++) {
+         uploadHead = 0;
+         for (auto& padded : world.padded)
+            pool.submit(padded, [&](const VoxelVertex* verts, size_t count) {
+               size_t bytes = count * 4 * sizeof(VoxelVertex);
+               memcpy(&upload[uploadHead.fetch_add(bytes, memory_order_relaxed)], verts, bytes);
+               poolQuads.fetch_add(count, memory_order_relaxed);
+            });
+         pool.waitIdle();
+      }
+      Report("pool", world.padded.size() * repeats, poolQuads / repeats,
+             chrono::duration<double>(Clock::now() - start).count());
+   }
+
+   return 0;
+}
@@ -0,0 +1,162 @@
+// glen-regionbench: world save/load throughput through RegionStore.
+// Usage: glen-regionbench [directory] [chunksX] [chunksY] [chunksZ] [threads]
+//
+// Wipes directory, saves a generated terrain world into it in batches, loads every chunk back on one thread and then
+// on several, and finally overwrites half the world and compacts. Generation isn't timed. Loads will mostly be from
+// the page cache, since we just wrote it all; that's the mmap + decompress cost on its own.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RegionFile.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static uint32 Hash(int32 x, int32 y, int32 z) {
+   uint32 h = uint32(x) * 0x8da6b343u ^ uint32(y) * 0xd8163841u ^ uint32(z) * 0xcb1ab31fu;
+   h ^= h >> 15;
+   h *= 0x2c1b3c6du;
+   h ^= h >> 12;
+   return h;
+}
+
+static BlockId Terrain(int32 x, int32 y, int32 z) {
+   float height = 64.0f + 24.0f * sinf(x * 0.02f) * cosf(z * 0.015f) + 6.0f * sinf(x * 0.11f + z * 0.07f);
+   if (y > height)
+      return y < 56 ? 9 : 0;  // Water below sea level, otherwise air
+   if (y > height - 1)
+      return 1;
+   if (y > height - 4)
+      return 2;
+   return Hash(x, y, z) % 128 == 0 ? 4 + Hash(z, x, y) % 4 : 3;
+}
+
+static void Generate(int32 cx, int32 cy, int32 cz, Chunk& chunk, BlockId salt = 0) {
+   for (int32 z = 0; z < ChunkSize; z++)
+      for (int32 y = 0; y < ChunkSize; y++)
+         for (int32 x = 0; x < ChunkSize; x++)
+            chunk.at(x, y, z) = Terrain(cx * ChunkSize + x, cy * ChunkSize + y, cz * ChunkSize + z) + salt;
+}
+
+static uint64 DirectorySize(const string& dir) {
+   uint64 total = 0;
+   for (auto& entry : filesystem::directory_iterator(dir))
+      total += entry.file_size();
+   return total;
+}
+
+int main(int argc, char** argv) {
+   string dir = argc > 1 ? argv[1] : "regionbench.world";
+   int32  gx = argc > 2 ? atoi(argv[2]) : 32, gy = argc > 3 ? atoi(argv[3]) : 4, gz = argc > 4 ? atoi(argv[4]) : 32;
+   size_t threads = argc > 5 ? strtoul(argv[5], nullptr, 10) : max(1u, thread::hardware_concurrency());
+
+   size_t count    = size_t(gx) * gy * gz;
+   double rawBytes = double(count) * sizeof(Chunk);
+   printf("%zu %d³ chunks (%dx%dx%d), %.0f MiB raw, into %s\n", count, ChunkSize, gx, gy, gz, rawBytes / 1048576,
+          dir.c_str());
+
+   filesystem::remove_all(dir);
+   auto store = make_unique<RegionStore>(dir);
+
+   // Save, a region column's worth of chunks at a time
+   constexpr size_t   Batch = 512;
+   vector<Chunk>      chunks(Batch);
+   vector<ChunkWrite> writes;
+   double             saveTime = 0;
+
+   auto saveWorld = [&](bool half, BlockId salt) {
+      writes.clear();
+      auto flush = [&] {
+         auto start = Clock::now();
+         if (!store->save(writes))
+            printf("  save failed!\n");
+         saveTime += chrono::duration<double>(Clock::now() - start).count();
+         writes.clear();
+      };
+      for (int32 cz = 0; cz < gz; cz++)
+         for (int32 cx = 0; cx < gx; cx++)
+            for (int32 cy = 0; cy < gy; cy++) {
+               if (half && (cx + cz) % 2)
+                  continue;
+               Chunk& chunk = chunks[writes.size()];
+               Generate(cx, cy, cz, chunk, salt);
+               writes.push_back({cx, cy, cz, &chunk});
+               if (writes.size() == Batch)
+                  flush();
+            }
+      if (!writes.empty())
+         flush();
+   };
+
+   saveWorld(false, 0);
+   uint64 fileBytes = DirectorySize(dir);
+   printf("  save        %8.0f chunks/s  %8.1f MiB/s raw   %.1f MiB on disk (%.1fx)\n", count / saveTime,
+          rawBytes / saveTime / 1048576, fileBytes / 1048576.0, rawBytes / fileBytes);
+
+   // Load with a fresh store, so the region files get opened and mapped as part of it
+   store = make_unique<RegionStore>(dir);
+
+   auto   out      = make_unique<Chunk>();
+   auto   expected = make_unique<Chunk>();
+   size_t missing  = 0;
+   auto   start    = Clock::now();
+   for (int32 cz = 0; cz < gz; cz++)
+      for (int32 cx = 0; cx < gx; cx++)
+         for (int32 cy = 0; cy < gy; cy++)
+            missing += !store->load(cx, cy, cz, *out);
+   double loadTime = chrono::duration<double>(Clock::now() - start).count();
+   printf("  load        %8.0f chunks/s  %8.1f MiB/s raw   (%zu missing)\n", count / loadTime,
+          rawBytes / loadTime / 1048576, missing);
+
+   atomic<size_t> next{0};
+   start = Clock::now();
+   vector<thread> workers;
+   for (size_t t = 0; t < threads; t++)
+      workers.emplace_back([&] {
+         auto chunk = make_unique<Chunk>();
+         for (size_t i; (i = next.fetch_add(1)) < count;)
+            store->load(i % gx, i / gx % gy, i / gx / gy, *chunk);
+      });
+   for (auto& worker : workers)
+      worker.join();
+   loadTime = chrono::duration<double>(Clock::now() - start).count();
+   printf("  load x%-4zu  %8.0f chunks/s  %8.1f MiB/s raw\n", threads, count / loadTime, rawBytes / loadTime / 1048576);
+
+   // Overwrite half of it, which leaves the old payloads as dead space, then compact every region
+   saveTime = 0;
+   saveWorld(true, 1);
+   uint64 before = DirectorySize(dir);
+
+   start = Clock::now();
+   for (int32 rz = 0; rz * RegionSize < gz; rz++)
+      for (int32 ry = 0; ry * RegionSize < gy; ry++)
+         for (int32 rx = 0; rx * RegionSize < gx; rx++)
+            if (auto region = store->region(rx, ry, rz, false))
+               region->compact();
+   double compactTime = chrono::duration<double>(Clock::now() - start).count();
+   printf("  compact     %.1f MiB -> %.1f MiB in %.0f ms\n", before / 1048576.0, DirectorySize(dir) / 1048576.0,
+          compactTime * 1e3);
+
+   // Spot check a few chunks made it through all that intact
+   size_t wrong = 0;
+   for (size_t i = 0; i < count; i += max<size_t>(1, count / 64)) {
+      int32 cx = i % gx, cy = i / gx % gy, cz = i / gx / gy;
+      Generate(cx, cy, cz, *expected, (cx + cz) % 2 ? 0 : 1);
+      wrong += !store->load(cx, cy, cz, *out) || memcmp(out->blocks, expected->blocks, sizeof(out->blocks)) != 0;
+   }
+   if (wrong)
+      printf("  %zu chunks came back wrong!\n", wrong);
+
+   return wrong ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+// glen-snapshotbench: registry snapshot save/load times.
+// Usage: glen-snapshotbench [entities] [file]
+//
+// Builds a registry of moving things (every one has a Position and Velocity, half have Health, a tenth are Static),
+// then times a full snapshot into memory and to a file, loading that file back into an empty registry, and a delta
+// after touching 1% of it. The loaded registries are compared against the original at the end.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "RegistrySnapshot.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Position {
+   float x, y, z;
+};
+struct Velocity {
+   float x, y, z;
+};
+struct Health {
+   int32 current, max;
+};
+struct Static {};
+
+SNAPSHOT_COMPONENT(Position, 1);
+SNAPSHOT_COMPONENT(Velocity, 1);
+SNAPSHOT_COMPONENT(Health, 1);
+SNAPSHOT_COMPONENT(Static, 1);
+
+using Snapshot = RegistrySnapshot<Position, Velocity, Health, Static>;
+using Delta    = RegistryDelta<Position, Velocity, Health, Static>;
+
+template <typename F>
+static double Time(F&& f) {
+   auto start = Clock::now();
+   f();
+   return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+template <typename Component>
+static size_t Differences(const entt::registry& a, const entt::registry& b) {
+   auto   view  = a.view<const Component>();
+   size_t wrong = view.size() != b.view<const Component>().size();
+   for (size_t i = 0; i < view.size(); i++) {
+      entt::entity entity = view.data()[i];
+      if (!b.valid(entity) || !b.has<Component>(entity))
+         wrong++;
+      else if constexpr (!std::is_empty_v<Component>)
+         wrong += memcmp(&a.get<Component>(entity), &b.get<Component>(entity), sizeof(Component)) != 0;
+   }
+   return wrong;
+}
+
+static size_t Differences(const entt::registry& a, const entt::registry& b) {
+   size_t wrong = 0;
+   a.each([&](entt::entity entity) { wrong += !b.valid(entity); });
+   b.each([&](entt::entity entity) { wrong += !a.valid(entity); });
+   return wrong + Differences<Position>(a, b) + Differences<Velocity>(a, b) + Differences<Health>(a, b) +
+          Differences<Static>(a, b);
+}
+
+int main(int argc, char** argv) {
+   size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+   string path  = argc > 2 ? argv[2] : "snapshotbench.snap";
+
+   entt::registry registry;
+   for (size_t i = 0; i < count; i++) {
+      auto entity = registry.create();
+      registry.emplace<Position>(entity, float(i), 0.0f, float(i % 1000));
+      registry.emplace<Velocity>(entity, 1.0f, 0.0f, -1.0f);
+      if (i % 2 == 0)
+         registry.emplace<Health>(entity, int32(i % 100), 100);
+      if (i % 10 == 0)
+         registry.emplace<Static>(entity);
+   }
+   printf("%zu entities\n", count);
+
+   // Full snapshots
+   Snapshot       snapshot;
+   vector<ubyte>  memory;
+   SnapshotWriter writer(1);
+   double         saveTime = Time([&] {
+      snapshot.save(registry, writer);
+      writer.write(memory);
+   });
+   printf("  save to memory   %7.2f ms  %6.1f MiB\n", saveTime, memory.size() / 1048576.0);
+
+   bool   written   = false;
+   double writeTime = Time([&] { written = writer.write(path); });
+   printf("  save to file     %7.2f ms%s\n", writeTime, written ? "" : "  (failed!)");
+
+   entt::registry loaded;
+   bool           ok       = false;
+   double         loadTime = Time([&] {
+      SnapshotFile file(path);
+      ok = file.isValid() && Snapshot::Load(file.view(), loaded);
+   });
+   printf("  load from file   %7.2f ms%s\n", loadTime, ok ? "" : "  (failed!)");
+
+   // A baseline, then a frame where 1% of things move, get hurt, or are replaced
+   Delta         delta;
+   vector<ubyte> base, changes;
+   {
+      SnapshotWriter baseWriter(1);
+      delta.save(registry, baseWriter);
+      baseWriter.write(base);
+   }
+
+   size_t touched = count / 100;
+   for (size_t i = 0; i < touched; i++) {
+      auto entity = entt::entity(uint32(i * 97 % count));
+      if (!registry.valid(entity))
+         continue;
+      switch (i % 4) {
+         case 0: registry.get<Position>(entity).x += 1.0f; break;
+         case 1: registry.emplace_or_replace<Health>(entity, 1, 100); break;
+         case 2: registry.remove_if_exists<Static>(entity); break;
+         case 3:
+            registry.destroy(entity);
+            registry.emplace<Position>(registry.create(), 0.0f, 0.0f, 0.0f);
+            break;
+      }
+   }
+
+   SnapshotWriter deltaWriter(2, Some<uint64>(1));
+   double         deltaTime = Time([&] {
+      delta.save(registry, deltaWriter);
+      deltaWriter.write(changes);
+   });
+   printf("  delta            %7.2f ms  %6.1f KiB for %zu changes\n", deltaTime, changes.size() / 1024.0, touched);
+
+   entt::registry replayed;
+   double         applyTime = Time([&] {
+      ok = Delta::Apply(SnapshotView(base.data(), base.size()), replayed) &&
+           Delta::Apply(SnapshotView(changes.data(), changes.size()), replayed);
+   });
+   printf("  apply base+delta %7.2f ms%s\n", applyTime, ok ? "" : "  (failed!)");
+
+   // loaded was taken before the changes, so bring it up to date with the delta too
+   Delta::Apply(SnapshotView(changes.data(), changes.size()), loaded);
+   size_t wrong = Differences(registry, loaded) + Differences(registry, replayed);
+   if (wrong)
+      printf("  %zu differences after loading!\n", wrong);
+
+   remove(path.c_str());
+   return wrong ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+// glen-storagebench: resident memory and access speed of PalettedChunk against plain dense Chunks.
+// Usage: glen-storagebench [chunksX] [chunksY] [chunksZ]
+//
+// Generates a terrain world (air on top, a few surface layers, stone with ore underneath) and stores it both ways,
+// then times random reads, random writes and filling PaddedChunks for the mesher out of each.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "PalettedChunk.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static uint32 Hash(int32 x, int32 y, int32 z) {
+   uint32 h = uint32(x) * 0x8da6b343u ^ uint32(y) * 0xd8163841u ^ uint32(z) * 0xcb1ab31fu;
+   h ^= h >> 15;
+   h *= 0x2c1b3c6du;
+   h ^= h >> 12;
+   return h;
+}
+
+static BlockId Terrain(int32 x, int32 y, int32 z) {
+   float height = 96.0f + 24.0f * sinf(x * 0.02f) * cosf(z * 0.015f) + 6.0f * sinf(x * 0.11f + z * 0.07f);
+   if (y > height)
+      return y < 80 ? 9 : 0;  // Water below sea level, otherwise air
+   if (y > height - 1)
+      return 1;  // Grass
+   if (y > height - 4)
+      return 2;  // Dirt
+   return Hash(x, y, z) % 128 == 0 ? 4 + Hash(z, x, y) % 4 : 3;  // Stone, four kinds of ore
+}
+
+template <typename F>
+static double Time(F&& f) {
+   auto start = Clock::now();
+   f();
+   return chrono::duration<double>(Clock::now() - start).count();
+}
+
+/// What the mesher does with them: pad every chunk with its neighbours.
+template <typename Storage>
+static uint64 PadAll(const vector<const Storage*>& chunks, int32 gx, int32 gy, int32 gz, PaddedChunk& padded) {
+   uint64 sum = 0;
+   for (int32 cz = 0; cz < gz; cz++)
+      for (int32 cy = 0; cy < gy; cy++)
+         for (int32 cx = 0; cx < gx; cx++) {
+            const Storage* neighbours[27];
+            for (int32 n = 0; n < 27; n++) {
+               int32 nx = cx + n % 3 - 1, ny = cy + n / 3 % 3 - 1, nz = cz + n / 9 - 1;
+               bool  in      = nx >= 0 && ny >= 0 && nz >= 0 && nx < gx && ny < gy && nz < gz;
+               neighbours[n] = in ? chunks[nx + ny * gx + nz * gx * gy] : nullptr;
+            }
+            padded.fill(neighbours);
+            sum += padded.blocks[(cx + cy + cz) % PaddedChunk::Volume];
+         }
+   return sum;
+}
+
+int main(int argc, char** argv) {
+   int32 gx = argc > 1 ? atoi(argv[1]) : 16, gy = argc > 2 ? atoi(argv[2]) : 8, gz = argc > 3 ? atoi(argv[3]) : 16;
+   size_t count = size_t(gx) * gy * gz;
+
+   vector<unique_ptr<Chunk>> dense(count);
+   vector<PalettedChunk>     paletted;
+   paletted.reserve(count);
+
+   for (int32 cz = 0, i = 0; cz < gz; cz++)
+      for (int32 cy = 0; cy < gy; cy++)
+         for (int32 cx = 0; cx < gx; cx++, i++) {
+            dense[i] = make_unique<Chunk>();
+            for (int32 z = 0; z < ChunkSize; z++)
+               for (int32 y = 0; y < ChunkSize; y++)
+                  for (int32 x = 0; x < ChunkSize; x++)
+                     dense[i]->at(x, y, z) = Terrain(cx * ChunkSize + x, cy * ChunkSize + y, cz * ChunkSize + z);
+         }
+
+   double convert = Time([&] {
+      for (auto& chunk : dense)
+         paletted.push_back(PalettedChunk::FromDense(*chunk));
+   });
+
+   // Memory
+   size_t denseBytes = count * sizeof(Chunk), palettedBytes = 0, uniform = 0;
+   size_t bitHistogram[17] = {};
+   for (auto& chunk : paletted) {
+      palettedBytes += chunk.memoryUsage();
+      uniform += chunk.isUniform();
+      bitHistogram[chunk.bitsPerBlock()]++;
+   }
+
+   printf("%zu %d³ chunks (%dx%dx%d), FromDense %.2f ms/chunk\n", count, ChunkSize, gx, gy, gz, convert * 1e3 / count);
+   printf("  dense     %10.2f MiB\n", denseBytes / 1048576.0);
+   printf("  paletted  %10.2f MiB  (%.1fx smaller, %zu uniform)\n", palettedBytes / 1048576.0,
+          double(denseBytes) / palettedBytes, uniform);
+   printf("  bits/block:");
+   for (int32 bits = 0; bits <= 16; bits++)
+      if (bitHistogram[bits])
+         printf(" %d:%zu", bits, bitHistogram[bits]);
+   printf("\n");
+
+   // Random reads and writes, same sequence of positions for both
+   constexpr size_t Ops = 1 << 24;
+   vector<uint32>   positions(Ops);
+   mt19937          rng(1);
+   for (auto& pos : positions)
+      pos = rng() % (count * ChunkVolume);
+
+   uint64 sum       = 0;
+   double denseRead = Time([&] {
+      for (uint32 pos : positions)
+         sum += dense[pos / ChunkVolume]->blocks[pos % ChunkVolume];
+   });
+   double palRead = Time([&] {
+      for (uint32 pos : positions)
+         sum += paletted[pos / ChunkVolume].get(pos % ChunkVolume);
+   });
+
+   double denseWrite = Time([&] {
+      for (size_t i = 0; i < Ops; i++)
+         dense[positions[i] / ChunkVolume]->blocks[positions[i] % ChunkVolume] = BlockId(i % 8);
+   });
+   double palWrite = Time([&] {
+      for (size_t i = 0; i < Ops; i++)
+         paletted[positions[i] / ChunkVolume].set(positions[i] % ChunkVolume, BlockId(i % 8));
+   });
+
+   vector<const Chunk*>         denseChunks;
+   vector<const PalettedChunk*> palettedChunks;
+   for (size_t i = 0; i < count; i++) {
+      denseChunks.push_back(dense[i].get());
+      palettedChunks.push_back(&paletted[i]);
+   }
+
+   auto   padded   = make_unique<PaddedChunk>();
+   double densePad = Time([&] { sum += PadAll(denseChunks, gx, gy, gz, *padded); });
+   double palPad   = Time([&] { sum += PadAll(palettedChunks, gx, gy, gz, *padded); });
+
+   printf("                 dense       paletted\n");
+   printf("  random get  %8.2f ns  %8.2f ns\n", denseRead * 1e9 / Ops, palRead * 1e9 / Ops);
+   printf("  random set  %8.2f ns  %8.2f ns\n", denseWrite * 1e9 / Ops, palWrite * 1e9 / Ops);
+   printf("  pad chunk   %8.2f us  %8.2f us\n", densePad * 1e6 / count, palPad * 1e6 / count);
+
+   // After all those random writes every chunk's noise; see how far compact() gets it back
+   palettedBytes = 0;
+   for (auto& chunk : paletted) {
+      chunk.compact();
+      palettedBytes += chunk.memoryUsage();
+   }
+   printf("  after 8-block noise writes + compact(): %.2f MiB (checksum %llu)\n", palettedBytes / 1048576.0,
+          (unsigned long long)sum);
+
+   return 0;
+}